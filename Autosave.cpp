@@ -0,0 +1,240 @@
+#include "Autosave.h"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <zlib.h>
+#include "Trace.h"
+
+namespace {
+	const std::string AUTOSAVE_INFIX = ".autosave-";
+
+	std::string timestamp() {
+		std::time_t now = std::time(nullptr);
+		std::tm local{};
+#ifdef _WIN32
+		localtime_s(&local, &now);
+#else
+		localtime_r(&now, &local);
+#endif
+		char buffer[32];
+		std::strftime(buffer, sizeof(buffer), "%Y%m%d-%H%M%S", &local);
+		return buffer;
+	}
+
+	// Deletes the oldest autosaves of the map, the timestamps sort them by name
+	void pruneAutosaves(const std::filesystem::path& directory, const std::string& name, int kept) {
+		std::string prefix = name + AUTOSAVE_INFIX;
+		std::vector<std::filesystem::path> autosaves;
+		std::error_code code;
+		for (const auto& entry : std::filesystem::directory_iterator(directory, code)) {
+			std::string filename = entry.path().filename().string();
+			if (filename.starts_with(prefix) && filename.ends_with(".tmx"))
+				autosaves.push_back(entry.path());
+		}
+		std::sort(autosaves.begin(), autosaves.end());
+		for (size_t i = 0; i + std::max(kept, 1) < autosaves.size(); i++)
+			std::filesystem::remove(autosaves[i], code);
+	}
+}
+
+std::string autosaveDirectory(const AutosaveOptions& options) {
+	if (!options.directory.empty())
+		return options.directory;
+	return (std::filesystem::temp_directory_path() / "tilemapeditor-autosave").string();
+}
+
+std::string autosaveName(const std::string& map_path, const std::string& untitled_id) {
+	if (map_path.empty())
+		return "untitled-" + untitled_id;
+	std::string name = std::filesystem::path(map_path).stem().string();
+	size_t suffix = name.find(AUTOSAVE_INFIX);
+	if (suffix != std::string::npos)
+		return name.substr(0, suffix);
+
+	std::error_code code;
+	std::string absolute = std::filesystem::absolute(map_path, code).lexically_normal().string();
+	uint32_t hash = (uint32_t)crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(absolute.data()), (uInt)absolute.size());
+	char id[16];
+	snprintf(id, sizeof(id), "-%08x", hash);
+	return name + id;
+}
+
+std::string makeUntitledID() {
+	std::random_device device;
+	char id[32];
+	snprintf(id, sizeof(id), "%s-%04x", timestamp().c_str(), device() & 0xFFFF);
+	return id;
+}
+
+bool saveSnapshotTMX(const MapSnapshot& snapshot, const std::string& path, TMXEncoding encoding, TMXSaveCache* cache, std::string& error) {
+	TMXMapInfo info{ .width = snapshot.width, .height = snapshot.height, .tile_size = snapshot.tile_size, .layer_count = (int)snapshot.layers.size() };
+	TMXWriter writer(info);
+
+	// Same GIDs as PaletteArea::saveTextureToTMX
+	std::map<int, TextureData> tilesets;
+	int first_gid = 1;
+	for (const SnapshotTexture& texture : snapshot.textures) {
+		int
+			columns = texture.image_w / snapshot.tile_size,
+			tile_count = columns * (texture.image_h / snapshot.tile_size);
+		tilesets[texture.id] = addTMXTileset(
+			writer.getDocument(), writer.getMapElement(), first_gid, texture.name, snapshot.tile_size,
+			columns, tile_count, texture.path, texture.image_w, texture.image_h);
+		first_gid += tile_count;
+	}
+
+	writer.setCache(cache);
+	if (!writer.open(path)) {
+		error = "Failed to open " + path;
+		return false;
+	}
+	for (size_t layer = 0; layer < snapshot.layers.size(); layer++) {
+		bool success = writer.writeLayer(
+			(int)layer + 1,
+			layer < snapshot.layer_names.size() ? snapshot.layer_names[layer] : "Layer " + std::to_string(layer),
+			layer < snapshot.layer_visibles.size() ? snapshot.layer_visibles[layer] : true,
+			snapshot.layers[layer], tilesets, encoding);
+		if (!success) {
+			error = "Failed to encode layer " + std::to_string(layer);
+			return false;
+		}
+	}
+	if (!writer.close()) {
+		error = "Failed to write " + path;
+		return false;
+	}
+	return true;
+}
+
+void Autosaver::start() {
+	if (worker.joinable())
+		return;
+	stopping = false;
+	worker = std::thread([this]() { run(); });
+}
+
+void Autosaver::stop() {
+	if (!worker.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+	worker.join();
+}
+
+bool Autosaver::isIdle() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return !busy;
+}
+
+void Autosaver::waitIdle() {
+	std::unique_lock<std::mutex> lock(mutex);
+	changed.wait(lock, [this]() { return !busy; });
+}
+
+bool Autosaver::submit(std::unique_ptr<MapSnapshot>&& snapshot, const AutosaveOptions& options, const std::string& name, std::string& path) {
+	SnapshotState state;
+	for (const TileLayer& layer : snapshot->layers)
+		state.revisions.emplace_back(layer.getUID(), layer.getRevision());
+	state.names = snapshot->layer_names;
+	state.visibles = snapshot->layer_visibles;
+	for (const SnapshotTexture& texture : snapshot->textures)
+		state.textures.push_back(std::to_string(texture.id) + ':' + texture.path);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (busy || !worker.joinable())
+			return false;
+		// The previous snapshot only counts once it is on the disk
+		if (has_submitted && last_succeeded)
+			written_state = std::move(submitted_state);
+		has_submitted = false;
+		if (state == written_state)
+			return false;
+
+		pending = std::move(snapshot);
+		pending_options = options;
+		pending_name = name;
+		pending_path = (std::filesystem::path(autosaveDirectory(options)) / (name + AUTOSAVE_INFIX + timestamp() + ".tmx")).string();
+		path = pending_path;
+		busy = true;
+	}
+	submitted_state = std::move(state);
+	has_submitted = true;
+	changed.notify_all();
+	return true;
+}
+
+void Autosaver::reset() {
+	written_state = SnapshotState();
+	submitted_state = SnapshotState();
+	has_submitted = false;
+}
+
+std::string Autosaver::getStatus() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return status;
+}
+
+void Autosaver::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		changed.wait(lock, [this]() { return stopping || pending != nullptr; });
+		if (pending == nullptr)
+			return;
+
+		std::unique_ptr<MapSnapshot> snapshot = std::move(pending);
+		AutosaveOptions options = pending_options;
+		std::string path = pending_path;
+		std::string name = pending_name;
+		lock.unlock();
+
+		std::string result;
+		bool succeeded = write(*snapshot, options, path, name, result);
+		// The chunks are released before anyone waiting for the worker is woken up
+		snapshot.reset();
+
+		lock.lock();
+		last_succeeded = succeeded;
+		status = result;
+		busy = false;
+		changed.notify_all();
+	}
+}
+
+bool Autosaver::write(
+	const MapSnapshot& snapshot,
+	const AutosaveOptions& options,
+	const std::string& path,
+	const std::string& name,
+	std::string& result)
+{
+	TRACE_SCOPE("Autosave");
+	std::error_code code;
+	std::filesystem::path directory = std::filesystem::path(path).parent_path();
+	std::filesystem::create_directories(directory, code);
+
+	// Written next to its final name, so that a crash never leaves a truncated autosave behind
+	std::string temporary = path + ".tmp";
+	std::string error;
+	if (!saveSnapshotTMX(snapshot, temporary, options.encoding, &cache, error)) {
+		std::filesystem::remove(temporary, code);
+		result = "Autosave failed: " + error;
+		return false;
+	}
+	std::filesystem::rename(temporary, path, code);
+	if (code) {
+		std::filesystem::remove(temporary, code);
+		result = "Autosave failed: " + code.message();
+		return false;
+	}
+
+	pruneAutosaves(directory, name, options.kept);
+	result = "Autosaved to " + path;
+	return true;
+}
@@ -0,0 +1,132 @@
+#ifndef TILEMAPEDITOR_AUTOSAVE_H
+#define TILEMAPEDITOR_AUTOSAVE_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "TileLayer.h"
+#include "TMXWriter.h"
+
+constexpr int DEFAULT_AUTOSAVE_INTERVAL_S{ 120 };
+constexpr int DEFAULT_AUTOSAVES_KEPT{ 5 };
+// Shortest interval, autosaves are named after the current second
+constexpr int MIN_AUTOSAVE_INTERVAL_S{ 5 };
+
+struct AutosaveOptions {
+	// 0 disables autosaving
+	int interval_s{ DEFAULT_AUTOSAVE_INTERVAL_S };
+	// Older autosaves of the same map are deleted
+	int kept{ DEFAULT_AUTOSAVES_KEPT };
+	// See autosaveDirectory()
+	std::string directory{};
+	TMXEncoding encoding{ TMXEncoding::BASE64_ZLIB };
+};
+
+struct SnapshotTexture {
+	int id{ 0 };
+	std::string name{};
+	std::string path{};
+	int image_w{ 0 };
+	int image_h{ 0 };
+};
+
+// Everything needed to write the map, without any reference to the editor
+struct MapSnapshot {
+	int width{ 1 };
+	int height{ 1 };
+	int tile_size{ 1 };
+	// Made with TileLayer::snapshot()
+	std::vector<TileLayer> layers{};
+	std::vector<std::string> layer_names{};
+	std::vector<bool> layer_visibles{};
+	std::vector<SnapshotTexture> textures{};
+};
+
+// Defaults to a folder in the system temp directory, the journal is written there as well
+std::string autosaveDirectory(const AutosaveOptions& options);
+/*
+* Autosaves are named after the map file and a hash of its path, so that maps with the same name don't share them.
+* A map that was never saved is named after untitled_id instead, see makeUntitledID().
+* Opening an autosave keeps the name it already has.
+*/
+std::string autosaveName(const std::string& map_path, const std::string& untitled_id);
+// New id for a map that was never saved, unique across editor sessions
+std::string makeUntitledID();
+
+// Writes a snapshot as a TMX file, also used by the autosave worker
+bool saveSnapshotTMX(const MapSnapshot& snapshot, const std::string& path, TMXEncoding encoding, TMXSaveCache* cache, std::string& error);
+
+/*
+* Writes snapshots of the map from a worker thread, one at a time.
+* Files are named <name>.autosave-<date>-<time>.tmx, and only the most recent ones are kept.
+*
+* Usage:
+*   autosaver.start();
+*   if (autosaver.isIdle()) autosaver.submit(std::move(snapshot), options, name, path);
+*   autosaver.stop();
+*/
+class Autosaver {
+	std::thread worker{};
+	std::mutex mutex{};
+	std::condition_variable changed{};
+	// Guarded by mutex
+	std::unique_ptr<MapSnapshot> pending{};
+	AutosaveOptions pending_options{};
+	std::string pending_path{};
+	std::string pending_name{};
+	bool busy{ false };
+	bool stopping{ false };
+	std::string status{};
+
+	// Worker only: bands of the previous autosave
+	TMXSaveCache cache{};
+
+	// Layer ids/revisions, names and textures of a snapshot, nothing is written when they didn't change
+	struct SnapshotState {
+		std::vector<std::pair<uint64_t, uint64_t>> revisions{};
+		std::vector<std::string> names{};
+		std::vector<bool> visibles{};
+		std::vector<std::string> textures{};
+
+		bool operator==(const SnapshotState&) const = default;
+	};
+	// Main thread only: state of the last snapshot that reached the disk, and of the one submitted after it
+	SnapshotState written_state{};
+	SnapshotState submitted_state{};
+	bool has_submitted{ false };
+	// Guarded by mutex: whether the last snapshot taken by the worker was written
+	bool last_succeeded{ false };
+
+public:
+	Autosaver() = default;
+	Autosaver(const Autosaver&) = delete;
+	Autosaver& operator=(const Autosaver&) = delete;
+	~Autosaver() { stop(); }
+
+	void start();
+	// Writes the snapshot in progress, if any, before returning
+	void stop();
+	bool isIdle();
+	// Blocks until the snapshot being written, and every chunk it shares, is released
+	void waitIdle();
+	/*
+	* Returns false if the worker is busy or if nothing changed since the last snapshot written.
+	* A snapshot that failed to be written is tried again on the next call.
+	* Otherwise path is where the snapshot will be, once the worker is done with it.
+	*/
+	bool submit(std::unique_ptr<MapSnapshot>&& snapshot, const AutosaveOptions& options, const std::string& name, std::string& path);
+	// Forgets the previous snapshot, the next one is always written (e.g. when another map is opened)
+	void reset();
+	// Result of the last autosave, for display
+	std::string getStatus();
+
+private:
+	void run();
+	bool write(const MapSnapshot& snapshot, const AutosaveOptions& options, const std::string& path, const std::string& name, std::string& result);
+};
+
+#endif
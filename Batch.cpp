@@ -0,0 +1,255 @@
+#include "Batch.h"
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <thread>
+#include "TMXReader.h"
+#include "TMXWriter.h"
+#include "PNGExporter.h"
+
+namespace {
+	// Maps are already processed in parallel, each one uses a single thread
+	constexpr unsigned BATCH_MAP_THREADS{ 1 };
+
+	const std::map<std::string, TMXEncoding> encoding_arguments = {
+		{"csv", TMXEncoding::CSV},
+		{"base64", TMXEncoding::BASE64},
+		{"zlib", TMXEncoding::BASE64_ZLIB},
+		{"zstd", TMXEncoding::BASE64_ZSTD}
+	};
+
+	std::filesystem::path outputPath(const BatchOptions& options, const std::string& input, const std::string& extension) {
+		std::filesystem::path path(input);
+		std::filesystem::path directory = (options.output_dir.empty() ? path.parent_path() : std::filesystem::path(options.output_dir));
+		return directory / path.filename().replace_extension(extension);
+	}
+
+	bool convert(const BatchOptions& options, const std::string& input, std::string& message) {
+		TMXMapInfo info;
+		std::vector<TMXTileset> tilesets;
+		std::vector<TMXLayer> layers;
+		if (!loadTMX(input, info, tilesets, layers, message, BATCH_MAP_THREADS))
+			return false;
+
+		std::filesystem::path output = outputPath(options, input, ".tmx");
+		std::error_code code;
+		std::filesystem::path output_dir = std::filesystem::absolute(output.parent_path(), code);
+
+		TMXWriter writer(info);
+		std::map<int, TextureData> tileset_data;
+		for (size_t id = 0; id < tilesets.size(); id++) {
+			const TMXTileset& tileset = tilesets[id];
+			// Image paths are relative to the map file, so they have to follow it
+			std::filesystem::path image = std::filesystem::proximate(std::filesystem::absolute(tileset.image_path, code), output_dir, code);
+			int rows = (tileset.tile_count + tileset.columns - 1) / tileset.columns;
+			tileset_data[(int)id] = addTMXTileset(
+				writer.getDocument(), writer.getMapElement(), tileset.first_gid, tileset.name, info.tile_size,
+				tileset.columns, tileset.tile_count, image.generic_string(),
+				tileset.image_width > 0 ? tileset.image_width : tileset.columns * info.tile_size,
+				tileset.image_height > 0 ? tileset.image_height : rows * info.tile_size);
+		}
+
+		if (!writer.open(output.string())) {
+			message = "Failed to open " + output.string();
+			return false;
+		}
+		for (size_t layer = 0; layer < layers.size(); layer++) {
+			if (!writer.writeLayer((int)layer + 1, layers[layer].name, layers[layer].visible, layers[layer].tiles, tileset_data, options.encoding)) {
+				message = "Failed to write layer \"" + layers[layer].name + "\"";
+				return false;
+			}
+		}
+		if (!writer.close()) {
+			message = "Failed to write " + output.string();
+			return false;
+		}
+		message = output.string();
+		return true;
+	}
+
+	bool render(const BatchOptions& options, const std::string& input, std::string& message) {
+		TMXMapInfo info;
+		std::vector<TMXTileset> tilesets;
+		std::vector<TMXLayer> layers;
+		if (!loadTMX(input, info, tilesets, layers, message, BATCH_MAP_THREADS))
+			return false;
+
+		std::map<int, std::string> paths;
+		for (size_t id = 0; id < tilesets.size(); id++)
+			paths[(int)id] = tilesets[id].image_path;
+		std::map<int, TilesetImage> images;
+		if (!loadTilesetImages(paths, images, message))
+			return false;
+
+		std::vector<const TileLayer*> rendered;
+		for (const TMXLayer& layer : layers)
+			if (layer.visible || options.all_layers)
+				rendered.push_back(&layer.tiles);
+		if (rendered.empty()) {
+			message = "No visible layer";
+			return false;
+		}
+
+		std::filesystem::path output = outputPath(options, input, ".png");
+		if (!exportPNG(output.string(), rendered, images, info.tile_size, message, BATCH_MAP_THREADS))
+			return false;
+		message = output.string();
+		return true;
+	}
+
+	bool validate(const std::string& input, std::string& message) {
+		TMXMapInfo info;
+		std::vector<TMXTileset> tilesets;
+		std::vector<TMXLayer> layers;
+		if (!loadTMX(input, info, tilesets, layers, message, BATCH_MAP_THREADS))
+			return false;
+
+		for (size_t id = 0; id < tilesets.size(); id++) {
+			const TMXTileset& tileset = tilesets[id];
+			std::map<int, TilesetImage> images;
+			if (!loadTilesetImages({ { (int)id, tileset.image_path } }, images, message))
+				return false;
+			const TilesetImage& image = images[(int)id];
+			if ((tileset.image_width > 0 && tileset.image_width != image.width) ||
+				(tileset.image_height > 0 && tileset.image_height != image.height)) {
+				message = "Tileset \"" + tileset.name + "\": the image is " + std::to_string(image.width) + "x" + std::to_string(image.height) +
+					", the map declares " + std::to_string(tileset.image_width) + "x" + std::to_string(tileset.image_height);
+				return false;
+			}
+			int rows = (tileset.tile_count + tileset.columns - 1) / tileset.columns;
+			if (tileset.columns * info.tile_size > image.width || rows * info.tile_size > image.height) {
+				message = "Tileset \"" + tileset.name + "\": " + std::to_string(tileset.tile_count) + " tiles don't fit in its image";
+				return false;
+			}
+		}
+
+		// Every tile has to be inside its tileset
+		for (const TMXLayer& layer : layers) {
+			bool valid = true;
+			layer.tiles.forEachChunk([&](int, int, const PackedTile* tiles) {
+				for (int i = 0; i < CHUNK_AREA && valid; i++) {
+					if (tiles[i] == EMPTY_TILE)
+						continue;
+					Tile tile = unpackTile(tiles[i]);
+					const TMXTileset& tileset = tilesets[tile.texture_id];
+					valid = (tile.id_on_texture.y * tileset.columns + tile.id_on_texture.x < tileset.tile_count);
+				}
+			});
+			if (!valid) {
+				message = "Layer \"" + layer.name + "\" uses tiles outside of its tilesets";
+				return false;
+			}
+		}
+		message = "OK";
+		return true;
+	}
+}
+
+bool parseBatchArgs(int argc, char* argv[], BatchOptions& options, std::string& error) {
+	if (argc < 2)
+		return false;
+	std::string command(argv[1]);
+	if (command == "convert")
+		options.command = BatchCommand::CONVERT;
+	else if (command == "png")
+		options.command = BatchCommand::PNG;
+	else if (command == "validate")
+		options.command = BatchCommand::VALIDATE;
+	else
+		return false;
+
+	for (int i = 2; i < argc; i++) {
+		std::string arg(argv[i]);
+		bool has_value = (i + 1 < argc);
+		if (arg == "--output-dir" && has_value)
+			options.output_dir = argv[++i];
+		else if (arg == "--jobs" && has_value)
+			options.jobs = std::max(0, std::atoi(argv[++i]));
+		else if (arg == "--all-layers")
+			options.all_layers = true;
+		else if (arg == "--encoding" && has_value) {
+			auto it = encoding_arguments.find(argv[++i]);
+			if (it == encoding_arguments.end()) {
+				error = "Unknown encoding " + std::string(argv[i]) + " (csv, base64, zlib or zstd)";
+				return true;
+			}
+			options.encoding = it->second;
+		}
+		else if (arg.rfind("--", 0) == 0) {
+			error = "Unknown option " + arg;
+			return true;
+		}
+		else
+			options.inputs.push_back(arg);
+	}
+
+	if (options.inputs.empty())
+		error = "No map given";
+	else if (options.command == BatchCommand::CONVERT && options.output_dir.empty())
+		error = "convert needs --output-dir";
+	else if (options.command != BatchCommand::VALIDATE) {
+		// Maps are written concurrently, two of them can't go to the same file
+		std::map<std::filesystem::path, std::string> outputs;
+		for (const std::string& input : options.inputs) {
+			std::error_code code;
+			std::filesystem::path output = outputPath(options, input, options.command == BatchCommand::PNG ? ".png" : ".tmx");
+			output = std::filesystem::absolute(output, code).lexically_normal();
+			// The output directory can be the input's own, or a link to it
+			if (std::filesystem::equivalent(output, input, code)) {
+				error = input + " would be overwritten, choose another --output-dir";
+				break;
+			}
+			auto [it, inserted] = outputs.emplace(output, input);
+			if (!inserted) {
+				error = it->second + " and " + input + " would both be written to " + output.string();
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+int runBatch(const BatchOptions& options) {
+	if (!options.output_dir.empty()) {
+		std::error_code code;
+		std::filesystem::create_directories(options.output_dir, code);
+		if (code) {
+			std::cout << "Failed to create " << options.output_dir << ": " << code.message() << std::endl;
+			return 1;
+		}
+	}
+
+	// Each map is handled by one worker, maps are taken in order until there is none left
+	std::vector<std::string> messages(options.inputs.size());
+	std::vector<char> succeeded(options.inputs.size(), 0);
+	std::atomic<size_t> next_map{ 0 };
+	size_t worker_count = (options.jobs > 0 ? (size_t)options.jobs : std::max(1u, std::thread::hardware_concurrency()));
+	worker_count = std::min(worker_count, options.inputs.size());
+
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < worker_count; i++) {
+		workers.emplace_back([&]() {
+			for (size_t map = next_map++; map < options.inputs.size(); map = next_map++) {
+				const std::string& input = options.inputs[map];
+				bool success = false;
+				switch (options.command) {
+				case BatchCommand::CONVERT: success = convert(options, input, messages[map]); break;
+				case BatchCommand::PNG: success = render(options, input, messages[map]); break;
+				case BatchCommand::VALIDATE: success = validate(input, messages[map]); break;
+				}
+				succeeded[map] = success;
+			}
+		});
+	}
+	for (std::thread& worker : workers)
+		worker.join();
+
+	size_t failed = 0;
+	for (size_t map = 0; map < options.inputs.size(); map++) {
+		std::cout << (succeeded[map] ? "[ok] " : "[failed] ") << options.inputs[map] << ": " << messages[map] << std::endl;
+		failed += !succeeded[map];
+	}
+	std::cout << options.inputs.size() - failed << "/" << options.inputs.size() << " maps succeeded" << std::endl;
+	return failed == 0 ? 0 : 1;
+}
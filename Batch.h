@@ -0,0 +1,42 @@
+#ifndef TILEMAPEDITOR_BATCH_H
+#define TILEMAPEDITOR_BATCH_H
+
+#include <string>
+#include <vector>
+#include "TMX.h"
+
+enum class BatchCommand {
+	// Re-encodes TMX maps
+	CONVERT,
+	// Renders TMX maps to PNG
+	PNG,
+	// Checks that maps load and that their tiles exist in their tilesets
+	VALIDATE
+};
+
+struct BatchOptions {
+	BatchCommand command{ BatchCommand::VALIDATE };
+	std::vector<std::string> inputs{};
+	// Next to each input when empty (PNG only, convert requires it)
+	std::string output_dir{};
+	TMXEncoding encoding{ TMXEncoding::BASE64_ZLIB };
+	// Maps processed at the same time, 0 means one per core
+	int jobs{ 0 };
+	// Hidden layers are rendered too
+	bool all_layers{ false };
+};
+
+/*
+* Command line, without any window:
+*   convert  --output-dir <dir> [--encoding csv|base64|zlib|zstd] [--jobs N] <maps...>
+*   png      [--output-dir <dir>] [--all-layers] [--jobs N] <maps...>
+*   validate [--jobs N] <maps...>
+* Returns false when the first argument isn't one of these commands.
+* Usage errors are reported through error.
+*/
+bool parseBatchArgs(int argc, char* argv[], BatchOptions& options, std::string& error);
+
+// Returns the process exit code, 1 if any map failed
+int runBatch(const BatchOptions& options);
+
+#endif
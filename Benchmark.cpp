@@ -0,0 +1,349 @@
+#include "Benchmark.h"
+#include <SDL.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "EditArea.h"
+#include "PaletteArea.h"
+#include "TMXWriter.h"
+
+namespace {
+	constexpr int BENCH_TILE_SIZE{ 16 };
+	// Tiles per side of the synthetic tilesets
+	constexpr int BENCH_TILESET_TILES{ 32 };
+	constexpr int BENCH_VIEW_W{ 1280 };
+	constexpr int BENCH_VIEW_H{ 720 };
+
+	struct BenchmarkResult {
+		std::string name;
+		int map_size;
+		size_t iterations;
+		size_t ops_per_iteration;
+		// Per operation
+		double mean_ns;
+		double median_ns;
+		double min_ns;
+		double max_ns;
+	};
+
+	/*
+	* setup() isn't timed, body() is. Each sample is divided by ops_per_iteration
+	* so that very short operations can be timed in batches.
+	*/
+	BenchmarkResult measure(
+		const std::string& name,
+		int map_size,
+		size_t iterations,
+		size_t ops_per_iteration,
+		const std::function<void()>& setup,
+		const std::function<void()>& body)
+	{
+		std::vector<double> samples;
+		samples.reserve(iterations);
+		for (size_t i = 0; i < iterations; i++) {
+			if (setup)
+				setup();
+			auto start = std::chrono::steady_clock::now();
+			body();
+			auto end = std::chrono::steady_clock::now();
+			samples.push_back(std::chrono::duration<double, std::nano>(end - start).count() / ops_per_iteration);
+		}
+
+		std::sort(samples.begin(), samples.end());
+		double total = 0;
+		for (double sample : samples)
+			total += sample;
+		return BenchmarkResult{
+			name, map_size, iterations, ops_per_iteration,
+			total / samples.size(), samples[samples.size() / 2], samples.front(), samples.back() };
+	}
+
+	// Deterministic positions, so that runs can be compared
+	struct Random {
+		uint32_t state{ 12345 };
+		int next(int max) {
+			state = state * 1664525u + 1013904223u;
+			return (int)((state >> 8) % (uint32_t)max);
+		}
+	};
+
+	SDL_Texture* createTileset(SDL_Renderer* renderer, Uint8 shade) {
+		int side = BENCH_TILE_SIZE * BENCH_TILESET_TILES;
+		SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STATIC, side, side);
+		if (texture == nullptr)
+			return nullptr;
+		std::vector<Uint32> pixels((size_t)side * side);
+		for (int y = 0; y < side; y++) for (int x = 0; x < side; x++)
+			pixels[(size_t)y * side + x] = ((Uint32)(x * 255 / side) << 24) | ((Uint32)(y * 255 / side) << 16) | ((Uint32)shade << 8) | 0xFF;
+		SDL_UpdateTexture(texture, nullptr, pixels.data(), side * 4);
+		SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+		return texture;
+	}
+
+	TileSelection makeSelection(int texture_id, int w, int h) {
+		TileSelection selection;
+		selection.topleft.texture_id = texture_id;
+		selection.topleft.id_on_texture = TileID(0, 0);
+		selection.bottomright = TileID(w - 1, h - 1);
+		return selection;
+	}
+
+	/*
+	* Layer 0 is filled with a 4x4 pattern of texture 0,
+	* layer 1 gets sparse stamps of texture 1 on about 1% of the map.
+	*/
+	void fillMap(EditArea& area, int map_size) {
+		std::vector<TileLayer> layers;
+		layers.emplace_back(map_size, map_size);
+		layers.emplace_back(map_size, map_size);
+		area.setLayers(std::move(layers));
+
+		area.selected_layer = 0;
+		area.setSelection(makeSelection(0, 4, 4));
+		area.onFill(TileID(0, 0), false);
+
+		area.selected_layer = 1;
+		area.setSelection(makeSelection(1, 2, 2));
+		Random random;
+		size_t stamps = std::max<size_t>(1, (size_t)map_size * map_size / 400);
+		for (size_t i = 0; i < stamps; i++) {
+			area.setFocusedTile(TileID(random.next(map_size - 1), random.next(map_size - 1)));
+			area.onPlace(false);
+		}
+	}
+
+	std::string toJSON(const std::vector<BenchmarkResult>& results) {
+		std::ostringstream out;
+		out << "{\n";
+		out << "  \"context\": { \"tile_size\": " << BENCH_TILE_SIZE
+			<< ", \"view_width\": " << BENCH_VIEW_W << ", \"view_height\": " << BENCH_VIEW_H << " },\n";
+		out << "  \"benchmarks\": [\n";
+		for (size_t i = 0; i < results.size(); i++) {
+			const BenchmarkResult& r = results[i];
+			out << "    { \"name\": \"" << r.name << "\", \"map_size\": " << r.map_size
+				<< ", \"iterations\": " << r.iterations << ", \"ops_per_iteration\": " << r.ops_per_iteration
+				<< ", \"mean_ns\": " << r.mean_ns << ", \"median_ns\": " << r.median_ns
+				<< ", \"min_ns\": " << r.min_ns << ", \"max_ns\": " << r.max_ns << " }"
+				<< (i + 1 < results.size() ? ",\n" : "\n");
+		}
+		out << "  ]\n}\n";
+		return out.str();
+	}
+
+	void benchmarkMap(
+		int map_size,
+		SDL_Renderer* renderer,
+		PaletteArea& palette,
+		std::vector<BenchmarkResult>& results)
+	{
+		std::map<int, Tilemap_visible> visibles;
+		EditArea area(BENCH_TILE_SIZE, map_size, map_size);
+		area.visibles = &visibles;
+		const std::map<int, Texture>& textures = palette.getTextures();
+		// Heavy operations run fewer times on large maps
+		size_t heavy_iterations = (map_size >= 4096 ? 1 : (map_size >= 1024 ? 3 : 10));
+
+		/* Basic brush */
+		std::vector<TileLayer> empty_layers;
+		empty_layers.emplace_back(map_size, map_size);
+		area.setLayers(std::move(empty_layers));
+		area.selected_layer = 0;
+		area.setSelection(makeSelection(0, 4, 4));
+		Random random;
+		// Recorded like a stroke, so the undo bookkeeping is part of the cost
+		results.push_back(measure("place", map_size, 20, 1000, nullptr, [&] {
+			area.beginEdit();
+			for (int i = 0; i < 1000; i++) {
+				area.setFocusedTile(TileID(random.next(map_size - 3), random.next(map_size - 3)));
+				area.onPlace(false);
+			}
+			area.endEdit();
+		}));
+
+		/* Rectangle brush, grown one tile per frame up to 256x256 */
+		int rect_side = std::min(map_size, 256);
+		area.selected_brush = BRUSH_RECTANGLE;
+		results.push_back(measure("rectangle", map_size, 10, 1, nullptr, [&] {
+			area.setFocusedTile(TileID(0, 0));
+			area.onStartDrag(false);
+			for (int i = 0; i < rect_side; i++) {
+				area.setFocusedTile(TileID(i, i));
+				area.onDrag(false);
+			}
+			area.onEndDrag(false);
+		}));
+		area.selected_brush = BRUSH_BASIC;
+
+		/* Fill of an empty layer */
+		results.push_back(measure("fill", map_size, heavy_iterations, 1,
+			[&] {
+				std::vector<TileLayer> layers;
+				layers.emplace_back(map_size, map_size);
+				area.setLayers(std::move(layers));
+				area.selected_layer = 0;
+				area.setSelection(makeSelection(0, 4, 4));
+			},
+			[&] {
+				area.beginEdit();
+				area.onFill(TileID(0, 0), false);
+				area.endEdit();
+			}));
+
+		/* Texture removal, only 1% of the map uses texture 1 */
+		results.push_back(measure("delete_texture", map_size, heavy_iterations, 1,
+			[&] { fillMap(area, map_size); },
+			[&] { area.onDeleteTexture(1); }));
+		results.push_back(measure("replace_remove_tiles", map_size, heavy_iterations, 1,
+			[&] { fillMap(area, map_size); },
+			[&] { area.editOnReplaceRemoveTiles(0, 1, 1); }));
+
+		/* Rendering */
+		fillMap(area, map_size);
+		RenderTarget view;
+		SDL_Texture* target = view.acquire(renderer, SDL_PIXELFORMAT_RGBA8888, BENCH_VIEW_W, BENCH_VIEW_H);
+		for (float zoom : { 0.25f, 1.0f, 4.0f }) {
+			std::string suffix = "/zoom_" + std::to_string(zoom).substr(0, 4);
+			area.view_scale = zoom;
+			area.camera_pos = cho::Vector2f(0, 0);
+			float step = (float)BENCH_TILE_SIZE;
+
+			// Every frame pans by one tile, so the layer caches are rebuilt each time
+			results.push_back(measure("render_pan" + suffix, map_size, 30, 1, nullptr, [&] {
+				area.camera_pos = area.camera_pos + cho::Vector2f(step, 0);
+				SDL_SetRenderTarget(renderer, target);
+				area.drawMap(renderer, target, textures, BENCH_VIEW_W, BENCH_VIEW_H);
+				SDL_SetRenderTarget(renderer, nullptr);
+			}));
+			results.push_back(measure("render_static" + suffix, map_size, 30, 1, nullptr, [&] {
+				SDL_SetRenderTarget(renderer, target);
+				area.drawMap(renderer, target, textures, BENCH_VIEW_W, BENCH_VIEW_H);
+				SDL_SetRenderTarget(renderer, nullptr);
+			}));
+		}
+		view.destroy();
+
+		/* TMX save */
+		std::string path = (std::filesystem::temp_directory_path() / "tilemapeditor_bench.tmx").string();
+		const std::vector<TileLayer>& layers = area.getLayers();
+		auto saveTMX = [&](TMXEncoding encoding, TMXSaveCache* cache) {
+			TMXMapInfo info{ .width = map_size, .height = map_size, .tile_size = BENCH_TILE_SIZE, .layer_count = (int)layers.size() };
+			TMXWriter writer(info);
+			std::map<int, TextureData> tilesets = palette.saveTextureToTMX(writer.getDocument(), writer.getMapElement());
+			writer.setCache(cache);
+			if (!writer.open(path))
+				return;
+			for (size_t layer = 0; layer < layers.size(); layer++)
+				writer.writeLayer((int)layer + 1, "Layer " + std::to_string(layer), true, layers[layer], tilesets, encoding);
+			writer.close();
+		};
+		for (TMXEncoding encoding : { TMXEncoding::BASE64_ZLIB, TMXEncoding::BASE64_ZSTD }) {
+			std::string suffix = (encoding == TMXEncoding::BASE64_ZLIB ? "/zlib" : "/zstd");
+			results.push_back(measure("tmx_save" + suffix, map_size, heavy_iterations, 1, nullptr, [&] {
+				saveTMX(encoding, nullptr);
+			}));
+
+			// A few stamps between two saves, only their bands are compressed again
+			TMXSaveCache cache;
+			saveTMX(encoding, &cache);
+			area.setSelection(makeSelection(0, 4, 4));
+			results.push_back(measure("tmx_resave" + suffix, map_size, 10, 1,
+				[&] {
+					area.beginEdit();
+					for (int i = 0; i < 3; i++) {
+						area.setFocusedTile(TileID(random.next(map_size - 3), random.next(map_size - 3)));
+						area.onPlace(false);
+					}
+					area.endEdit();
+				},
+				[&] { saveTMX(encoding, &cache); }));
+		}
+		std::filesystem::remove(path);
+		area.destroy();
+	}
+}
+
+bool parseBenchmarkArgs(int argc, char* argv[], BenchmarkOptions& options) {
+	bool enabled = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		bool has_value = (i + 1 < argc);
+		if (arg == "--bench")
+			enabled = true;
+		else if (arg == "--bench-out" && has_value)
+			options.output_path = argv[++i];
+		else if (arg == "--bench-min-size" && has_value)
+			options.min_map_size = std::atoi(argv[++i]);
+		else if (arg == "--bench-max-size" && has_value)
+			options.max_map_size = std::atoi(argv[++i]);
+		else if (arg == "--bench-verbose")
+			options.verbose = true;
+	}
+	return enabled;
+}
+
+int runBenchmarks(const BenchmarkOptions& options) {
+	// Nothing is displayed, the software renderer draws into a plain surface
+	SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+		std::cout << "SDL_Init failed: " << SDL_GetError() << std::endl;
+		return 1;
+	}
+	SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, BENCH_VIEW_W, BENCH_VIEW_H, 32, SDL_PIXELFORMAT_RGBA8888);
+	SDL_Renderer* renderer = (surface != nullptr ? SDL_CreateSoftwareRenderer(surface) : nullptr);
+	if (renderer == nullptr) {
+		std::cout << "Software renderer creation failed: " << SDL_GetError() << std::endl;
+		SDL_FreeSurface(surface);
+		SDL_Quit();
+		return 1;
+	}
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+
+	PaletteArea palette(BENCH_TILE_SIZE);
+	for (int id = 0; id < 2; id++) {
+		Texture texture;
+		texture.name = std::to_string(id) + ". bench_tileset_" + std::to_string(id) + ".png";
+		texture.path = "bench_tileset_" + std::to_string(id) + ".png";
+		texture.texture = createTileset(renderer, (Uint8)(id * 200));
+		palette.addTexture(id, texture);
+	}
+
+	std::vector<BenchmarkResult> results;
+	auto run = [&](int map_size) {
+		size_t first = results.size();
+		benchmarkMap(map_size, renderer, palette, results);
+		if (options.verbose)
+			for (size_t i = first; i < results.size(); i++)
+				std::cerr << results[i].name << " " << map_size << "x" << map_size << ": " << results[i].median_ns << " ns/op" << std::endl;
+	};
+	for (int map_size = 64; map_size <= options.max_map_size; map_size *= 4) {
+		if (map_size >= options.min_map_size)
+			run(map_size);
+		// 64, 256, 1024, 4096 and then 8192
+		if (map_size == 4096 && options.max_map_size >= 8192)
+			run(8192);
+	}
+
+	std::string json = toJSON(results);
+	bool written = true;
+	if (options.output_path.empty())
+		std::cout << json;
+	else {
+		std::ofstream file(options.output_path);
+		file << json;
+		written = file.good();
+		if (!written)
+			std::cout << "Failed to write " << options.output_path << std::endl;
+	}
+
+	palette.destroy();
+	SDL_DestroyRenderer(renderer);
+	SDL_FreeSurface(surface);
+	SDL_Quit();
+	return written ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+#ifndef TILEMAPEDITOR_BENCHMARK_H
+#define TILEMAPEDITOR_BENCHMARK_H
+
+#include <string>
+
+struct BenchmarkOptions {
+	// Written to stdout when empty
+	std::string output_path{};
+	int min_map_size{ 64 };
+	int max_map_size{ 8192 };
+	// Prints each result to stderr as soon as it is measured
+	bool verbose{ false };
+};
+
+/*
+* Command line: --bench [--bench-out <file.json>] [--bench-min-size N] [--bench-max-size N] [--bench-verbose]
+* Returns false when --bench isn't given.
+*/
+bool parseBenchmarkArgs(int argc, char* argv[], BenchmarkOptions& options);
+
+// Times the edit/palette hot paths on synthetic maps with the software renderer and writes the results as JSON.
+// Returns the process exit code.
+int runBenchmarks(const BenchmarkOptions& options);
+
+#endif
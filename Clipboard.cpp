@@ -0,0 +1,74 @@
+#include "Clipboard.h"
+#include <algorithm>
+
+TileBlock TileBlock::capture(const std::vector<TileLayer>& source, int x, int y, int w, int h) {
+	TileBlock block;
+	block.width = w;
+	block.height = h;
+	block.layers.resize(source.size());
+
+	for (size_t layer = 0; layer < source.size(); layer++) {
+		std::vector<PackedTile>& tiles = block.layers[layer];
+		tiles.resize((size_t)w * h);
+		bool used = false;
+		for (int row = 0; row < h; row++) {
+			PackedTile* out = &tiles[(size_t)row * w];
+			source[layer].readSpan(y + row, x, x + w - 1, [&](int tile_x, PackedTile tile) {
+				out[tile_x - x] = tile;
+				used |= (tile != EMPTY_TILE);
+			});
+		}
+		if (!used)
+			tiles = std::vector<PackedTile>();
+	}
+	return block;
+}
+
+void TileBlock::flipHorizontal() {
+	for (std::vector<PackedTile>& tiles : layers)
+		if (!tiles.empty())
+			for (int y = 0; y < height; y++)
+				std::reverse(tiles.begin() + (size_t)y * width, tiles.begin() + (size_t)(y + 1) * width);
+}
+
+void TileBlock::flipVertical() {
+	for (std::vector<PackedTile>& tiles : layers)
+		if (!tiles.empty())
+			for (int y = 0; y < height / 2; y++)
+				std::swap_ranges(
+					tiles.begin() + (size_t)y * width,
+					tiles.begin() + (size_t)(y + 1) * width,
+					tiles.begin() + (size_t)(height - 1 - y) * width);
+}
+
+void TileBlock::rotate(bool clockwise) {
+	int new_width = height, new_height = width;
+	std::vector<PackedTile> rotated;
+
+	for (std::vector<PackedTile>& tiles : layers) {
+		if (tiles.empty())
+			continue;
+		rotated.resize(tiles.size());
+
+		// Square blocks keep both the reads and the scattered writes in cache
+		for (int block_y = 0; block_y < height; block_y += TRANSFORM_BLOCK_SIZE)
+		for (int block_x = 0; block_x < width; block_x += TRANSFORM_BLOCK_SIZE) {
+			int
+				end_y = std::min(height, block_y + TRANSFORM_BLOCK_SIZE),
+				end_x = std::min(width, block_x + TRANSFORM_BLOCK_SIZE);
+			for (int y = block_y; y < end_y; y++) {
+				const PackedTile* src = &tiles[(size_t)y * width];
+				for (int x = block_x; x < end_x; x++) {
+					int
+						new_x = clockwise ? height - 1 - y : y,
+						new_y = clockwise ? x : width - 1 - x;
+					rotated[(size_t)new_y * new_width + new_x] = src[x];
+				}
+			}
+		}
+		tiles.swap(rotated);
+	}
+
+	width = new_width;
+	height = new_height;
+}
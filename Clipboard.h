@@ -0,0 +1,44 @@
+#ifndef TILEMAPEDITOR_CLIPBOARD_H
+#define TILEMAPEDITOR_CLIPBOARD_H
+
+#include <vector>
+#include "TileLayer.h"
+
+// Side of the square tiles of cells used when rotating, 32x32 packed tiles fit in L1
+constexpr int TRANSFORM_BLOCK_SIZE{ 32 };
+
+/*
+* Rectangular region copied from every layer of the map.
+* Layers are stored row-major, layers without any tile in the region stay empty.
+*/
+class TileBlock {
+	int width{ 0 };
+	int height{ 0 };
+	std::vector<std::vector<PackedTile>> layers{};
+
+public:
+	TileBlock() = default;
+	static TileBlock capture(const std::vector<TileLayer>& source, int x, int y, int w, int h);
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	size_t getLayerCount() const { return layers.size(); }
+	bool empty() const { return width == 0 || height == 0; }
+	bool hasLayer(size_t layer) const { return layer < layers.size() && !layers[layer].empty(); }
+	const PackedTile* row(size_t layer, int y) const { return &layers[layer][(size_t)y * width]; }
+
+	void flipHorizontal();
+	void flipVertical();
+	void rotate(bool clockwise);
+
+	// Clears every tile for which predicate(tile) is true
+	template<typename Pred>
+	void removeIf(Pred&& predicate) {
+		for (std::vector<PackedTile>& tiles : layers)
+			for (PackedTile& tile : tiles)
+				if (tile != EMPTY_TILE && predicate(tile))
+					tile = EMPTY_TILE;
+	}
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "EditArea.h"
+#include "Profiler.h"
 
 TileID EditArea::getTileID(int mouse_x, int mouse_y) {
 	int
@@ -8,22 +9,38 @@ TileID EditArea::getTileID(int mouse_x, int mouse_y) {
 	return TileID(tile_x, tile_y);
 }
 
+TileID EditArea::screenToTile(int screen_x, int screen_y) const {
+	float size = tile_pixel_size * view_scale;
+	float
+		x = screen_x - (on_screen_origin.x + view_pos.x),
+		y = screen_y - (on_screen_origin.y + view_pos.y + 35);  // Menu bar offset
+	return TileID((int)std::floor(x / size), (int)std::floor(y / size));
+}
+
 bool EditArea::isValidHover() {
 	return !(focused.x < 0 || focused.x >= tilemap_width || focused.y < 0 || focused.y >= tilemap_height);
 }
 
 bool EditArea::isValidFocus() {
+	return isValidStamp(focused);
+}
+
+bool EditArea::isValidStamp(TileID at) {
 	if (!isValidSelection(selection))
 		return false;
 
-	if (!isValidHover())
+	if (at.x < 0 || at.x >= tilemap_width || at.y < 0 || at.y >= tilemap_height)
 		return false;
 
-	return (focused.x + selection_width - 1 < tilemap_width) && (focused.y + selection_height - 1 < tilemap_height);
+	return (at.x + selection_width - 1 < tilemap_width) && (at.y + selection_height - 1 < tilemap_height);
 }
 
 void EditArea::onPlace(bool clear) {
-	if (!isValidFocus())
+	stamp(focused, clear);
+}
+
+void EditArea::stamp(TileID at, bool clear) {
+	if (!isValidStamp(at))
 		return;
 
 	Tile tile;
@@ -33,11 +50,90 @@ void EditArea::onPlace(bool clear) {
 			tile.id_on_texture.x = selection.topleft.id_on_texture.x + w;
 			tile.id_on_texture.y = selection.topleft.id_on_texture.y + h;
 		}
-		tilemap[selected_layer][(size_t)focused.y + h][(size_t)focused.x + w] = tile;
+		setTile(selected_layer, at.x + w, at.y + h, packTile(tile));
+	}
+}
+
+void EditArea::onStrokeTo(TileID target, bool clear) {
+	if (selected_brush != BRUSH_BASIC || !visibles->operator[](selected_layer).visible)
+		return;
+	if (stroke_last.x == -1 && stroke_last.y == -1)
+		stroke_last = target;
+
+	// Bresenham walk from the previous cell, each cell is stamped at most once per stroke
+	int
+		x = stroke_last.x, y = stroke_last.y,
+		dx = std::abs(target.x - x), dy = -std::abs(target.y - y),
+		sx = (x < target.x ? 1 : -1), sy = (y < target.y ? 1 : -1),
+		error = dx + dy;
+	while (true) {
+		uint64_t key = ((uint64_t)(uint32_t)y << 32) | (uint32_t)x;
+		if (stroke_stamped.insert(key).second)
+			stamp(TileID(x, y), clear);
+
+		if (x == target.x && y == target.y)
+			break;
+		int error2 = 2 * error;
+		if (error2 >= dy) {
+			error += dy;
+			x += sx;
+		}
+		if (error2 <= dx) {
+			error += dx;
+			y += sy;
+		}
 	}
+	stroke_last = target;
+}
+
+void EditArea::setTile(size_t layer, int x, int y, PackedTile tile) {
+	PackedTile previous = tilemap[layer].set(x, y, tile);
+	if (previous == tile)
+		return;
+	layer_caches[layer].markDirty(x, y, x, y);
+	if (recorder.isActive())
+		recorder.record((uint32_t)layer, (uint32_t)(y * tilemap_width + x), previous);
+}
+
+void EditArea::beginEdit() {
+	recorder.begin(tilemap.size(), (size_t)tilemap_width * tilemap_height);
+}
+
+TileDelta EditArea::endEdit() {
+	return recorder.finish(tilemap);
+}
+
+void EditArea::commitEdit() {
+	if (!recorder.isActive())
+		return;
+	TileDelta delta = endEdit();
+	if (!delta.empty() && on_edit)
+		on_edit(std::move(delta));
+}
+
+void EditArea::applyDelta(const TileDelta& delta, bool redo) {
+	delta.forEachCell(redo, [this](uint32_t layer, uint32_t index, PackedTile tile) {
+		setTile(layer, index % tilemap_width, index / tilemap_width, tile);
+	});
 }
 
 void EditArea::onStartDrag(bool clear) {
+	// A whole stroke is undone at once, even if it started outside of the grid
+	if (!recorder.isActive())
+		beginEdit();
+
+	if (selected_brush == BRUSH_SELECT) {
+		onSelectStart(clear);
+		return;
+	}
+
+	// The fill only needs its seed inside the grid, not the whole selection
+	if (selected_brush == BRUSH_FILL) {
+		if (visibles->operator[](selected_layer).visible)
+			onFill(focused, clear);
+		return;
+	}
+
 	if (!isValidFocus())
 		return;
 	if (!visibles->operator[](selected_layer).visible)
@@ -46,22 +142,27 @@ void EditArea::onStartDrag(bool clear) {
 		return;
 	
 	if (selected_brush == BRUSH_RECTANGLE) {
-		rect_preview = TileMap(tilemap_height, std::vector<Tile>(tilemap_width, Tile()));
 		dragOrigin = focused;
 		dragTopLeft = focused;
 		dragBottomRight = focused;
+		drag_reversed_x = false;
+		drag_reversed_y = false;
 		rect_preview_layer = selected_layer;
 		rect_clear = clear;
 	}
 }
 
 void EditArea::onDrag(bool clear_if_basic_brush) {
+	if (selected_brush == BRUSH_SELECT) {
+		onSelectDrag();
+		return;
+	}
 	if (!visibles->operator[](selected_layer).visible)
 		return;
 	if (!isValidFocus())
 		return;
 	if (selected_brush == BRUSH_BASIC) {
-		onPlace(clear_if_basic_brush);
+		onStrokeTo(focused, clear_if_basic_brush);
 		return;
 	}
 
@@ -74,55 +175,272 @@ void EditArea::onDrag(bool clear_if_basic_brush) {
 	dragBottomRight.x = std::max(dragOrigin.x, focused.x);
 	dragBottomRight.y = std::max(dragOrigin.y, focused.y);
 
-	int
-		diff_x = dragBottomRight.x - dragTopLeft.x,
-		diff_y = dragBottomRight.y - dragTopLeft.y;
+	// The selection pattern starts from the origin, in the direction of the drag
+	drag_reversed_x = (focused.x < dragOrigin.x);
+	drag_reversed_y = (focused.y < dragOrigin.y);
+}
 
-	// Variation of w and h per iteration
-	int
-		dw = (focused.x >= dragOrigin.x ? 1 : -1),
-		dh = (focused.y >= dragOrigin.y ? 1 : -1);
-	// How much we moved in the x and y directions respectively
+PackedTile EditArea::rectangleTile(int x, int y) const {
+	if (rect_clear)
+		return EMPTY_TILE;
+
+	Tile tile;
+	tile.texture_id = selection.topleft.texture_id;
+	tile.id_on_texture.x = mod(x - dragOrigin.x + (drag_reversed_x ? -1 : 0), selection_width) + selection.topleft.id_on_texture.x;
+	tile.id_on_texture.y = mod(y - dragOrigin.y + (drag_reversed_y ? -1 : 0), selection_height) + selection.topleft.id_on_texture.y;
+	return packTile(tile);
+}
+
+void EditArea::onFill(TileID seed, bool clear) {
+	if (seed.x < 0 || seed.x >= tilemap_width || seed.y < 0 || seed.y >= tilemap_height)
+		return;
+	if (!clear && !isValidSelection(selection))
+		return;
+
+	TileLayer& layer = tilemap[selected_layer];
+	PackedTile target = layer.getPacked(seed.x, seed.y);
+	auto replacement = [&](int x, int y) {
+		if (clear)
+			return EMPTY_TILE;
+		Tile tile;
+		tile.texture_id = selection.topleft.texture_id;
+		tile.id_on_texture.x = selection.topleft.id_on_texture.x + mod(x - seed.x, selection_width);
+		tile.id_on_texture.y = selection.topleft.id_on_texture.y + mod(y - seed.y, selection_height);
+		return packTile(tile);
+	};
+	// Filling a region with its own tile would change nothing
+	if (selection_width * selection_height == 1 && replacement(seed.x, seed.y) == target)
+		return;
+
+	// The pattern can contain the target tile itself, so filled cells are tracked separately
+	std::vector<uint64_t> visited(((size_t)tilemap_width * tilemap_height + 63) / 64, 0);
+	auto fillable = [&](int x, int y) {
+		size_t index = (size_t)y * tilemap_width + x;
+		return !(visited[index / 64] & (1ull << (index % 64))) && layer.getPacked(x, y) == target;
+	};
+
+	// Only a fill starting the edit can be kept as its pattern
+	bool first_write = recorder.isEmpty();
+
+	// Scanline span fill: each popped seed is extended into a full row span,
+	// then one seed is pushed per fillable run in the rows above and below
+	std::vector<TileID> stack{ seed };
+	while (!stack.empty()) {
+		TileID cell = stack.back();
+		stack.pop_back();
+		if (!fillable(cell.x, cell.y))
+			continue;
+
+		int left = cell.x, right = cell.x;
+		while (left > 0 && fillable(left - 1, cell.y))
+			left--;
+		while (right < tilemap_width - 1 && fillable(right + 1, cell.y))
+			right++;
+
+		for (int x = left; x <= right; x++) {
+			size_t index = (size_t)cell.y * tilemap_width + x;
+			visited[index / 64] |= 1ull << (index % 64);
+		}
+		writeSpan(selected_layer, cell.y, left, right, [&](int x) { return replacement(x, cell.y); });
+
+		for (int y : { cell.y - 1, cell.y + 1 }) {
+			if (y < 0 || y >= tilemap_height)
+				continue;
+			bool in_run = false;
+			layer.readSpan(y, left, right, [&](int x, PackedTile tile) {
+				size_t index = (size_t)y * tilemap_width + x;
+				bool open = (tile == target) && !(visited[index / 64] & (1ull << (index % 64)));
+				if (open && !in_run)
+					stack.push_back(TileID(x, y));
+				in_run = open;
+			});
+		}
+	}
+
+	if (first_write && !clear && selection_width * selection_height > 1) {
+		TileDelta::Pattern pattern;
+		pattern.origin = packTile(selection.topleft);
+		pattern.width = selection_width;
+		pattern.height = selection_height;
+		pattern.anchor_x = seed.x;
+		pattern.anchor_y = seed.y;
+		pattern.map_width = tilemap_width;
+		recorder.setPattern(pattern);
+	}
+}
+
+template<typename Value>
+void EditArea::writeSpan(size_t layer, int y, int x1, int x2, Value&& value) {
+	tilemap[layer].setSpan(y, x1, x2, value, [&](int x, PackedTile previous) {
+		if (recorder.isActive())
+			recorder.record((uint32_t)layer, (uint32_t)(y * tilemap_width + x), previous);
+	});
+	layer_caches[layer].markDirty(x1, y, x2, y);
+}
+
+void EditArea::placeBlock(const TileBlock& block, TileID at) {
+	// Only the part of the block inside the map is written
 	int
-		delta_w = 0,
-		delta_h = 0;
+		first_x = std::max(0, -at.x),
+		last_x = std::min(block.getWidth(), tilemap_width - at.x),
+		first_y = std::max(0, -at.y),
+		last_y = std::min(block.getHeight(), tilemap_height - at.y);
 
-	bool
-		at_least_once_x = true,
-		at_least_once_y = true;
-	
-	for (int h = dragOrigin.y; (h < dragOrigin.y + diff_y) || at_least_once_y;) {
-		delta_w = 0;
-		at_least_once_x = true;
-		for (int w = dragOrigin.x; (w < dragOrigin.x + diff_x) || at_least_once_x;) {
-			if (!rect_clear) {
-				Tile drawn_tile;
-				drawn_tile.texture_id = selection.topleft.texture_id;
-				drawn_tile.id_on_texture.x = mod(delta_w + (focused.x >= dragOrigin.x ? 0 : -1), selection_width) + selection.topleft.id_on_texture.x;
-				drawn_tile.id_on_texture.y = mod(delta_h + (focused.y >= dragOrigin.y ? 0 : -1), selection_height) + selection.topleft.id_on_texture.y;
-				rect_preview[(size_t)(dragOrigin.y + delta_h)][(size_t)(dragOrigin.x + delta_w)] = drawn_tile;
+	for (size_t layer = 0; layer < std::min(block.getLayerCount(), tilemap.size()); layer++) {
+		if (!block.hasLayer(layer))
+			continue;
+		for (int row = first_y; row < last_y; row++) {
+			const PackedTile* tiles = block.row(layer, row);
+			// Empty cells of the block are transparent, so only runs of tiles are written
+			for (int x = first_x; x < last_x;) {
+				if (tiles[x] == EMPTY_TILE) {
+					x++;
+					continue;
+				}
+				int run_end = x;
+				while (run_end < last_x && tiles[run_end] != EMPTY_TILE)
+					run_end++;
+				writeSpan(layer, at.y + row, at.x + x, at.x + run_end - 1, [&](int map_x) { return tiles[map_x - at.x]; });
+				x = run_end;
 			}
+		}
+	}
+}
 
-			w = dragOrigin.x + std::abs(delta_w);
-			at_least_once_x = false;
-			delta_w += dw;
+void EditArea::clearRegion(TileID topleft, TileID bottomright) {
+	for (size_t layer = 0; layer < tilemap.size(); layer++)
+		for (int y = topleft.y; y <= bottomright.y; y++)
+			writeSpan(layer, y, topleft.x, bottomright.x, [](int) { return EMPTY_TILE; });
+}
+
+void EditArea::onSelectStart(bool right_click) {
+	if (isFloating()) {
+		if (right_click) {
+			cancelFloating();
+			return;
+		}
+
+		TileID at = floatingPosition();
+		placeBlock(floating, at);
+		if (clipboard_mode == ClipboardMode::MOVING) {
+			// The moved tiles stay selected at their new place
+			marquee_topleft = TileID(std::max(0, at.x), std::max(0, at.y));
+			marquee_bottomright = TileID(
+				std::min(tilemap_width - 1, at.x + floating.getWidth() - 1),
+				std::min(tilemap_height - 1, at.y + floating.getHeight() - 1));
+			if (marquee_topleft.x > marquee_bottomright.x || marquee_topleft.y > marquee_bottomright.y)
+				deselect();
+			floating = TileBlock();
+			lifted = TileBlock();
+			clipboard_mode = ClipboardMode::NONE;
 		}
+		return;
+	}
+
+	if (right_click || !isValidHover()) {
+		deselect();
+		return;
+	}
+	selecting = true;
+	marquee_origin = focused;
+	marquee_topleft = focused;
+	marquee_bottomright = focused;
+}
+
+void EditArea::onSelectDrag() {
+	if (!selecting)
+		return;
+	TileID clamped(std::clamp(focused.x, 0, tilemap_width - 1), std::clamp(focused.y, 0, tilemap_height - 1));
+	marquee_topleft = TileID(std::min(marquee_origin.x, clamped.x), std::min(marquee_origin.y, clamped.y));
+	marquee_bottomright = TileID(std::max(marquee_origin.x, clamped.x), std::max(marquee_origin.y, clamped.y));
+}
+
+void EditArea::copySelection() {
+	if (!hasMarquee())
+		return;
+	clipboard = TileBlock::capture(tilemap, marquee_topleft.x, marquee_topleft.y,
+		marquee_bottomright.x - marquee_topleft.x + 1, marquee_bottomright.y - marquee_topleft.y + 1);
+}
+
+void EditArea::cutSelection() {
+	if (!hasMarquee() || isEditing())
+		return;
+	copySelection();
+	deleteSelection();
+}
+
+void EditArea::deleteSelection() {
+	if (!hasMarquee() || isEditing())
+		return;
+	beginEdit();
+	clearRegion(marquee_topleft, marquee_bottomright);
+	commitEdit();
+}
+
+void EditArea::pasteClipboard() {
+	if (clipboard.empty() || isEditing())
+		return;
+	floating = clipboard;
+	floating_offset = TileID(0, 0);
+	clipboard_mode = ClipboardMode::PASTING;
+}
+
+void EditArea::moveSelection() {
+	if (!hasMarquee() || isEditing())
+		return;
+	floating = TileBlock::capture(tilemap, marquee_topleft.x, marquee_topleft.y,
+		marquee_bottomright.x - marquee_topleft.x + 1, marquee_bottomright.y - marquee_topleft.y + 1);
+
+	// Lifting and dropping the tiles end up in a single history entry
+	beginEdit();
+	clearRegion(marquee_topleft, marquee_bottomright);
+	move_origin = marquee_topleft;
+	lifted = floating;
+	floating_offset = isValidHover() ? TileID(marquee_topleft.x - focused.x, marquee_topleft.y - focused.y) : TileID(0, 0);
+	clipboard_mode = ClipboardMode::MOVING;
+	deselect();
+}
+
+void EditArea::flipClipboard(bool horizontal) {
+	TileBlock& block = (isFloating() ? floating : clipboard);
+	if (horizontal)
+		block.flipHorizontal();
+	else
+		block.flipVertical();
+}
+
+void EditArea::rotateClipboard(bool clockwise) {
+	TileBlock& block = (isFloating() ? floating : clipboard);
+	block.rotate(clockwise);
+}
 
-		h = dragOrigin.y + std::abs(delta_h);
-		at_least_once_y = false;
-		delta_h += dh;
+void EditArea::cancelFloating() {
+	if (clipboard_mode == ClipboardMode::MOVING) {
+		// Back to where it was, untransformed, the map is unchanged so nothing goes to the history
+		placeBlock(lifted, move_origin);
+		endEdit();
 	}
+	floating = TileBlock();
+	lifted = TileBlock();
+	clipboard_mode = ClipboardMode::NONE;
 }
 
 void EditArea::onEndDrag(bool cancelled) {
+	selecting = false;
+	finishRectangle(cancelled);
+	commitEdit();
+	stroke_last = TileID(-1, -1);
+	stroke_stamped.clear();
+}
+
+void EditArea::finishRectangle(bool cancelled) {
 	if (!visibles->operator[](selected_layer).visible)
 		return;
 	if (dragOrigin.x == -1)
 		return;
 	if(!cancelled)
 		for (int h = dragTopLeft.y; h <= dragBottomRight.y; h++) for (int w = dragTopLeft.x; w <= dragBottomRight.x; w++)
-			tilemap[rect_preview_layer][h][w] = rect_preview[h][w];
-	rect_preview.clear();
+			setTile(rect_preview_layer, w, h, rectangleTile(w, h));
 	dragOrigin = TileID(-1, -1);
 	dragTopLeft = TileID(-1, -1);
 	dragBottomRight = TileID(-1, -1);
@@ -130,32 +448,95 @@ void EditArea::onEndDrag(bool cancelled) {
 }
 
 void EditArea::onAddLayer() {
-	TileMap new_map(tilemap_height, std::vector<Tile>(tilemap_width, Tile()));
-	tilemap.push_back(new_map);
+	insertLayer((int)tilemap.size(), TileLayer(tilemap_width, tilemap_height));
+}
+
+void EditArea::insertLayer(int index, TileLayer&& layer) {
+	tilemap.insert(tilemap.begin() + index, std::move(layer));
+	layer_caches.emplace(layer_caches.begin() + index);
+}
+
+TileLayer EditArea::takeLayer(int index) {
+	TileLayer layer = std::move(tilemap[index]);
+	onDeleteLayer(index);
+	return layer;
+}
+
+void EditArea::setLayers(std::vector<TileLayer>&& layers) {
+	destroy();
+	tilemap = std::move(layers);
+	layer_caches.clear();
+	layer_caches.resize(tilemap.size());
+}
+
+void EditArea::mapLayers(std::shared_ptr<const void> owner, std::vector<std::vector<const PackedTile*>>&& chunks) {
+	for (size_t layer = 0; layer < tilemap.size() && layer < chunks.size(); layer++)
+		tilemap[layer].mapChunks(owner, std::move(chunks[layer]));
 }
 
 void EditArea::onDeleteLayer(int layer) {
 	tilemap.erase(tilemap.begin() + layer);
+	layer_caches[layer].target.destroy();
+	layer_caches.erase(layer_caches.begin() + layer);
 }
 
 void EditArea::onSwap(int a, int b) {
 	std::swap(tilemap.at(a), tilemap.at(b));
+	std::swap(layer_caches.at(a), layer_caches.at(b));
+}
+
+template<typename Pred>
+void EditArea::removeTilesIf(int texture_id, Pred&& predicate) {
+	for (size_t layer = 0; layer < tilemap.size(); layer++) {
+		tilemap[layer].removeTextureTiles(texture_id, predicate, [&](int x, int y, PackedTile tile) {
+			layer_caches[layer].markDirty(x, y, x, y);
+			if (recorder.isActive())
+				recorder.record((uint32_t)layer, (uint32_t)(y * tilemap_width + x), tile);
+		});
+	}
 }
 
 void EditArea::onDeleteTexture(int id) {
-	for (TileMap& layer : tilemap)
-		for (std::vector<Tile>& row : layer)
-			for (Tile& tile : row)
-				if (tile.texture_id == id)
-					tile = Tile();
+	removeTilesIf(id, [](PackedTile tile) { return true; });
+	auto uses_texture = [id](PackedTile tile) { return packedTextureID(tile) == id; };
+	clipboard.removeIf(uses_texture);
+	floating.removeIf(uses_texture);
+	lifted.removeIf(uses_texture);
 }
 
 void EditArea::editOnReplaceRemoveTiles(int texture_id, int max_x, int max_y) {
-	for (TileMap& layer : tilemap)
-		for (std::vector<Tile>& row : layer)
-			for (Tile& tile : row)
-				if (tile.texture_id == texture_id && (tile.id_on_texture.x > max_x || tile.id_on_texture.y > max_y))
-					tile = Tile();
+	auto out_of_range = [=](PackedTile packed) {
+		Tile tile = unpackTile(packed);
+		return tile.texture_id == texture_id && (tile.id_on_texture.x > max_x || tile.id_on_texture.y > max_y);
+	};
+	removeTilesIf(texture_id, out_of_range);
+	clipboard.removeIf(out_of_range);
+	floating.removeIf(out_of_range);
+	lifted.removeIf(out_of_range);
+}
+
+void EditArea::onTextureChanged(int texture_id) {
+	// Only the layers drawing this texture have to be baked again
+	for (size_t layer = 0; layer < tilemap.size(); layer++)
+		if (tilemap[layer].textureUsage(texture_id) > 0)
+			layer_caches[layer].valid = false;
+}
+
+size_t EditArea::textureUsage(int texture_id) const {
+	size_t count = 0;
+	for (const TileLayer& layer : tilemap)
+		count += layer.textureUsage(texture_id);
+	return count;
+}
+
+void EditArea::invalidateCaches() {
+	for (LayerCache& cache : layer_caches)
+		cache.valid = false;
+}
+
+void EditArea::destroy() {
+	for (LayerCache& cache : layer_caches)
+		cache.target.destroy();
 }
 
 void EditArea::renderFocus(SDL_Color color, SDL_Renderer* renderer) {
@@ -177,33 +558,218 @@ void EditArea::renderFocus(SDL_Color color, SDL_Renderer* renderer) {
 	SDL_RenderDrawLine(renderer, topleft_x + dim_x, topleft_y, topleft_x + dim_x, topleft_y + dim_y);
 }
 
+void EditArea::renderTileRect(SDL_Color color, SDL_Renderer* renderer, TileID topleft, int w, int h) {
+	SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+	SDL_FRect rect{
+		on_screen_origin.x + topleft.x * on_screen_tile_size,
+		on_screen_origin.y + topleft.y * on_screen_tile_size,
+		w * on_screen_tile_size,
+		h * on_screen_tile_size };
+	SDL_RenderDrawRectF(renderer, &rect);
+}
+
+void EditArea::renderBlock(
+	SDL_Renderer* renderer,
+	const std::map<int, Texture>& ref_textures,
+	size_t layer,
+	cho::Vector2i topleft,
+	cho::Vector2i bottomright)
+{
+	TileID at = floatingPosition();
+	int
+		first_x = std::max({ topleft.x, at.x, 0 }),
+		first_y = std::max({ topleft.y, at.y, 0 }),
+		last_x = std::min({ bottomright.x, at.x + floating.getWidth() - 1, tilemap_width - 1 }),
+		last_y = std::min({ bottomright.y, at.y + floating.getHeight() - 1, tilemap_height - 1 });
+
+	// Only the visible part of the block is turned into quads, however large it is
+	for (int y = first_y; y <= last_y; y++) {
+		const PackedTile* tiles = floating.row(layer, y - at.y);
+		for (int x = first_x; x <= last_x; x++) {
+			PackedTile packed = tiles[x - at.x];
+			if (packed == EMPTY_TILE)
+				continue;
+			Tile tile = unpackTile(packed);
+			TileBatch& batch = batches[tile.texture_id];
+			if (batch.empty())
+				batch.begin(ref_textures.at(tile.texture_id).texture);
+
+			SDL_Rect src_rect{ tile_pixel_size * tile.id_on_texture.x, tile_pixel_size * tile.id_on_texture.y, tile_pixel_size, tile_pixel_size };
+			SDL_FRect target_rect{ on_screen_origin.x + on_screen_tile_size * x, on_screen_origin.y + on_screen_tile_size * y, on_screen_tile_size, on_screen_tile_size };
+			batch.addQuad(target_rect, src_rect);
+		}
+	}
+
+	for (auto& [texture_id, texture_batch] : batches)
+		texture_batch.submit(renderer);
+}
+
 void EditArea::renderTilemap(
 	SDL_Renderer* renderer,
 	const std::map<int, Texture>& ref_textures,
 	cho::Vector2i topleft,
 	cho::Vector2i bottomright,
-	TileMap& target, 
+	const TileLayer& target,
 	bool is_preview_layer)
 {
-	for (size_t h = topleft.y; h <= std::min(bottomright.y, tilemap_height - 1); h++)
-	for (size_t w = topleft.x; w <= std::min(bottomright.x, tilemap_width - 1); w++) {
-		bool use_preview = is_preview_layer && (dragOrigin.x != -1) &&
-			(dragTopLeft.x <= w && w <= dragBottomRight.x) && (dragTopLeft.y <= h && h <= dragBottomRight.y);
-
-		Tile tile = (use_preview ? rect_preview[h][w] : target[h][w]);
-		if (tile.texture_id == -1) continue;
-
-		float rend_size = tile_pixel_size * view_scale;
-		SDL_Rect
-			src_rect{ tile_pixel_size * tile.id_on_texture.x, tile_pixel_size * tile.id_on_texture.y, tile_pixel_size, tile_pixel_size },
-			target_rect{ on_screen_origin.x + rend_size * w, on_screen_origin.y + rend_size * h, std::ceil(rend_size), std::ceil(rend_size) };
-		SDL_RenderCopy(renderer, ref_textures.at(tile.texture_id).texture, &src_rect, &target_rect);
+	int
+		last_x = std::min(bottomright.x, tilemap_width - 1),
+		last_y = std::min(bottomright.y, tilemap_height - 1);
+	bool preview_active = is_preview_layer && (dragOrigin.x != -1);
+
+	if (last_x < topleft.x || last_y < topleft.y)
+		return;
+
+	float rend_size = tile_pixel_size * view_scale;
+	int batch_texture_id = -1;
+	TileBatch* batch = nullptr;
+
+	// Walk chunk by chunk so that empty chunks are skipped entirely
+	for (int chunk_y = topleft.y / CHUNK_SIZE; chunk_y <= last_y / CHUNK_SIZE; chunk_y++)
+	for (int chunk_x = topleft.x / CHUNK_SIZE; chunk_x <= last_x / CHUNK_SIZE; chunk_x++) {
+		const PackedTile* chunk = target.getChunkTiles(chunk_x, chunk_y);
+		bool chunk_in_preview = preview_active &&
+			chunk_x * CHUNK_SIZE <= dragBottomRight.x && dragTopLeft.x < (chunk_x + 1) * CHUNK_SIZE &&
+			chunk_y * CHUNK_SIZE <= dragBottomRight.y && dragTopLeft.y < (chunk_y + 1) * CHUNK_SIZE;
+		if (chunk == nullptr && !chunk_in_preview)
+			continue;
+
+		int
+			start_x = std::max(topleft.x, chunk_x * CHUNK_SIZE),
+			start_y = std::max(topleft.y, chunk_y * CHUNK_SIZE),
+			end_x = std::min(last_x, chunk_x * CHUNK_SIZE + CHUNK_SIZE - 1),
+			end_y = std::min(last_y, chunk_y * CHUNK_SIZE + CHUNK_SIZE - 1);
+
+		for (int h = start_y; h <= end_y; h++)
+		for (int w = start_x; w <= end_x; w++) {
+			bool use_preview = chunk_in_preview &&
+				(dragTopLeft.x <= w && w <= dragBottomRight.x) && (dragTopLeft.y <= h && h <= dragBottomRight.y);
+
+			PackedTile packed = EMPTY_TILE;
+			if (use_preview)
+				packed = rectangleTile(w, h);
+			else if (chunk != nullptr)
+				packed = chunk[(size_t)(h % CHUNK_SIZE) * CHUNK_SIZE + (w % CHUNK_SIZE)];
+			if (packed == EMPTY_TILE) continue;
+			Tile tile = unpackTile(packed);
+
+			// Consecutive tiles mostly share a texture, so the batch lookup is cached
+			if (tile.texture_id != batch_texture_id) {
+				batch_texture_id = tile.texture_id;
+				batch = &batches[batch_texture_id];
+				if (batch->empty())
+					batch->begin(ref_textures.at(batch_texture_id).texture);
+			}
+
+			SDL_Rect src_rect{ tile_pixel_size * tile.id_on_texture.x, tile_pixel_size * tile.id_on_texture.y, tile_pixel_size, tile_pixel_size };
+			SDL_FRect target_rect{ on_screen_origin.x + rend_size * w, on_screen_origin.y + rend_size * h, rend_size, rend_size };
+			batch->addQuad(target_rect, src_rect);
+		}
+	}
+
+	// One draw call per texture used in this layer
+	for (auto& [texture_id, texture_batch] : batches)
+		texture_batch.submit(renderer);
+}
+
+SDL_Texture* EditArea::bakeLayer(
+	SDL_Renderer* renderer,
+	const std::map<int, Texture>& ref_textures,
+	size_t layer,
+	int view_w,
+	int view_h,
+	cho::Vector2i topleft,
+	cho::Vector2i bottomright)
+{
+	LayerCache& cache = layer_caches[layer];
+	SDL_Texture* previous = cache.target.get();
+	SDL_Texture* cache_texture = cache.target.acquire(renderer, SDL_PIXELFORMAT_RGBA8888, view_w, view_h);
+	if (cache_texture == nullptr)
+		return nullptr;
+	if (cache_texture != previous) {
+		SDL_SetTextureBlendMode(cache_texture, SDL_BLENDMODE_BLEND);
+		cache.valid = false;
+	}
+
+	if (cache.valid && !cache.isDirty())
+		return cache_texture;
+
+	SDL_SetRenderTarget(renderer, cache_texture);
+	if (!cache.valid) {
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+		SDL_RenderClear(renderer);
+		renderTilemap(renderer, ref_textures, topleft, bottomright, tilemap[layer], false);
+	}
+	else {
+		// Tiles outside of the view aren't in the cache, so only the visible part of the region is re-baked
+		cho::Vector2i
+			dirty_topleft(std::max(topleft.x, cache.dirty_topleft.x), std::max(topleft.y, cache.dirty_topleft.y)),
+			dirty_bottomright(std::min(bottomright.x, cache.dirty_bottomright.x), std::min(bottomright.y, cache.dirty_bottomright.y));
+
+		if (dirty_topleft.x <= dirty_bottomright.x && dirty_topleft.y <= dirty_bottomright.y) {
+			int
+				clip_x1 = (int)std::floor(on_screen_origin.x + dirty_topleft.x * on_screen_tile_size),
+				clip_y1 = (int)std::floor(on_screen_origin.y + dirty_topleft.y * on_screen_tile_size),
+				clip_x2 = (int)std::ceil(on_screen_origin.x + (dirty_bottomright.x + 1) * on_screen_tile_size),
+				clip_y2 = (int)std::ceil(on_screen_origin.y + (dirty_bottomright.y + 1) * on_screen_tile_size);
+			SDL_Rect clip{ clip_x1, clip_y1, clip_x2 - clip_x1, clip_y2 - clip_y1 };
+
+			SDL_BlendMode blend_mode;
+			SDL_GetRenderDrawBlendMode(renderer, &blend_mode);
+			SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+			SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+			SDL_RenderSetClipRect(renderer, &clip);
+			SDL_RenderFillRect(renderer, &clip);
+			SDL_SetRenderDrawBlendMode(renderer, blend_mode);
+
+			// At fractional sizes the clip shares pixel rows and columns with the neighbouring tiles,
+			// a ring of them is redrawn to put back what the clear wiped
+			cho::Vector2i
+				ring_topleft(std::max({ 0, topleft.x, dirty_topleft.x - 1 }), std::max({ 0, topleft.y, dirty_topleft.y - 1 })),
+				ring_bottomright(
+					std::min({ tilemap_width - 1, bottomright.x, dirty_bottomright.x + 1 }),
+					std::min({ tilemap_height - 1, bottomright.y, dirty_bottomright.y + 1 }));
+			renderTilemap(renderer, ref_textures, ring_topleft, ring_bottomright, tilemap[layer], false);
+			SDL_RenderSetClipRect(renderer, nullptr);
+		}
 	}
+
+	cache.valid = true;
+	cache.clearDirty();
+	return cache_texture;
 }
 
 void EditArea::drawToTexture(SDL_Renderer* renderer, SDL_Texture* texture, const std::map<int, Texture>& ref_textures, int view_w, int view_h) {
+	drawMap(renderer, texture, ref_textures, view_w, view_h);
+
+	// Focused tile
+	view_pos = ImGui::GetWindowPos();
+	ImVec2 pos = ImGui::GetMousePos();
+	pos.x -= (on_screen_origin.x + ImGui::GetWindowPos().x);
+	pos.y -= (on_screen_origin.y + ImGui::GetWindowPos().y + 35);  // Menu bar offset
+	focused = getTileID(pos.x, pos.y);
+	if (selected_brush != BRUSH_SELECT)
+		renderFocus(highlight_line_color, renderer);
+	else if (isFloating())
+		renderTileRect(marquee_color, renderer, floatingPosition(), floating.getWidth(), floating.getHeight());
+	else if (isValidHover())
+		renderTileRect(highlight_line_color, renderer, focused, 1, 1);
+
+	if (hasMarquee())
+		renderTileRect(marquee_color, renderer, marquee_topleft,
+			marquee_bottomright.x - marquee_topleft.x + 1, marquee_bottomright.y - marquee_topleft.y + 1);
+
+	SDL_SetRenderTarget(renderer, nullptr);
+}
+
+void EditArea::setSelection(const TileSelection& new_selection) {
+	selection = new_selection;
 	selection_width = selection.bottomright.x - selection.topleft.id_on_texture.x + 1;
 	selection_height = selection.bottomright.y - selection.topleft.id_on_texture.y + 1;
+}
+
+void EditArea::drawMap(SDL_Renderer* renderer, SDL_Texture* texture, const std::map<int, Texture>& ref_textures, int view_w, int view_h) {
+	setSelection(selection);
 
 	// Draw lines
 	on_screen_tile_size = view_scale * tile_pixel_size;
@@ -211,27 +777,10 @@ void EditArea::drawToTexture(SDL_Renderer* renderer, SDL_Texture* texture, const
 
 	SDL_SetRenderDrawColor(renderer, clear_color.r, clear_color.g, clear_color.b, clear_color.a);
 	SDL_RenderClear(renderer);
-	SDL_SetRenderDrawColor(renderer, line_color.r, line_color.g, line_color.b, line_color.a);
-
-	// Vertical lines
-	for (int i = 0; i < tilemap_width + 1; i++) {
-		int
-			x1 = i * on_screen_tile_size + on_screen_origin.x,
-			y1 = on_screen_origin.y,
-			x2 = x1,
-			y2 = y1 + tilemap_height * on_screen_tile_size;
-		SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-	}
 
-	// Horizontal lines
-	for (int i = 0; i < tilemap_height + 1; i++) {
-		int
-			x1 = on_screen_origin.x,
-			y1 = i * on_screen_tile_size + on_screen_origin.y,
-			x2 = x1 + tilemap_width * on_screen_tile_size,
-			y2 = y1;
-		SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-	}
+	int target_w = view_w, target_h = view_h;
+	SDL_QueryTexture(texture, nullptr, nullptr, &target_w, &target_h);
+	grid.draw(renderer, line_color, on_screen_origin, on_screen_tile_size, tilemap_width, tilemap_height, target_w, target_h);
 
 	// TopLeft
 	int
@@ -239,43 +788,59 @@ void EditArea::drawToTexture(SDL_Renderer* renderer, SDL_Texture* texture, const
 		render_area_tl_y = std::max(0, (int)(-on_screen_origin.y / on_screen_tile_size));
 	// BottomRight
 	int
-		render_area_br_x = std::min(tilemap_width, (int)(render_area_tl_x + view_w / (int)on_screen_tile_size) + 1),
-		render_area_br_y = std::min(tilemap_height, (int)(render_area_tl_y + view_h / (int)on_screen_tile_size) + 1);
+		render_area_br_x = std::min(tilemap_width, (int)(render_area_tl_x + view_w / on_screen_tile_size) + 1),
+		render_area_br_y = std::min(tilemap_height, (int)(render_area_tl_y + view_h / on_screen_tile_size) + 1);
 
 	cho::Vector2i
 		render_area_topleft(render_area_tl_x, render_area_tl_y),
 		render_area_bottomright(render_area_br_x, render_area_br_y);
 
+	// Layer caches are baked in screen space, so any camera change invalidates them
+	if (on_screen_origin.x != cached_origin.x || on_screen_origin.y != cached_origin.y || on_screen_tile_size != cached_tile_size) {
+		invalidateCaches();
+		cached_origin = on_screen_origin;
+		cached_tile_size = on_screen_tile_size;
+	}
+
 	// Render tiles
 	for (size_t layer = 0; layer < tilemap.size(); layer++) {
 		if (!(*visibles)[layer].visible)
 			continue;
 
-		renderTilemap(
-			renderer,
-			ref_textures,
-			render_area_topleft,
-			render_area_bottomright,
-			tilemap[layer],
-			layer == rect_preview_layer
-		);
-	}
+		// The layer being edited with the rectangle brush is drawn live with its preview
+		bool is_preview_layer = (dragOrigin.x != -1) && (layer == rect_preview_layer);
+		SDL_Texture* cached = nullptr;
+		if (!is_preview_layer)
+			cached = bakeLayer(renderer, ref_textures, layer, target_w, target_h, render_area_topleft, render_area_bottomright);
 
-	// Focused tile
-	ImVec2 pos = ImGui::GetMousePos();
-	pos.x -= (on_screen_origin.x + ImGui::GetWindowPos().x);
-	pos.y -= (on_screen_origin.y + ImGui::GetWindowPos().y + 35);  // Menu bar offset
-	focused = getTileID(pos.x, pos.y);
-	renderFocus(highlight_line_color, renderer);
+		SDL_SetRenderTarget(renderer, texture);
+		if (cached != nullptr) {
+			SDL_RenderCopy(renderer, cached, nullptr, nullptr);
+			PROFILE_COUNT(ProfileCounter::DRAW_CALLS, 1);
+		}
+		else {
+			renderTilemap(
+				renderer,
+				ref_textures,
+				render_area_topleft,
+				render_area_bottomright,
+				tilemap[layer],
+				is_preview_layer
+			);
+		}
 
-	SDL_SetRenderTarget(renderer, nullptr);
+		// The floating block is drawn over its own layer, so the layer order is kept
+		if (isFloating() && floating.hasLayer(layer))
+			renderBlock(renderer, ref_textures, layer, render_area_topleft, render_area_bottomright);
+	}
 }
 
 SDL_Texture* draw_edit_area_texture(
-	SDL_Renderer* renderer, Uint32 format, int window_w, int window_h,
+	SDL_Renderer* renderer, RenderTarget& target, Uint32 format, int window_w, int window_h,
 	EditArea& editarea, int& focusflag, const std::map<int, Texture>& ref_textures,
-	std::map<int, Tilemap_visible>& visibles)
+	std::map<int, Tilemap_visible>& visibles, bool redraw)
 {
+	PROFILE_SCOPE("Edit area");
 	/* PREPARATION */
 	ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0, 0));
 	Uint32 window_flags = ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse |
@@ -289,15 +854,21 @@ SDL_Texture* draw_edit_area_texture(
 	if (!ImGui::IsItemHovered() && isCursorInsideWindow(ImGui::GetMousePos(), pos, size))
 		focusflag = FOCUSED_EDIT;
 
-	SDL_Texture* texture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_TARGET, (int)size.x, (int)size.y);
+	SDL_Texture* previous = target.get();
+	SDL_Texture* texture = target.acquire(renderer, format, (int)size.x, (int)size.y);
 	if (!texture) {
 		std::cerr << "Failed to create edit texture" << std::endl;
+		ImGui::End();
+		ImGui::PopStyleVar();
 		return nullptr;
 	}
 
 	/* ACTUAL RENDERING */
-	SDL_SetRenderTarget(renderer, texture);
-	editarea.drawToTexture(renderer, texture, ref_textures, window_w * EDIT_WIDTH, window_h);
+	// A freshly created target has undefined content
+	if (redraw || texture != previous) {
+		SDL_SetRenderTarget(renderer, texture);
+		editarea.drawToTexture(renderer, texture, ref_textures, window_w * EDIT_WIDTH, window_h);
+	}
 
 	ImGui::Image((void*)texture, ImVec2(size.x, size.y));
 	
@@ -8,14 +8,51 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <unordered_set>
+#include <functional>
+#include <climits>
 #include "chomusuke/common.h"
 #include "chomusuke/math.h"
 #include "useful.h"
+#include "TileLayer.h"
+#include "Rendering.h"
+#include "History.h"
+#include "Clipboard.h"
 
 
+/*
+* Screen-space bake of one layer for the current camera.
+* Only the dirty region is re-rendered as long as the camera doesn't move.
+*/
+struct LayerCache {
+	RenderTarget target{};
+	bool valid{ false };
+	// Tile-space region modified since the last bake (inclusive)
+	cho::Vector2i dirty_topleft{ INT_MAX, INT_MAX };
+	cho::Vector2i dirty_bottomright{ -1, -1 };
+
+	bool isDirty() const { return dirty_topleft.x <= dirty_bottomright.x && dirty_topleft.y <= dirty_bottomright.y; }
+	void markDirty(int x1, int y1, int x2, int y2) {
+		dirty_topleft = cho::Vector2i(std::min(dirty_topleft.x, x1), std::min(dirty_topleft.y, y1));
+		dirty_bottomright = cho::Vector2i(std::max(dirty_bottomright.x, x2), std::max(dirty_bottomright.y, y2));
+	}
+	void clearDirty() {
+		dirty_topleft = cho::Vector2i(INT_MAX, INT_MAX);
+		dirty_bottomright = cho::Vector2i(-1, -1);
+	}
+};
+
+enum class ClipboardMode {
+	NONE,
+	// The clipboard follows the cursor and is stamped on each click
+	PASTING,
+	// The selected tiles were lifted and follow the cursor until dropped
+	MOVING
+};
+
 class EditArea {
 	int tile_pixel_size{ 16 };
-	std::vector<TileMap> tilemap{};
+	std::vector<TileLayer> tilemap{};
 	TileID topleft{};
 	TileID focused{ -1, -1 };
 	int tilemap_width = 0;
@@ -27,12 +64,47 @@ class EditArea {
 	TileID dragOrigin{ -1, -1 };
 	TileID dragTopLeft{ -1, -1 };
 	TileID dragBottomRight{ -1, -1 };
-	TileMap rect_preview{};
+	// The rectangle preview isn't stored, its tiles are computed from the drag origin and the selection
+	bool drag_reversed_x{ false };
+	bool drag_reversed_y{ false };
 	int rect_preview_layer{ 0 };
+	// Last cell stamped by the basic brush, and every cell stamped during the current stroke
+	TileID stroke_last{ -1, -1 };
+	std::unordered_set<uint64_t> stroke_stamped{};
+	// Screen position of the edit view, used to convert mouse events to tiles
+	ImVec2 view_pos{};
+	// Marquee of the select brush (inclusive), x == -1 when nothing is selected
+	TileID marquee_origin{ -1, -1 };
+	TileID marquee_topleft{ -1, -1 };
+	TileID marquee_bottomright{ -1, -1 };
+	bool selecting{ false };
+	TileBlock clipboard{};
+	// Block following the cursor while pasting or moving
+	TileBlock floating{};
+	ClipboardMode clipboard_mode{ ClipboardMode::NONE };
+	// From the cursor to the top-left of the floating block
+	TileID floating_offset{ 0, 0 };
+	// Where the moved tiles came from, and the tiles as they were lifted (before any flip or rotation).
+	// They go back there if the move is cancelled.
+	TileID move_origin{ -1, -1 };
+	TileBlock lifted{};
 	int selection_width{ 1 };
 	int selection_height{ 1 };
 	bool rect_clear{ false };
 
+	// Per-texture geometry buffers, reused for every layer and every frame
+	std::map<int, TileBatch> batches{};
+	GridRenderer grid{};
+
+	// One cache per layer, kept in the same order as tilemap
+	std::vector<LayerCache> layer_caches{};
+	// View the caches were baked for
+	cho::Vector2f cached_origin{};
+	float cached_tile_size{ 0 };
+
+	// Cells written since beginEdit()
+	DeltaRecorder recorder{};
+
 	// PUBLIC MEMBERS
 public:
 	cho::Vector2f camera_pos{ DEFAULT_CAM_POS };
@@ -40,10 +112,13 @@ public:
 	SDL_Color line_color{ 150, 150, 150, 255 };
 	SDL_Color highlight_line_color{ 200, 200, 200, 255 };
 	SDL_Color clear_color{ 0, 0, 0, 255 };
+	SDL_Color marquee_color{ 90, 170, 255, 255 };
 	size_t selected_layer{ 0 };
 	TileSelection selection;
 	int selected_brush{ BRUSH_BASIC };
 	std::map<int, Tilemap_visible>* visibles{ nullptr };
+	// Called with the tiles changed by each stroke/rectangle
+	std::function<void(TileDelta&&)> on_edit;
 
 	// PUBLIC FUNCTIONS
 public:
@@ -55,26 +130,82 @@ public:
 		tilemap_height(tilemap_h)
 	{}
 	TileID getTileID(int mouse_x, int mouse_y);
+	// Tile under a point given in window coordinates
+	TileID screenToTile(int screen_x, int screen_y) const;
+	const std::vector<TileLayer>& getLayers() const { return tilemap; }
+	int getTilemapWidth() const { return tilemap_width; }
+	int getTilemapHeight() const { return tilemap_height; }
 	void drawToTexture(
 		SDL_Renderer* renderer,
 		SDL_Texture* texture,
 		const std::map<int, Texture>& ref_textures,
 		int view_w,
 		int view_h);
+	// Grid and layers only, without anything depending on the mouse (usable without ImGui)
+	void drawMap(
+		SDL_Renderer* renderer,
+		SDL_Texture* texture,
+		const std::map<int, Texture>& ref_textures,
+		int view_w,
+		int view_h);
+	void setSelection(const TileSelection& new_selection);
+	// The tile under the cursor is normally updated while drawing
+	void setFocusedTile(TileID tile) { focused = tile; }
 	void onPlace(bool clear = false);
 	void onAddLayer();
+	void insertLayer(int index, TileLayer&& layer);
+	// Removes a layer and gives it back
+	TileLayer takeLayer(int index);
+	// Replaces every layer, used when a map is loaded
+	void setLayers(std::vector<TileLayer>&& layers);
+	// Points the chunks of every layer at a freshly saved file, the tiles stay the same
+	void mapLayers(std::shared_ptr<const void> owner, std::vector<std::vector<const PackedTile*>>&& chunks);
 	void onDeleteLayer(int layer);
 	void onSwap(int a, int b);
 	void onStartDrag(bool clear = false);
 	void onDrag(bool clear_if_basic_brush = false);
 	void onEndDrag(bool cancelled = false);
+	// Extends the basic brush stroke to the given tile, stamping every cell along the way
+	void onStrokeTo(TileID target, bool clear);
+	// Fills the region of identical tiles around a cell with the selection pattern
+	void onFill(TileID seed, bool clear);
 	// Whether the mouse cursor is inside the grid
 	bool isValidHover();
 	// Whether the entire brush is inside the grid
 	bool isValidFocus();
+	// Whether the entire brush fits in the grid when placed at the given tile
+	bool isValidStamp(TileID at);
 	void renderFocus(SDL_Color color, SDL_Renderer* renderer);
 	void onDeleteTexture(int id);
 	void editOnReplaceRemoveTiles(int texture_id, int max_x, int max_y);
+	// The pixels of a texture changed, tiles using it have to be re-baked
+	void onTextureChanged(int texture_id);
+	// Number of tiles using the texture, over all layers
+	size_t textureUsage(int texture_id) const;
+	void destroy();
+	// Clipboard, they work on the marquee of the select brush across all layers
+	bool hasMarquee() const { return marquee_topleft.x != -1; }
+	bool hasClipboard() const { return !clipboard.empty(); }
+	bool isFloating() const { return clipboard_mode != ClipboardMode::NONE; }
+	void copySelection();
+	void cutSelection();
+	void deleteSelection();
+	void pasteClipboard();
+	void moveSelection();
+	// Transform the floating block, or the clipboard when nothing floats
+	void flipClipboard(bool horizontal);
+	void rotateClipboard(bool clockwise);
+	// Drops the pasted block, or puts the moved tiles back
+	void cancelFloating();
+	void deselect() { marquee_topleft = marquee_bottomright = TileID(-1, -1); }
+	// An edit spanning several events (a move) is in progress
+	bool isEditing() const { return recorder.isActive(); }
+
+	// Every tile written between these two calls ends up in the returned delta
+	void beginEdit();
+	TileDelta endEdit();
+	// Writes the before (undo) or after (redo) values of a delta
+	void applyDelta(const TileDelta& delta, bool redo);
 
 private:
 	void renderTilemap(
@@ -82,19 +213,56 @@ private:
 		const std::map<int, Texture>& ref_textures,
 		cho::Vector2i topleft,
 		cho::Vector2i bottomright,
-		TileMap& target, 
+		const TileLayer& target,
 		bool is_preview_layer);
+	SDL_Texture* bakeLayer(
+		SDL_Renderer* renderer,
+		const std::map<int, Texture>& ref_textures,
+		size_t layer,
+		int view_w,
+		int view_h,
+		cho::Vector2i topleft,
+		cho::Vector2i bottomright);
+	void invalidateCaches();
+	void setTile(size_t layer, int x, int y, PackedTile tile);
+	void finishRectangle(bool cancelled);
+	void stamp(TileID at, bool clear);
+	// Writes value(x) to [x1, x2] of row y, recording and invalidating the changed cells
+	template<typename Value>
+	void writeSpan(size_t layer, int y, int x1, int x2, Value&& value);
+	// Writes the non-empty tiles of a block with its top-left at the given tile
+	void placeBlock(const TileBlock& block, TileID at);
+	void clearRegion(TileID topleft, TileID bottomright);
+	void onSelectStart(bool right_click);
+	void onSelectDrag();
+	TileID floatingPosition() const { return TileID(focused.x + floating_offset.x, focused.y + floating_offset.y); }
+	void renderBlock(
+		SDL_Renderer* renderer,
+		const std::map<int, Texture>& ref_textures,
+		size_t layer,
+		cho::Vector2i topleft,
+		cho::Vector2i bottomright);
+	void renderTileRect(SDL_Color color, SDL_Renderer* renderer, TileID topleft, int w, int h);
+	// Tile drawn at (x, y) by the rectangle being dragged
+	PackedTile rectangleTile(int x, int y) const;
+	// Ends the current edit and hands it to on_edit
+	void commitEdit();
+	// Clears the tiles of a texture, in every layer, for which predicate(tile) is true
+	template<typename Pred>
+	void removeTilesIf(int texture_id, Pred&& predicate);
 };
 
 
 SDL_Texture* draw_edit_area_texture(
 	SDL_Renderer* renderer,
+	RenderTarget& target,
 	Uint32 format,
 	int window_w,
 	int window_h,
 	EditArea& editarea,
 	int& focusflag,
 	const std::map<int, Texture>& ref_textures,
-	std::map<int, Tilemap_visible>& visibles);
+	std::map<int, Tilemap_visible>& visibles,
+	bool redraw = true);
 
 #endif
\ No newline at end of file
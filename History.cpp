@@ -0,0 +1,98 @@
+#include "History.h"
+
+void DeltaRecorder::begin(size_t layer_count, size_t cells) {
+	delta = TileDelta();
+	touched.clear();
+	touched.resize(layer_count);
+	cell_count = cells;
+	pattern = TileDelta::Pattern();
+	active = true;
+}
+
+TileDelta DeltaRecorder::finish(const std::vector<TileLayer>& layers) {
+	active = false;
+	touched.clear();
+
+	if (pattern.width > 0) {
+		delta.pattern = pattern;
+		delta.runs.shrink_to_fit();
+		delta.before.shrink_to_fit();
+		return std::move(delta);
+	}
+	for (const TileDelta::Run& run : delta.runs) {
+		const TileLayer& layer = layers[run.layer];
+		int
+			x = (int)(run.start % layer.getWidth()),
+			y = (int)(run.start / layer.getWidth());
+		// Runs can wrap over several rows
+		for (uint32_t left = run.length; left > 0; y++, x = 0) {
+			int count = (int)std::min<uint32_t>(left, layer.getWidth() - x);
+			layer.readSpan(y, x, x + count - 1, [&](int, PackedTile tile) { appendSpan(delta.after, tile); });
+			left -= count;
+		}
+	}
+
+	delta.runs.shrink_to_fit();
+	delta.before.shrink_to_fit();
+	delta.after.shrink_to_fit();
+	return std::move(delta);
+}
+
+void History::push(HistoryEntry entry) {
+	// A new edit discards everything that could have been redone
+	for (HistoryEntry& discarded : redo_stack)
+		release(discarded);
+	redo_stack.clear();
+
+	memory_used += entry.bytes;
+	undo_stack.push_back(std::move(entry));
+	evict();
+}
+
+bool History::undo() {
+	if (undo_stack.empty())
+		return false;
+	HistoryEntry entry = std::move(undo_stack.back());
+	undo_stack.pop_back();
+	entry.undo();
+	redo_stack.push_back(std::move(entry));
+	return true;
+}
+
+bool History::redo() {
+	if (redo_stack.empty())
+		return false;
+	HistoryEntry entry = std::move(redo_stack.back());
+	redo_stack.pop_back();
+	entry.redo();
+	undo_stack.push_back(std::move(entry));
+	return true;
+}
+
+void History::clear() {
+	for (HistoryEntry& entry : undo_stack)
+		release(entry);
+	for (HistoryEntry& entry : redo_stack)
+		release(entry);
+	undo_stack.clear();
+	redo_stack.clear();
+}
+
+void History::setMemoryBudget(size_t bytes) {
+	memory_budget = bytes;
+	evict();
+}
+
+void History::evict() {
+	// The latest edit is always kept, even if it is larger than the budget on its own
+	while (memory_used > memory_budget && undo_stack.size() > 1) {
+		release(undo_stack.front());
+		undo_stack.pop_front();
+	}
+}
+
+void History::release(HistoryEntry& entry) {
+	memory_used -= entry.bytes;
+	if (entry.release)
+		entry.release();
+}
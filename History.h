@@ -0,0 +1,171 @@
+#ifndef TILEMAPEDITOR_HISTORY_H
+#define TILEMAPEDITOR_HISTORY_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+#include "TileLayer.h"
+
+constexpr size_t DEFAULT_HISTORY_BUDGET_MB{ 64 };
+
+/*
+* Tile changes made by one edit (a stroke, a rectangle, a texture deletion...).
+* Cells are stored as runs of consecutive indices (y * width + x) and
+* the before/after values of those cells are run-length encoded.
+* A fill with a multi-tile pattern barely compresses that way, so its after
+* values are kept as the pattern instead.
+*/
+struct TileDelta {
+	struct Run {
+		uint32_t layer;
+		uint32_t start;
+		uint32_t length;
+	};
+	struct Span {
+		PackedTile tile;
+		uint32_t count;
+	};
+
+	// Cell (x, y) holds the tile origin moved by ((x - anchor_x) mod width, (y - anchor_y) mod height) on its texture
+	struct Pattern {
+		PackedTile origin{ EMPTY_TILE };
+		int32_t width{ 0 };
+		int32_t height{ 0 };
+		int32_t anchor_x{ 0 };
+		int32_t anchor_y{ 0 };
+		// Width of the map the indices refer to
+		int32_t map_width{ 0 };
+
+		PackedTile at(uint32_t index) const {
+			int
+				dx = ((int)(index % map_width) - anchor_x) % width,
+				dy = ((int)(index / map_width) - anchor_y) % height;
+			dx += (dx < 0 ? width : 0);
+			dy += (dy < 0 ? height : 0);
+			return origin + (PackedTile)dx + ((PackedTile)dy << PACKED_COORD_BITS);
+		}
+	};
+
+	std::vector<Run> runs{};
+	std::vector<Span> before{};
+	std::vector<Span> after{};
+	// Used instead of after when its width isn't 0
+	Pattern pattern{};
+
+	bool empty() const { return runs.empty(); }
+	bool hasPattern() const { return pattern.width > 0; }
+	size_t memoryUsage() const { return runs.capacity() * sizeof(Run) + (before.capacity() + after.capacity()) * sizeof(Span); }
+
+	// f(layer, index, tile) for every cell, with either its before or after value
+	template<typename Func>
+	void forEachCell(bool use_after, Func&& f) const {
+		if (use_after && hasPattern()) {
+			for (const Run& run : runs)
+				for (uint32_t i = 0; i < run.length; i++)
+					f(run.layer, run.start + i, pattern.at(run.start + i));
+			return;
+		}
+		const std::vector<Span>& spans = (use_after ? after : before);
+		size_t span = 0;
+		uint32_t used_in_span = 0;
+		for (const Run& run : runs) {
+			for (uint32_t i = 0; i < run.length; i++) {
+				f(run.layer, run.start + i, spans[span].tile);
+				if (++used_in_span == spans[span].count) {
+					span++;
+					used_in_span = 0;
+				}
+			}
+		}
+	}
+};
+
+/*
+* Collects the cells written during an edit.
+* Only the first write of a cell is recorded (with its previous value),
+* the after values are read from the layers once the edit is over.
+*/
+class DeltaRecorder {
+	TileDelta delta{};
+	// Set when every cell recorded so far was written from this pattern
+	TileDelta::Pattern pattern{};
+	// One bit per cell and per layer, allocated when a layer is first written to
+	std::vector<std::vector<uint64_t>> touched{};
+	size_t cell_count{ 0 };
+	bool active{ false };
+
+public:
+	void begin(size_t layer_count, size_t cells);
+	bool isActive() const { return active; }
+	bool isEmpty() const { return delta.runs.empty(); }
+	// Every cell recorded so far holds a tile of this pattern, until another one changes
+	void setPattern(const TileDelta::Pattern& written) { pattern = written; }
+	static void appendSpan(std::vector<TileDelta::Span>& spans, PackedTile tile) {
+		if (!spans.empty() && spans.back().tile == tile)
+			spans.back().count++;
+		else
+			spans.push_back({ tile, 1 });
+	}
+	// Called for every tile write, so it is kept inline
+	void record(uint32_t layer, uint32_t index, PackedTile before) {
+		if (!active || layer >= touched.size())
+			return;
+		pattern.width = 0;
+
+		std::vector<uint64_t>& bits = touched[layer];
+		if (bits.empty())
+			bits.resize((cell_count + 63) / 64, 0);
+		uint64_t mask = 1ull << (index % 64);
+		if (bits[index / 64] & mask)
+			return;
+		bits[index / 64] |= mask;
+
+		if (!delta.runs.empty() && delta.runs.back().layer == layer && delta.runs.back().start + delta.runs.back().length == index)
+			delta.runs.back().length++;
+		else
+			delta.runs.push_back({ layer, index, 1 });
+		appendSpan(delta.before, before);
+	}
+	TileDelta finish(const std::vector<TileLayer>& layers);
+};
+
+struct HistoryEntry {
+	std::function<void()> undo{};
+	std::function<void()> redo{};
+	// Called once the entry leaves the history for good (eviction, discarded redo, clear)
+	std::function<void()> release{};
+	size_t bytes{ 0 };
+};
+
+/*
+* Undo/redo stacks. The oldest entries are evicted when the total size
+* of the recorded entries goes over the memory budget.
+*/
+class History {
+	std::deque<HistoryEntry> undo_stack{};
+	std::vector<HistoryEntry> redo_stack{};
+	size_t memory_budget{ DEFAULT_HISTORY_BUDGET_MB << 20 };
+	size_t memory_used{ 0 };
+
+public:
+	History() = default;
+	History(const History&) = delete;
+	History& operator=(const History&) = delete;
+	~History() { clear(); }
+
+	void push(HistoryEntry entry);
+	bool undo();
+	bool redo();
+	bool canUndo() const { return !undo_stack.empty(); }
+	bool canRedo() const { return !redo_stack.empty(); }
+	void clear();
+	void setMemoryBudget(size_t bytes);
+	size_t getMemoryUsed() const { return memory_used; }
+
+private:
+	void evict();
+	void release(HistoryEntry& entry);
+};
+
+#endif
@@ -0,0 +1,230 @@
+#include "InputRecording.h"
+#include <cstring>
+#include <iostream>
+
+namespace {
+	template<typename T>
+	void put(std::vector<unsigned char>& out, T value) {
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+		out.insert(out.end(), bytes, bytes + sizeof(T));
+	}
+
+	class Reader {
+		const std::vector<unsigned char>& data;
+		size_t offset{ 0 };
+
+	public:
+		Reader(const std::vector<unsigned char>& data_) : data(data_) {}
+		bool atEnd() const { return offset == data.size(); }
+		template<typename T>
+		bool get(T& value) {
+			if (data.size() - offset < sizeof(T))
+				return false;
+			memcpy(&value, data.data() + offset, sizeof(T));
+			offset += sizeof(T);
+			return true;
+		}
+		bool get(void* out, size_t size) {
+			if (data.size() - offset < size)
+				return false;
+			memcpy(out, data.data() + offset, size);
+			offset += size;
+			return true;
+		}
+	};
+
+	// Returns false for the events that aren't recorded
+	bool encodeEvent(std::vector<unsigned char>& out, const SDL_Event& event) {
+		switch (event.type) {
+		case SDL_QUIT:
+			put<uint32_t>(out, event.type);
+			return true;
+		case SDL_MOUSEMOTION:
+			put<uint32_t>(out, event.type);
+			put<int32_t>(out, event.motion.x);
+			put<int32_t>(out, event.motion.y);
+			put<int32_t>(out, event.motion.xrel);
+			put<int32_t>(out, event.motion.yrel);
+			put<uint32_t>(out, event.motion.state);
+			return true;
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP:
+			put<uint32_t>(out, event.type);
+			put<uint8_t>(out, event.button.button);
+			put<uint8_t>(out, event.button.state);
+			put<uint8_t>(out, event.button.clicks);
+			put<int32_t>(out, event.button.x);
+			put<int32_t>(out, event.button.y);
+			return true;
+		case SDL_MOUSEWHEEL:
+			put<uint32_t>(out, event.type);
+			put<int32_t>(out, event.wheel.x);
+			put<int32_t>(out, event.wheel.y);
+			put<uint32_t>(out, event.wheel.direction);
+			put<float>(out, event.wheel.preciseX);
+			put<float>(out, event.wheel.preciseY);
+			return true;
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:
+			put<uint32_t>(out, event.type);
+			put<uint8_t>(out, event.key.state);
+			put<uint8_t>(out, event.key.repeat);
+			put<int32_t>(out, event.key.keysym.scancode);
+			put<int32_t>(out, event.key.keysym.sym);
+			put<uint16_t>(out, event.key.keysym.mod);
+			return true;
+		case SDL_TEXTINPUT:
+			put<uint32_t>(out, event.type);
+			out.insert(out.end(), event.text.text, event.text.text + sizeof(event.text.text));
+			return true;
+		case SDL_WINDOWEVENT:
+			put<uint32_t>(out, event.type);
+			put<uint8_t>(out, event.window.event);
+			put<int32_t>(out, event.window.data1);
+			put<int32_t>(out, event.window.data2);
+			return true;
+		}
+		return false;
+	}
+
+	bool decodeEvent(Reader& reader, SDL_Event& event) {
+		memset(&event, 0, sizeof(event));
+		uint32_t type;
+		if (!reader.get(type))
+			return false;
+		event.type = type;
+
+		int32_t scancode, sym;
+		uint16_t mod;
+		switch (type) {
+		case SDL_QUIT:
+			return true;
+		case SDL_MOUSEMOTION:
+			return reader.get(event.motion.x) && reader.get(event.motion.y) &&
+				reader.get(event.motion.xrel) && reader.get(event.motion.yrel) && reader.get(event.motion.state);
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP:
+			return reader.get(event.button.button) && reader.get(event.button.state) && reader.get(event.button.clicks) &&
+				reader.get(event.button.x) && reader.get(event.button.y);
+		case SDL_MOUSEWHEEL:
+			return reader.get(event.wheel.x) && reader.get(event.wheel.y) && reader.get(event.wheel.direction) &&
+				reader.get(event.wheel.preciseX) && reader.get(event.wheel.preciseY);
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:
+			if (!(reader.get(event.key.state) && reader.get(event.key.repeat) &&
+				reader.get(scancode) && reader.get(sym) && reader.get(mod)))
+				return false;
+			event.key.keysym.scancode = (SDL_Scancode)scancode;
+			event.key.keysym.sym = (SDL_Keycode)sym;
+			event.key.keysym.mod = mod;
+			return true;
+		case SDL_TEXTINPUT:
+			if (!reader.get(event.text.text, sizeof(event.text.text)))
+				return false;
+			event.text.text[sizeof(event.text.text) - 1] = '\0';
+			return true;
+		case SDL_WINDOWEVENT:
+			return reader.get(event.window.event) && reader.get(event.window.data1) && reader.get(event.window.data2);
+		}
+		return false;
+	}
+}
+
+bool InputRecorder::open(const std::string& path, int window_w, int window_h) {
+	close();
+	file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		std::cout << "Failed to open " << path << std::endl;
+		return false;
+	}
+
+	std::vector<unsigned char> header(INPUT_LOG_MAGIC, INPUT_LOG_MAGIC + sizeof(INPUT_LOG_MAGIC));
+	put<uint32_t>(header, INPUT_LOG_VERSION);
+	put<int32_t>(header, window_w);
+	put<int32_t>(header, window_h);
+	fwrite(header.data(), 1, header.size(), file);
+	return true;
+}
+
+void InputRecorder::record(const SDL_Event& event) {
+	if (file != nullptr && pending_count < UINT16_MAX && encodeEvent(pending, event))
+		pending_count++;
+}
+
+void InputRecorder::endFrame(uint32_t frame, float delta) {
+	if (file == nullptr || pending_count == 0)
+		return;
+
+	std::vector<unsigned char> header;
+	put<uint32_t>(header, frame);
+	put<float>(header, delta);
+	put<uint16_t>(header, pending_count);
+	fwrite(header.data(), 1, header.size(), file);
+	fwrite(pending.data(), 1, pending.size(), file);
+	pending.clear();
+	pending_count = 0;
+}
+
+void InputRecorder::close() {
+	if (file == nullptr)
+		return;
+	if (fclose(file) != 0)
+		std::cout << "Failed to write the input log" << std::endl;
+	file = nullptr;
+	pending.clear();
+	pending_count = 0;
+}
+
+bool loadInputLog(
+	const std::string& path,
+	int& window_w,
+	int& window_h,
+	std::vector<RecordedFrame>& frames,
+	std::string& error)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		error = "Failed to open " + path;
+		return false;
+	}
+	std::vector<unsigned char> data;
+	unsigned char buffer[1 << 16];
+	for (size_t read; (read = fread(buffer, 1, sizeof(buffer), file)) > 0;)
+		data.insert(data.end(), buffer, buffer + read);
+	fclose(file);
+
+	Reader reader(data);
+	char magic[sizeof(INPUT_LOG_MAGIC)];
+	uint32_t version;
+	int32_t w, h;
+	if (!reader.get(magic, sizeof(magic)) || memcmp(magic, INPUT_LOG_MAGIC, sizeof(magic)) != 0 ||
+		!reader.get(version) || !reader.get(w) || !reader.get(h)) {
+		error = path + " is not an input log";
+		return false;
+	}
+	if (version != INPUT_LOG_VERSION) {
+		error = "Unsupported input log version " + std::to_string(version);
+		return false;
+	}
+	window_w = w;
+	window_h = h;
+
+	frames.clear();
+	while (!reader.atEnd()) {
+		RecordedFrame frame;
+		uint16_t count;
+		if (!reader.get(frame.frame) || !reader.get(frame.delta) || !reader.get(count)) {
+			error = "Truncated frame in " + path;
+			return false;
+		}
+		frame.events.resize(count);
+		for (SDL_Event& event : frame.events) {
+			if (!decodeEvent(reader, event)) {
+				error = "Invalid event in frame " + std::to_string(frame.frame);
+				return false;
+			}
+		}
+		frames.push_back(std::move(frame));
+	}
+	return true;
+}
@@ -0,0 +1,51 @@
+#ifndef TILEMAPEDITOR_INPUTRECORDING_H
+#define TILEMAPEDITOR_INPUTRECORDING_H
+
+#include <SDL.h>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+constexpr char INPUT_LOG_MAGIC[4]{ 'T', 'M', 'E', 'I' };
+constexpr uint32_t INPUT_LOG_VERSION{ 1 };
+
+/*
+* Binary input log, in host byte order:
+*   header:  magic, version, window width, window height
+*   frames:  frame index (u32), delta (f32), event count (u16), then the events
+*   event:   SDL event type (u32) followed by the fields the editor uses for that type
+* Only frames that received events are written, and events the editor ignores are dropped.
+*/
+struct RecordedFrame {
+	uint32_t frame{ 0 };
+	float delta{ 0 };
+	std::vector<SDL_Event> events{};
+};
+
+class InputRecorder {
+	FILE* file{ nullptr };
+	// Events of the current frame, written with the frame's delta
+	std::vector<unsigned char> pending{};
+	uint16_t pending_count{ 0 };
+
+public:
+	~InputRecorder() { close(); }
+
+	bool open(const std::string& path, int window_w, int window_h);
+	bool isOpen() const { return file != nullptr; }
+	void record(const SDL_Event& event);
+	// Writes the events received since the previous call
+	void endFrame(uint32_t frame, float delta);
+	void close();
+};
+
+// Returns false, with a message in error, if the log can't be read
+bool loadInputLog(
+	const std::string& path,
+	int& window_w,
+	int& window_h,
+	std::vector<RecordedFrame>& frames,
+	std::string& error);
+
+#endif
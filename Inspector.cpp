@@ -1,4 +1,5 @@
 #include "Inspector.h"
+#include "Profiler.h"
 
 static char new_name[32] = "";
 
@@ -9,21 +10,44 @@ void InspectorArea::addNewLayer() {
 	selected = layer_names.size() - 1;
 }
 
+void InspectorArea::setLayers(const std::vector<std::string>& names, const std::vector<bool>& visibles) {
+	layer_names = names;
+	visible_layers.clear();
+	for (size_t i = 0; i < visibles.size(); i++)
+		visible_layers[i].visible = visibles[i];
+	selected = 0;
+}
+
 void InspectorArea::deleteLayer() {
 	if (layer_names.size() < 2) return;
 	on_delete_layer(deleting_layer);
-	layer_names.erase(layer_names.begin() + deleting_layer);
-
-	// Unless the user has selected another layer, bring the selection 1 layer below for natural behaviour
-	if(selected == deleting_layer){
-		visible_layers[deleting_layer].visible = true;
-		selected = (size_t)std::max(0, (int)deleting_layer - 1);
-	}
+	removeLayer(deleting_layer);
 
 	show_delete_warn = !_tmp_do_not_show_again;
 	deleting_layer = -1;
 }
 
+void InspectorArea::insertLayer(int index, const std::string& name, bool visible) {
+	layer_names.insert(layer_names.begin() + index, name);
+	for (int i = (int)layer_names.size() - 1; i > index; i--)
+		visible_layers[i] = visible_layers[i - 1];
+	visible_layers[index].visible = visible;
+	selected = index;
+}
+
+void InspectorArea::removeLayer(int index) {
+	layer_names.erase(layer_names.begin() + index);
+	for (int i = index; i < (int)layer_names.size(); i++)
+		visible_layers[i] = visible_layers[i + 1];
+	visible_layers.erase((int)layer_names.size());
+
+	// Unless the user has selected another layer, bring the selection 1 layer below for natural behaviour
+	if (selected == index)
+		selected = (size_t)std::max(0, index - 1);
+	else if (selected > (size_t)index)
+		selected--;
+}
+
 void InspectorArea::drawToTexture(int view_w, int view_h) {
 	ImGui::Text("Layers");
 	ImGui::Separator();
@@ -65,6 +89,8 @@ void InspectorArea::drawToTexture(int view_w, int view_h) {
 
 	if (ImGui::Button("Toggle visibility")) {
 		visible_layers[selected] = { .visible = !visible_layers[selected].visible };
+		if (on_layer_changed)
+			on_layer_changed((int)selected);
 	}
 
 	/* Renaming window */
@@ -75,6 +101,8 @@ void InspectorArea::drawToTexture(int view_w, int view_h) {
 		if (ImGui::Button("Confirm")) {
 			layer_names[selected] = std::string(new_name);
 			renaming = false;
+			if (on_layer_changed)
+				on_layer_changed((int)selected);
 		}
 		ImGui::End();
 	}
@@ -92,7 +120,7 @@ void InspectorArea::drawToTexture(int view_w, int view_h) {
 			ImGui::SameLine();
 			if (ImGui::Button("No"))
 				deleting_layer = -1;
-			ImGui::Text("Warning: You will NOT be able to undo this change so be careful!");
+			ImGui::Text("This can be undone with Ctrl+Z.");
 			ImGui::NewLine();
 			ImGui::Separator();
 			ImGui::Checkbox("Do not show this warning again in this session (restart to reset)", &_tmp_do_not_show_again);
@@ -108,8 +136,13 @@ void InspectorArea::drawToTexture(int view_w, int view_h) {
 	ImGui::NewLine();
 	ImGui::Text("Brush");
 	ImGui::Separator();
+	int previous_brush = selected_brush;
 	ImGui::RadioButton("Basic", &selected_brush, BRUSH_BASIC); ImGui::SameLine();
-	ImGui::RadioButton("Rectangle", &selected_brush, BRUSH_RECTANGLE);
+	ImGui::RadioButton("Rectangle", &selected_brush, BRUSH_RECTANGLE); ImGui::SameLine();
+	ImGui::RadioButton("Fill", &selected_brush, BRUSH_FILL); ImGui::SameLine();
+	ImGui::RadioButton("Select", &selected_brush, BRUSH_SELECT);
+	if (selected_brush != previous_brush && on_brush_changed)
+		on_brush_changed(selected_brush);
 	ImGui::Text("* Left click to draw, Right click to erase");
 
 	/* misc */
@@ -120,45 +153,48 @@ void InspectorArea::drawToTexture(int view_w, int view_h) {
 	ImGui::Checkbox("Show application framerate", &show_framerate);
 	if (show_framerate)
 		ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io->Framerate, io->Framerate);
+#ifdef TILEMAPEDITOR_PROFILE
+	ImGui::Checkbox("Show profiler", &show_profiler);
+#endif
+	ImGui::SliderInt("Undo memory (MB)", &history_budget_mb, 1, 1024);
+	ImGui::Text("Undo history: %.1f MB", history_memory_used / (1024.0f * 1024.0f));
+	ImGui::SliderInt("Autosave interval (s)", &autosave_interval_s, 0, 1800);
+	if (ImGui::IsItemHovered())
+		ImGui::SetTooltip("0 disables autosaving");
+	ImGui::SliderInt("Autosaves kept", &autosaves_kept, 1, 50);
+	if (!autosave_status.empty())
+		ImGui::TextWrapped("%s", autosave_status.c_str());
 }
 
 bool InspectorArea::swap(int a, int b) {
 	if (a < 0 || a >= layer_names.size() || b < 0 || b >= layer_names.size()) 
 		return false;
 	on_swap(a, b);
-	std::swap(layer_names.at(a), layer_names.at(b));
+	swapLayers(a, b);
 	return true;
 }
 
-SDL_Texture* draw_inspector_area_texture(
-	SDL_Renderer* renderer,
-	Uint32 format,
+void InspectorArea::swapLayers(int a, int b) {
+	std::swap(layer_names.at(a), layer_names.at(b));
+	std::swap(visible_layers[a], visible_layers[b]);
+}
+
+void draw_inspector_area(
 	int window_w,
 	int window_h,
 	InspectorArea& inspector
 	) 
 {
+	PROFILE_SCOPE("Inspector");
 	Uint32 window_flags = ImGuiWindowFlags_NoBringToFrontOnFocus | ImGuiWindowFlags_MenuBar | ImGuiWindowFlags_NoMove |
 		ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoCollapse;
 	ImGui::Begin("Inspector", (bool*)0, window_flags);
 	float view_w = window_w * INSPECTOR_WIDTH;
 	ImGui::SetWindowPos(ImVec2(window_w * (EDIT_WIDTH + PALETTE_WIDTH), 0), ImGuiCond_Once);
 	ImGui::SetWindowSize(ImVec2(view_w, (float)window_h), ImGuiCond_Once);
-	ImVec2 size = ImGui::GetWindowSize();
-
-	SDL_Texture* texture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_TARGET, (int)size.x, (int)size.y);
-	if (!texture) {
-		std::cerr << "Failed to create edit texture" << std::endl;
-		return nullptr;
-	}
 
 	/* ACTUAL RENDERING */
-	SDL_SetRenderTarget(renderer, texture);
+	// The inspector only consists of ImGui widgets, so no SDL render target is needed
 	inspector.drawToTexture(view_w, window_h);
-	ImGui::Image((void*)texture, ImVec2(size.x, size.y));
 	ImGui::End();
-
-	SDL_SetRenderTarget(renderer, nullptr);
-
-	return texture;
 }
\ No newline at end of file
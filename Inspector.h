@@ -11,6 +11,8 @@
 #include <map>
 #include "chomusuke/common.h"
 #include "useful.h"
+#include "History.h"
+#include "Autosave.h"
 
 
 class InspectorArea {
@@ -24,23 +26,39 @@ public:
 	std::function<void()> on_add_layer;
 	std::function<void(int)> on_delete_layer;
 	std::function<void(int, int)> on_swap;
+	// Called after a layer is renamed or shown/hidden
+	std::function<void(int)> on_layer_changed;
+	// Called with the new brush when another one is picked
+	std::function<void(int)> on_brush_changed;
 	std::vector<std::string> layer_names;
 	std::map<int, Tilemap_visible> visible_layers;
 	ImGuiIO* io{ nullptr };
 	size_t selected = 0;
 	int selected_brush{ 0 };
+	int history_budget_mb{ (int)DEFAULT_HISTORY_BUDGET_MB };
+	size_t history_memory_used{ 0 };
+	// 0 disables autosaving
+	int autosave_interval_s{ DEFAULT_AUTOSAVE_INTERVAL_S };
+	int autosaves_kept{ DEFAULT_AUTOSAVES_KEPT };
+	std::string autosave_status{};
+	// Only used in builds with TILEMAPEDITOR_PROFILE
+	bool show_profiler{ false };
 	InspectorArea() = default;
 
 	void addNewLayer();
+	// Replaces the layer list without notifying the edit area
+	void setLayers(const std::vector<std::string>& names, const std::vector<bool>& visibles);
 	void deleteLayer();
+	// Insert/remove a layer without notifying the edit area, used by undo/redo
+	void insertLayer(int index, const std::string& name, bool visible);
+	void removeLayer(int index);
+	void swapLayers(int a, int b);
 	void drawToTexture(int view_w, int view_h);
 	bool swap(int a, int b);
 	bool allowControl(){ return !(renaming || (deleting_layer != -1)); }
 };
 
-SDL_Texture* draw_inspector_area_texture(
-	SDL_Renderer* renderer,
-	Uint32 format,
+void draw_inspector_area(
 	int window_w,
 	int window_h,
 	InspectorArea& inspector
@@ -0,0 +1,530 @@
+#include "Journal.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <zlib.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+	const std::string JOURNAL_PREFIX = "journal-";
+	const std::string JOURNAL_EXTENSION = ".tmj";
+
+	template<typename T>
+	void put(std::vector<unsigned char>& out, T value) {
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+		out.insert(out.end(), bytes, bytes + sizeof(T));
+	}
+
+	void putString(std::vector<unsigned char>& out, const std::string& text) {
+		put<uint32_t>(out, (uint32_t)text.size());
+		out.insert(out.end(), text.begin(), text.end());
+	}
+
+	class Reader {
+		const unsigned char* data;
+		size_t size;
+		size_t offset{ 0 };
+
+	public:
+		Reader(const unsigned char* data_, size_t size_) : data(data_), size(size_) {}
+		bool atEnd() const { return offset == size; }
+		size_t position() const { return offset; }
+		template<typename T>
+		bool get(T& value) {
+			if (size - offset < sizeof(T))
+				return false;
+			memcpy(&value, data + offset, sizeof(T));
+			offset += sizeof(T);
+			return true;
+		}
+		bool getString(std::string& out) {
+			uint32_t length;
+			if (!get(length) || size - offset < length)
+				return false;
+			out.assign((const char*)data + offset, length);
+			offset += length;
+			return true;
+		}
+		// Reads count values into a vector, without trusting count for the allocation
+		template<typename T>
+		bool getArray(std::vector<T>& out, uint32_t count) {
+			if ((size - offset) / sizeof(T) < count)
+				return false;
+			out.resize(count);
+			if (count > 0)
+				memcpy(out.data(), data + offset, sizeof(T) * count);
+			offset += sizeof(T) * count;
+			return true;
+		}
+	};
+
+	uint32_t checksum(const unsigned char* data, size_t size) {
+		return (uint32_t)crc32(crc32(0L, Z_NULL, 0), data, (uInt)size);
+	}
+
+	void syncFile(FILE* file) {
+		fflush(file);
+#ifdef _WIN32
+		_commit(_fileno(file));
+#else
+		fsync(fileno(file));
+#endif
+	}
+
+	std::vector<unsigned char> encodeHeader(const JournalBase& base) {
+		std::vector<unsigned char> header(JOURNAL_MAGIC, JOURNAL_MAGIC + sizeof(JOURNAL_MAGIC));
+		put<uint32_t>(header, JOURNAL_VERSION);
+		put<uint8_t>(header, (uint8_t)base.kind);
+		putString(header, base.path);
+		put<int32_t>(header, base.width);
+		put<int32_t>(header, base.height);
+		put<int32_t>(header, base.tile_size);
+		put<uint32_t>(header, (uint32_t)base.texture_ids.size());
+		for (int id : base.texture_ids)
+			put<int32_t>(header, id);
+		put<uint8_t>(header, base.fingerprinted ? 1 : 0);
+		put<uint64_t>(header, base.file_size);
+		put<int64_t>(header, base.file_time);
+		put<uint32_t>(header, checksum(header.data(), header.size()));
+		return header;
+	}
+
+	bool decodeHeader(Reader& reader, const unsigned char* start, JournalBase& base) {
+		char magic[sizeof(JOURNAL_MAGIC)];
+		uint32_t version, texture_count, crc;
+		uint8_t kind, fingerprinted;
+		int32_t width, height, tile_size;
+		for (char& c : magic)
+			if (!reader.get(c))
+				return false;
+		if (memcmp(magic, JOURNAL_MAGIC, sizeof(magic)) != 0 || !reader.get(version) || version != JOURNAL_VERSION)
+			return false;
+		if (!reader.get(kind) || kind > (uint8_t)JournalBaseKind::NATIVE || !reader.getString(base.path) ||
+			!reader.get(width) || !reader.get(height) || !reader.get(tile_size) ||
+			!reader.get(texture_count) || !reader.getArray(base.texture_ids, texture_count) ||
+			!reader.get(fingerprinted) || !reader.get(base.file_size) || !reader.get(base.file_time))
+			return false;
+		base.fingerprinted = (fingerprinted != 0);
+		size_t header_size = encodeHeader(base).size() - sizeof(uint32_t);
+		if (!reader.get(crc) || crc != checksum(start, header_size))
+			return false;
+		base.kind = (JournalBaseKind)kind;
+		base.width = width;
+		base.height = height;
+		base.tile_size = tile_size;
+		return width > 0 && height > 0 && tile_size > 0;
+	}
+
+	bool decodeRecord(JournalRecordType type, Reader& payload, JournalRecord& record) {
+		record.type = type;
+		int32_t index = 0, other = 0;
+		uint8_t visible = 1;
+		switch (type) {
+		case JournalRecordType::TILES: {
+			uint32_t run_count, span_count;
+			if (!payload.get(run_count) || !payload.getArray(record.tiles.runs, run_count) ||
+				!payload.get(span_count) || !payload.getArray(record.tiles.after, span_count))
+				return false;
+			// Every cell needs a value
+			uint64_t cells = 0, values = 0;
+			for (const TileDelta::Run& run : record.tiles.runs)
+				cells += run.length;
+			for (const TileDelta::Span& span : record.tiles.after)
+				values += span.count;
+			return cells == values;
+		}
+		case JournalRecordType::TILE_PATTERN: {
+			uint32_t run_count;
+			TileDelta::Pattern& pattern = record.tiles.pattern;
+			if (!payload.get(run_count) || !payload.getArray(record.tiles.runs, run_count) || !payload.get(pattern))
+				return false;
+			record.type = JournalRecordType::TILES;
+			// The pattern has to stay on its texture
+			return pattern.origin != EMPTY_TILE && pattern.width > 0 && pattern.height > 0 && pattern.map_width > 0 &&
+				(pattern.origin & PACKED_COORD_MASK) + pattern.width <= (1u << PACKED_COORD_BITS) &&
+				((pattern.origin >> PACKED_COORD_BITS) & PACKED_COORD_MASK) + pattern.height <= (1u << PACKED_COORD_BITS);
+		}
+		case JournalRecordType::INSERT_LAYER:
+		case JournalRecordType::LAYER_PROPERTIES:
+			if (!payload.get(index) || !payload.get(visible) || !payload.getString(record.name))
+				return false;
+			break;
+		case JournalRecordType::REMOVE_LAYER:
+		case JournalRecordType::REMOVE_TEXTURE:
+			if (!payload.get(index))
+				return false;
+			break;
+		case JournalRecordType::SWAP_LAYERS:
+			if (!payload.get(index) || !payload.get(other))
+				return false;
+			break;
+		case JournalRecordType::SET_TEXTURE:
+			if (!payload.get(index) || !payload.getString(record.name) || !payload.getString(record.path))
+				return false;
+			break;
+		default:
+			return false;
+		}
+		record.index = index;
+		record.other = other;
+		record.visible = (visible != 0);
+		return true;
+	}
+
+	// Tiles of a whole layer, one run per chunk row
+	TileDelta layerContent(uint32_t layer_index, const TileLayer& layer) {
+		TileDelta content;
+		layer.forEachChunk([&](int chunk_x, int chunk_y, const PackedTile* tiles) {
+			int
+				columns = std::min(CHUNK_SIZE, layer.getWidth() - chunk_x * CHUNK_SIZE),
+				rows = std::min(CHUNK_SIZE, layer.getHeight() - chunk_y * CHUNK_SIZE);
+			for (int row = 0; row < rows; row++) {
+				uint32_t start = (uint32_t)((chunk_y * CHUNK_SIZE + row) * layer.getWidth() + chunk_x * CHUNK_SIZE);
+				content.runs.push_back({ layer_index, start, (uint32_t)columns });
+				for (int column = 0; column < columns; column++)
+					DeltaRecorder::appendSpan(content.after, tiles[(size_t)row * CHUNK_SIZE + column]);
+			}
+		});
+		return content;
+	}
+
+	std::string makeSessionName() {
+		std::time_t now = std::time(nullptr);
+		std::tm local{};
+#ifdef _WIN32
+		localtime_s(&local, &now);
+#else
+		localtime_r(&now, &local);
+#endif
+		char buffer[32];
+		std::strftime(buffer, sizeof(buffer), "%Y%m%d-%H%M%S", &local);
+		// Two editors started in the same second don't share a session
+		std::random_device random;
+		char suffix[16];
+		snprintf(suffix, sizeof(suffix), "-%04x", random() & 0xFFFF);
+		return std::string(buffer) + suffix;
+	}
+}
+
+void Journal::open(const std::string& journal_directory) {
+	if (isOpen())
+		return;
+	directory = journal_directory;
+	session = makeSessionName();
+	segment_count = 0;
+	stopping = false;
+	std::error_code code;
+	std::filesystem::create_directories(directory, code);
+	writer = std::thread([this]() { run(); });
+}
+
+void Journal::close(bool discard) {
+	if (!isOpen())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	writer.join();
+
+	if (file != nullptr) {
+		syncFile(file);
+		fclose(file);
+		file = nullptr;
+		open_file.clear();
+	}
+	if (discard) {
+		std::error_code code;
+		for (const Segment& segment : segments)
+			std::filesystem::remove(segment.file, code);
+	}
+	segments.clear();
+	buffer.clear();
+	buffer_file.clear();
+}
+
+void Journal::rotate(const JournalBase& base) {
+	if (!isOpen())
+		return;
+	char name[32];
+	snprintf(name, sizeof(name), ".%06u", ++segment_count);
+	std::string segment_file = (std::filesystem::path(directory) / (JOURNAL_PREFIX + session + name + JOURNAL_EXTENSION)).string();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!buffer.empty())
+			queued.push_back({ buffer_file, std::move(buffer) });
+		buffer = encodeHeader(base);
+		buffer_file = segment_file;
+		new_segments.push_back({ segment_file, base });
+		// The new base has to reach the disk before the older segments can go
+		flush_requested = true;
+	}
+	wake.notify_all();
+}
+
+void Journal::sync() {
+	if (!isOpen())
+		return;
+	std::unique_lock<std::mutex> lock(mutex);
+	// The next time the writer takes the buffer, it takes everything recorded until now
+	uint64_t target = flushes_started + 1;
+	flush_requested = true;
+	wake.notify_all();
+	wake.wait(lock, [this, target]() { return flushes_done >= target; });
+}
+
+template<typename Fill>
+void Journal::append(JournalRecordType type, Fill&& fill) {
+	if (!isOpen())
+		return;
+	std::lock_guard<std::mutex> lock(mutex);
+	// Nothing is recorded until there is a base to apply it to
+	if (buffer_file.empty())
+		return;
+
+	size_t start = buffer.size();
+	put<uint8_t>(buffer, (uint8_t)type);
+	put<uint32_t>(buffer, 0);
+	fill(buffer);
+	uint32_t size = (uint32_t)(buffer.size() - start - sizeof(uint8_t) - sizeof(uint32_t));
+	memcpy(&buffer[start + sizeof(uint8_t)], &size, sizeof(size));
+	put<uint32_t>(buffer, checksum(&buffer[start], buffer.size() - start));
+}
+
+void Journal::recordTiles(const TileDelta& delta, bool use_after) {
+	if (delta.empty())
+		return;
+	if (use_after && delta.hasPattern()) {
+		append(JournalRecordType::TILE_PATTERN, [&](std::vector<unsigned char>& out) {
+			put<uint32_t>(out, (uint32_t)delta.runs.size());
+			const unsigned char* runs = reinterpret_cast<const unsigned char*>(delta.runs.data());
+			out.insert(out.end(), runs, runs + delta.runs.size() * sizeof(TileDelta::Run));
+			put<TileDelta::Pattern>(out, delta.pattern);
+		});
+		return;
+	}
+	const std::vector<TileDelta::Span>& spans = (use_after ? delta.after : delta.before);
+	append(JournalRecordType::TILES, [&](std::vector<unsigned char>& out) {
+		put<uint32_t>(out, (uint32_t)delta.runs.size());
+		const unsigned char* runs = reinterpret_cast<const unsigned char*>(delta.runs.data());
+		out.insert(out.end(), runs, runs + delta.runs.size() * sizeof(TileDelta::Run));
+		put<uint32_t>(out, (uint32_t)spans.size());
+		const unsigned char* values = reinterpret_cast<const unsigned char*>(spans.data());
+		out.insert(out.end(), values, values + spans.size() * sizeof(TileDelta::Span));
+	});
+}
+
+void Journal::recordInsertLayer(int index, const std::string& name, bool visible, const TileLayer* content) {
+	append(JournalRecordType::INSERT_LAYER, [&](std::vector<unsigned char>& out) {
+		put<int32_t>(out, index);
+		put<uint8_t>(out, visible);
+		putString(out, name);
+	});
+	if (content != nullptr)
+		recordTiles(layerContent((uint32_t)index, *content), true);
+}
+
+void Journal::recordRemoveLayer(int index) {
+	append(JournalRecordType::REMOVE_LAYER, [&](std::vector<unsigned char>& out) { put<int32_t>(out, index); });
+}
+
+void Journal::recordSwapLayers(int a, int b) {
+	append(JournalRecordType::SWAP_LAYERS, [&](std::vector<unsigned char>& out) {
+		put<int32_t>(out, a);
+		put<int32_t>(out, b);
+	});
+}
+
+void Journal::recordLayerProperties(int index, const std::string& name, bool visible) {
+	append(JournalRecordType::LAYER_PROPERTIES, [&](std::vector<unsigned char>& out) {
+		put<int32_t>(out, index);
+		put<uint8_t>(out, visible);
+		putString(out, name);
+	});
+}
+
+void Journal::recordSetTexture(int id, const std::string& name, const std::string& path) {
+	append(JournalRecordType::SET_TEXTURE, [&](std::vector<unsigned char>& out) {
+		put<int32_t>(out, id);
+		putString(out, name);
+		putString(out, path);
+	});
+}
+
+void Journal::recordRemoveTexture(int id) {
+	append(JournalRecordType::REMOVE_TEXTURE, [&](std::vector<unsigned char>& out) { put<int32_t>(out, id); });
+}
+
+void Journal::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait_for(lock, std::chrono::milliseconds(JOURNAL_FLUSH_INTERVAL_MS), [this]() { return stopping || flush_requested; });
+		flush_requested = false;
+		flushes_started++;
+		std::vector<Pending> pending = std::move(queued);
+		queued.clear();
+		if (!buffer.empty()) {
+			pending.push_back({ buffer_file, std::move(buffer) });
+			buffer.clear();
+		}
+		std::vector<Segment> added = std::move(new_segments);
+		new_segments.clear();
+		bool stop = stopping;
+		lock.unlock();
+
+		write(pending);
+		segments.insert(segments.end(), added.begin(), added.end());
+		deleteObsoleteSegments();
+
+		lock.lock();
+		flushes_done++;
+		wake.notify_all();
+		if (stop)
+			return;
+	}
+}
+
+void Journal::write(std::vector<Pending>& pending) {
+	for (Pending& part : pending) {
+		if (part.file != open_file) {
+			if (file != nullptr) {
+				syncFile(file);
+				fclose(file);
+			}
+			file = fopen(part.file.c_str(), "ab");
+			open_file = part.file;
+		}
+		if (file != nullptr)
+			fwrite(part.bytes.data(), 1, part.bytes.size(), file);
+	}
+	if (file != nullptr && !pending.empty())
+		syncFile(file);
+}
+
+void Journal::deleteObsoleteSegments() {
+	// Autosaves are written after their segment is started, so their base may not exist yet
+	size_t first_needed = 0;
+	std::error_code code;
+	for (size_t i = segments.size(); i-- > 0;) {
+		if (isBaseLoadable(segments[i].base)) {
+			first_needed = i;
+			break;
+		}
+	}
+	for (size_t i = 0; i < first_needed; i++)
+		std::filesystem::remove(segments[i].file, code);
+	segments.erase(segments.begin(), segments.begin() + first_needed);
+}
+
+bool fingerprintBase(JournalBase& base) {
+	std::error_code code;
+	uintmax_t size = std::filesystem::file_size(base.path, code);
+	if (code)
+		return false;
+	auto time = std::filesystem::last_write_time(base.path, code);
+	if (code)
+		return false;
+	base.fingerprinted = true;
+	base.file_size = size;
+	base.file_time = (int64_t)time.time_since_epoch().count();
+	return true;
+}
+
+bool isBaseLoadable(const JournalBase& base) {
+	if (base.kind == JournalBaseKind::NEW_MAP)
+		return true;
+	if (!base.fingerprinted) {
+		std::error_code code;
+		return std::filesystem::exists(base.path, code);
+	}
+	JournalBase current = base;
+	return fingerprintBase(current) && current.file_size == base.file_size && current.file_time == base.file_time;
+}
+
+bool readJournalSegment(const std::string& path, JournalSegment& segment, std::string& error) {
+	std::ifstream in(path, std::ios::binary);
+	std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	segment = JournalSegment();
+	segment.file = path;
+	Reader reader(data.data(), data.size());
+	if (!decodeHeader(reader, data.data(), segment.base)) {
+		error = "Invalid journal header in " + path;
+		return false;
+	}
+
+	while (!reader.atEnd()) {
+		size_t start = reader.position();
+		uint8_t type;
+		uint32_t size, crc;
+		std::vector<unsigned char> payload;
+		if (!reader.get(type) || !reader.get(size) || !reader.getArray(payload, size)) {
+			segment.truncated = true;
+			break;
+		}
+		size_t framed_size = reader.position() - start;
+		JournalRecord record;
+		Reader payload_reader(payload.data(), payload.size());
+		if (!reader.get(crc) || crc != checksum(data.data() + start, framed_size) ||
+			!decodeRecord((JournalRecordType)type, payload_reader, record)) {
+			segment.truncated = true;
+			break;
+		}
+		segment.records.push_back(std::move(record));
+	}
+	return true;
+}
+
+bool findCrashedJournal(
+	const std::string& directory,
+	std::vector<JournalSegment>& chain,
+	std::vector<std::string>& files,
+	std::string& error)
+{
+	std::vector<std::string> found;
+	std::error_code code;
+	for (const auto& entry : std::filesystem::directory_iterator(directory, code)) {
+		std::string filename = entry.path().filename().string();
+		if (filename.starts_with(JOURNAL_PREFIX) && filename.ends_with(JOURNAL_EXTENSION))
+			found.push_back(entry.path().string());
+	}
+	if (found.empty())
+		return false;
+
+	// Session names start with their date, and segments are numbered with a fixed width
+	std::sort(found.begin(), found.end());
+	files = found;
+	auto sessionOf = [](const std::string& path) {
+		std::string filename = std::filesystem::path(path).filename().string();
+		return filename.substr(0, filename.find('.'));
+	};
+	std::string latest = sessionOf(found.back());
+
+	std::vector<JournalSegment> segments;
+	for (const std::string& path : found) {
+		if (sessionOf(path) != latest)
+			continue;
+		JournalSegment segment;
+		std::string segment_error;
+		if (readJournalSegment(path, segment, segment_error))
+			segments.push_back(std::move(segment));
+	}
+
+	for (size_t i = segments.size(); i-- > 0;) {
+		if (isBaseLoadable(segments[i].base)) {
+			chain.assign(std::make_move_iterator(segments.begin() + i), std::make_move_iterator(segments.end()));
+			return true;
+		}
+	}
+	error = "None of the maps the journal applies to can be found";
+	return false;
+}
@@ -0,0 +1,174 @@
+#ifndef TILEMAPEDITOR_JOURNAL_H
+#define TILEMAPEDITOR_JOURNAL_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "History.h"
+#include "TileLayer.h"
+
+// Records are written and synced to disk at most this long after the edit
+constexpr int JOURNAL_FLUSH_INTERVAL_MS{ 1000 };
+constexpr char JOURNAL_MAGIC[4]{ 'T', 'M', 'E', 'J' };
+constexpr uint32_t JOURNAL_VERSION{ 2 };
+
+enum class JournalBaseKind : uint8_t {
+	// Empty map with a single "Layer 0", as made by File > New
+	NEW_MAP,
+	TMX,
+	NATIVE
+};
+
+// State the records of a segment apply to
+struct JournalBase {
+	JournalBaseKind kind{ JournalBaseKind::NEW_MAP };
+	// Absolute path of the map file, empty for NEW_MAP
+	std::string path{};
+	int width{ 1 };
+	int height{ 1 };
+	int tile_size{ 1 };
+	// Palette ids when the base was written, in increasing order. A TMX file
+	// doesn't keep them, opening it numbers its tilesets from 0 in this order.
+	std::vector<int> texture_ids{};
+	// Size and modification time of the file when the base was taken. A map saved over it afterwards
+	// doesn't match anymore, so the records aren't replayed on top of it. Autosaves are never
+	// overwritten and don't exist yet when their segment starts, they have no fingerprint.
+	bool fingerprinted{ false };
+	uint64_t file_size{ 0 };
+	int64_t file_time{ 0 };
+};
+
+// Fills the fingerprint of a TMX or native base from its file, returns false if it can't be read
+bool fingerprintBase(JournalBase& base);
+// The records of a segment can be replayed on its base: a new map, or a file that is still the same
+bool isBaseLoadable(const JournalBase& base);
+
+enum class JournalRecordType : uint8_t {
+	// Cells and the values written to them, kept in tiles.after
+	TILES = 1,
+	// Empty layer, its tiles follow in a TILES record
+	INSERT_LAYER,
+	REMOVE_LAYER,
+	SWAP_LAYERS,
+	LAYER_PROPERTIES,
+	// Texture added to the palette, or replaced
+	SET_TEXTURE,
+	REMOVE_TEXTURE,
+	// Cells written from a pattern, read back as a TILES record with tiles.pattern set
+	TILE_PATTERN
+};
+
+struct JournalRecord {
+	JournalRecordType type{ JournalRecordType::TILES };
+	TileDelta tiles{};
+	// Layer index (first layer for SWAP_LAYERS) or texture id
+	int index{ 0 };
+	// Second layer of SWAP_LAYERS
+	int other{ 0 };
+	bool visible{ true };
+	std::string name{};
+	std::string path{};
+};
+
+struct JournalSegment {
+	std::string file{};
+	JournalBase base{};
+	std::vector<JournalRecord> records{};
+	// The end of the file was torn or corrupted, the records before it are still valid
+	bool truncated{ false };
+};
+
+/*
+* Write-ahead log of the edits made since the last save, autosave or open.
+*
+* The log is a list of segment files, journal-<session>.<n>.tmj. Each one starts
+* with the base it applies to, followed by records framed as
+* { uint8_t type, uint32_t size, payload, uint32_t crc32 }, in host byte order.
+* Records are appended to a memory buffer, and a writer thread writes and syncs
+* it every JOURNAL_FLUSH_INTERVAL_MS, so editing never waits for the disk.
+* Segments are deleted once a newer one has a base that exists on disk,
+* and the whole session is deleted when the editor closes normally.
+*/
+class Journal {
+	std::string directory{};
+	std::string session{};
+	uint32_t segment_count{ 0 };
+	std::thread writer{};
+	std::mutex mutex{};
+	std::condition_variable wake{};
+
+	struct Pending {
+		std::string file;
+		std::vector<unsigned char> bytes;
+	};
+	struct Segment {
+		std::string file;
+		JournalBase base;
+	};
+	// Guarded by mutex
+	std::vector<unsigned char> buffer{};
+	std::string buffer_file{};
+	std::vector<Pending> queued{};
+	std::vector<Segment> new_segments{};
+	bool flush_requested{ false };
+	bool stopping{ false };
+	// Number of times the writer took the buffer, and finished writing what it took
+	uint64_t flushes_started{ 0 };
+	uint64_t flushes_done{ 0 };
+
+	// Writer only
+	FILE* file{ nullptr };
+	std::string open_file{};
+	std::vector<Segment> segments{};
+
+public:
+	Journal() = default;
+	Journal(const Journal&) = delete;
+	Journal& operator=(const Journal&) = delete;
+	~Journal() { close(false); }
+
+	bool isOpen() const { return writer.joinable(); }
+	// Starts a new session in the directory, nothing is written before the first rotate()
+	void open(const std::string& journal_directory);
+	// Flushes, and deletes the files of the session when discard is true
+	void close(bool discard);
+	// Starts a new segment, the following records apply to the given base
+	void rotate(const JournalBase& base);
+	// Blocks until everything recorded so far is on disk
+	void sync();
+
+	void recordTiles(const TileDelta& delta, bool use_after);
+	// Content is written as a TILES record when given
+	void recordInsertLayer(int index, const std::string& name, bool visible, const TileLayer* content = nullptr);
+	void recordRemoveLayer(int index);
+	void recordSwapLayers(int a, int b);
+	void recordLayerProperties(int index, const std::string& name, bool visible);
+	void recordSetTexture(int id, const std::string& name, const std::string& path);
+	void recordRemoveTexture(int id);
+
+private:
+	void run();
+	void write(std::vector<Pending>& pending);
+	void deleteObsoleteSegments();
+	// Frames a record around the payload written by fill(buffer)
+	template<typename Fill>
+	void append(JournalRecordType type, Fill&& fill);
+};
+
+bool readJournalSegment(const std::string& path, JournalSegment& segment, std::string& error);
+
+/*
+* Finds the most recent session that wasn't closed normally, and returns the segments to replay:
+* the latest one whose base can still be loaded, and every segment after it.
+* Files of that session and of older ones are added to files, to be deleted once recovered.
+*/
+bool findCrashedJournal(
+	const std::string& directory,
+	std::vector<JournalSegment>& chain,
+	std::vector<std::string>& files,
+	std::string& error);
+
+#endif
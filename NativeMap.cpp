@@ -0,0 +1,479 @@
+#include "NativeMap.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	struct NativeHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t chunk_size;
+		int32_t width;
+		int32_t height;
+		int32_t tile_size;
+		uint32_t layer_count;
+		uint32_t texture_count;
+		uint32_t reserved;
+		uint64_t tables_offset;
+		uint64_t tables_size;
+		uint64_t tables_capacity;
+		// Everything after it is unused
+		uint64_t file_end;
+		// Region of the previous tables, the next in-place save writes its tables there
+		// so that the current ones stay intact until the header is replaced (0 when none)
+		uint64_t spare_offset;
+		uint64_t spare_capacity;
+	};
+
+	// Offsets are relative to the start of the tables
+	struct NativeLayerRecord {
+		// One uint64_t per chunk: offset of its payload in the file, 0 when empty
+		uint64_t chunk_table;
+		// usage_count records
+		uint64_t usage_table;
+		uint32_t name_offset;
+		uint32_t name_size;
+		uint32_t visible;
+		uint32_t usage_count;
+	};
+
+	struct NativeUsageRecord {
+		int32_t texture_id;
+		uint32_t reserved;
+		// One uint16_t per chunk
+		uint64_t counts;
+	};
+
+	struct NativeTextureRecord {
+		int32_t id;
+		uint32_t name_offset;
+		uint32_t name_size;
+		uint32_t path_offset;
+		uint32_t path_size;
+		uint32_t reserved;
+	};
+
+	uint64_t alignUp(uint64_t value, uint64_t alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// Appends raw values to the tables, keeping them 8-byte aligned
+	struct TableBuilder {
+		std::vector<unsigned char> bytes{};
+
+		uint64_t reserve(size_t size) {
+			uint64_t offset = bytes.size();
+			bytes.resize(alignUp(offset + size, 8), 0);
+			return offset;
+		}
+		template<typename T>
+		void write(uint64_t offset, const T& value) { memcpy(&bytes[offset], &value, sizeof(T)); }
+		void write(uint64_t offset, const void* data, size_t size) { memcpy(&bytes[offset], data, size); }
+	};
+
+	// Bounds-checked reads of the mapped tables
+	struct TableReader {
+		const unsigned char* data;
+		uint64_t size;
+
+		bool contains(uint64_t offset, uint64_t length) const { return offset <= size && length <= size - offset; }
+		template<typename T>
+		bool read(uint64_t offset, T& value) const {
+			if (!contains(offset, sizeof(T)))
+				return false;
+			memcpy(&value, data + offset, sizeof(T));
+			return true;
+		}
+		bool readString(uint32_t offset, uint32_t length, std::string& out) const {
+			if (!contains(offset, length))
+				return false;
+			out.assign((const char*)data + offset, length);
+			return true;
+		}
+	};
+
+	bool samePath(const std::string& a, const std::string& b) {
+		std::error_code code;
+		bool same = std::filesystem::equivalent(a, b, code);
+		return !code && same;
+	}
+
+	// Streams can't be synced, the file is opened again to flush it to the disk
+	bool syncPath(const std::string& path) {
+#ifdef _WIN32
+		int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+		if (fd < 0)
+			return false;
+		bool success = (_commit(fd) == 0);
+		_close(fd);
+#else
+		int fd = open(path.c_str(), O_RDWR);
+		if (fd < 0)
+			return false;
+		bool success = (fsync(fd) == 0);
+		close(fd);
+#endif
+		return success;
+	}
+
+	bool readHeader(const MappedFile& file, NativeHeader& header) {
+		if (file.getSize() < NATIVE_PAGE_SIZE)
+			return false;
+		memcpy(&header, file.getData(), sizeof(header));
+		return memcmp(header.magic, NATIVE_MAGIC, sizeof(NATIVE_MAGIC)) == 0 && header.version == NATIVE_VERSION &&
+			header.chunk_size == CHUNK_SIZE && header.tables_offset <= file.getSize() &&
+			header.tables_size <= file.getSize() - header.tables_offset;
+	}
+
+	std::vector<unsigned char> buildTables(
+		const NativeMapInfo& info,
+		const std::vector<TileLayer>& layers,
+		const std::vector<std::vector<uint64_t>>& chunk_offsets)
+	{
+		TableBuilder tables;
+		std::string strings;
+		auto addString = [&](const std::string& text) {
+			uint32_t offset = (uint32_t)strings.size();
+			strings += text;
+			return offset;
+		};
+
+		uint64_t layer_records = tables.reserve(sizeof(NativeLayerRecord) * layers.size());
+		uint64_t texture_records = tables.reserve(sizeof(NativeTextureRecord) * info.textures.size());
+		std::vector<NativeLayerRecord> records(layers.size());
+		for (size_t layer = 0; layer < layers.size(); layer++) {
+			NativeLayerRecord& record = records[layer];
+			record.chunk_table = tables.reserve(sizeof(uint64_t) * chunk_offsets[layer].size());
+			tables.write(record.chunk_table, chunk_offsets[layer].data(), sizeof(uint64_t) * chunk_offsets[layer].size());
+
+			std::vector<int> used_textures;
+			for (int texture_id = 0; texture_id < MAX_TEXTURES; texture_id++)
+				if (layers[layer].textureUsage(texture_id) > 0)
+					used_textures.push_back(texture_id);
+			record.usage_count = (uint32_t)used_textures.size();
+			record.usage_table = tables.reserve(sizeof(NativeUsageRecord) * used_textures.size());
+			for (size_t i = 0; i < used_textures.size(); i++) {
+				const std::vector<uint16_t>& counts = layers[layer].getTextureChunkCounts(used_textures[i]);
+				NativeUsageRecord usage{ used_textures[i], 0, tables.reserve(sizeof(uint16_t) * counts.size()) };
+				tables.write(usage.counts, counts.data(), sizeof(uint16_t) * counts.size());
+				tables.write(record.usage_table + sizeof(NativeUsageRecord) * i, usage);
+			}
+
+			const std::string& name = (layer < info.layer_names.size() ? info.layer_names[layer] : std::string());
+			record.name_offset = addString(name);
+			record.name_size = (uint32_t)name.size();
+			record.visible = (layer < info.layer_visibles.size() ? info.layer_visibles[layer] : true);
+		}
+		for (size_t i = 0; i < info.textures.size(); i++) {
+			const NativeTexture& texture = info.textures[i];
+			NativeTextureRecord record{ texture.id, addString(texture.name), (uint32_t)texture.name.size(), 0, (uint32_t)texture.path.size(), 0 };
+			record.path_offset = addString(texture.path);
+			tables.write(texture_records + sizeof(NativeTextureRecord) * i, record);
+		}
+
+		// Strings go last, so their offsets are shifted by the size of everything else
+		uint64_t string_base = tables.reserve(strings.size());
+		tables.write(string_base, strings.data(), strings.size());
+		for (size_t layer = 0; layer < layers.size(); layer++) {
+			records[layer].name_offset += (uint32_t)string_base;
+			tables.write(layer_records + sizeof(NativeLayerRecord) * layer, records[layer]);
+		}
+		for (size_t i = 0; i < info.textures.size(); i++) {
+			NativeTextureRecord record;
+			memcpy(&record, &tables.bytes[texture_records + sizeof(NativeTextureRecord) * i], sizeof(record));
+			record.name_offset += (uint32_t)string_base;
+			record.path_offset += (uint32_t)string_base;
+			tables.write(texture_records + sizeof(NativeTextureRecord) * i, record);
+		}
+		return std::move(tables.bytes);
+	}
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+	if (data != nullptr)
+		UnmapViewOfFile(data);
+	if (mapping_handle != nullptr)
+		CloseHandle(mapping_handle);
+	if (file_handle != nullptr && file_handle != INVALID_HANDLE_VALUE)
+		CloseHandle(file_handle);
+#else
+	if (data != nullptr)
+		munmap(const_cast<unsigned char*>(data), size);
+	if (descriptor != -1)
+		close(descriptor);
+#endif
+}
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& path, std::string& error) {
+	auto file = std::make_shared<MappedFile>();
+	file->path = path;
+#ifdef _WIN32
+	// Writes go through regular file I/O while the file is mapped
+	file->file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER size;
+	if (file->file_handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(file->file_handle, &size) || size.QuadPart == 0) {
+		error = "Failed to open " + path;
+		return nullptr;
+	}
+	file->size = (size_t)size.QuadPart;
+	file->mapping_handle = CreateFileMappingA(file->file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (file->mapping_handle != nullptr)
+		file->data = (const unsigned char*)MapViewOfFile(file->mapping_handle, FILE_MAP_READ, 0, 0, 0);
+#else
+	file->descriptor = ::open(path.c_str(), O_RDONLY);
+	struct stat status;
+	if (file->descriptor == -1 || fstat(file->descriptor, &status) != 0 || status.st_size == 0) {
+		error = "Failed to open " + path;
+		return nullptr;
+	}
+	file->size = (size_t)status.st_size;
+	void* mapped = mmap(nullptr, file->size, PROT_READ, MAP_SHARED, file->descriptor, 0);
+	if (mapped != MAP_FAILED)
+		file->data = (const unsigned char*)mapped;
+#endif
+	if (file->data == nullptr) {
+		error = "Failed to map " + path;
+		return nullptr;
+	}
+	return file;
+}
+
+bool openNativeMap(
+	const std::string& path,
+	NativeMapInfo& info,
+	std::vector<TileLayer>& layers,
+	std::shared_ptr<MappedFile>& file,
+	std::string& error)
+{
+	std::shared_ptr<MappedFile> mapped = MappedFile::open(path, error);
+	if (mapped == nullptr)
+		return false;
+	NativeHeader header;
+	if (!readHeader(*mapped, header)) {
+		error = path + " is not a native map, or was saved by another version";
+		return false;
+	}
+	if (header.width <= 0 || header.height <= 0 || header.tile_size <= 0) {
+		error = "Invalid map dimensions";
+		return false;
+	}
+
+	TableReader tables{ mapped->getData() + header.tables_offset, header.tables_size };
+	info = NativeMapInfo();
+	info.width = header.width;
+	info.height = header.height;
+	info.tile_size = header.tile_size;
+
+	for (uint32_t i = 0; i < header.texture_count; i++) {
+		NativeTextureRecord record;
+		NativeTexture texture;
+		if (!tables.read(sizeof(NativeLayerRecord) * header.layer_count + sizeof(NativeTextureRecord) * i, record) ||
+			!tables.readString(record.name_offset, record.name_size, texture.name) ||
+			!tables.readString(record.path_offset, record.path_size, texture.path) ||
+			record.id < 0 || record.id >= MAX_TEXTURES) {
+			error = "Invalid texture table";
+			return false;
+		}
+		texture.id = record.id;
+		// Relative texture paths are relative to the map file
+		std::filesystem::path texture_path(texture.path);
+		if (!texture_path.empty() && texture_path.is_relative())
+			texture.path = (std::filesystem::path(path).parent_path() / texture_path).string();
+		info.textures.push_back(texture);
+	}
+
+	layers.clear();
+	for (uint32_t layer = 0; layer < header.layer_count; layer++) {
+		NativeLayerRecord record;
+		std::string name;
+		if (!tables.read(sizeof(NativeLayerRecord) * layer, record) || !tables.readString(record.name_offset, record.name_size, name)) {
+			error = "Invalid layer table";
+			return false;
+		}
+		TileLayer& tiles = layers.emplace_back(header.width, header.height);
+		size_t chunk_count = (size_t)tiles.getChunksW() * tiles.getChunksH();
+		if (!tables.contains(record.chunk_table, sizeof(uint64_t) * chunk_count)) {
+			error = "Invalid chunk table in layer \"" + name + "\"";
+			return false;
+		}
+
+		std::vector<const PackedTile*> chunk_tiles(chunk_count, nullptr);
+		for (size_t chunk = 0; chunk < chunk_count; chunk++) {
+			uint64_t offset;
+			tables.read(record.chunk_table + sizeof(uint64_t) * chunk, offset);
+			if (offset == 0)
+				continue;
+			if (offset % NATIVE_PAGE_SIZE != 0 || offset > mapped->getSize() || mapped->getSize() - offset < NATIVE_PAGE_SIZE) {
+				error = "Invalid chunk offset in layer \"" + name + "\"";
+				return false;
+			}
+			chunk_tiles[chunk] = reinterpret_cast<const PackedTile*>(mapped->getData() + offset);
+		}
+
+		for (uint32_t i = 0; i < record.usage_count; i++) {
+			NativeUsageRecord usage;
+			if (!tables.read(record.usage_table + sizeof(NativeUsageRecord) * i, usage) ||
+				usage.texture_id < 0 || usage.texture_id >= MAX_TEXTURES ||
+				!tables.contains(usage.counts, sizeof(uint16_t) * chunk_count)) {
+				error = "Invalid texture usage in layer \"" + name + "\"";
+				return false;
+			}
+			std::vector<uint16_t> counts(chunk_count);
+			memcpy(counts.data(), tables.data + usage.counts, sizeof(uint16_t) * chunk_count);
+			// Counts of mapped chunks are checked when the chunk is first written, the others have no tiles
+			for (size_t chunk = 0; chunk < chunk_count; chunk++) {
+				if (counts[chunk] > CHUNK_AREA || (chunk_tiles[chunk] == nullptr && counts[chunk] != 0)) {
+					error = "Invalid texture usage in layer \"" + name + "\"";
+					return false;
+				}
+			}
+			tiles.setTextureChunkCounts(usage.texture_id, std::move(counts));
+		}
+
+		tiles.mapChunks(mapped, std::move(chunk_tiles));
+		info.layer_names.push_back(name);
+		info.layer_visibles.push_back(record.visible != 0);
+	}
+
+	file = mapped;
+	return true;
+}
+
+bool saveNativeMap(
+	const std::string& path,
+	const NativeMapInfo& info,
+	const std::vector<TileLayer>& layers,
+	std::shared_ptr<MappedFile>& file,
+	std::vector<std::vector<const PackedTile*>>& mapped_chunks,
+	std::string& error)
+{
+	NativeHeader previous;
+	bool in_place = (file != nullptr && samePath(file->getPath(), path) && readHeader(*file, previous));
+
+	// A complete file is written next to the target and then renamed over it,
+	// so that mappings of the previous file stay valid
+	std::string write_path = (in_place ? path : path + ".tmp");
+	std::fstream out(write_path, in_place ? (std::ios::in | std::ios::out | std::ios::binary) : (std::ios::out | std::ios::binary | std::ios::trunc));
+	if (!out) {
+		error = "Failed to open " + write_path;
+		return false;
+	}
+
+	uint64_t end = (in_place ? previous.file_end : NATIVE_PAGE_SIZE);
+	std::vector<std::vector<uint64_t>> chunk_offsets(layers.size());
+	for (size_t layer = 0; layer < layers.size(); layer++) {
+		const TileLayer& tiles = layers[layer];
+		bool same_mapping = in_place && tiles.getMappingOwner() == file.get();
+		chunk_offsets[layer].assign((size_t)tiles.getChunksW() * tiles.getChunksH(), 0);
+		for (int chunk_y = 0; chunk_y < tiles.getChunksH(); chunk_y++) for (int chunk_x = 0; chunk_x < tiles.getChunksW(); chunk_x++) {
+			size_t index = (size_t)chunk_y * tiles.getChunksW() + chunk_x;
+			const PackedTile* data = tiles.getChunkTiles(chunk_x, chunk_y);
+			if (data == nullptr)
+				continue;
+
+			const PackedTile* mapped = (same_mapping ? tiles.getMappedTiles(index) : nullptr);
+			uint64_t offset = (mapped != nullptr ? (uint64_t)((const unsigned char*)mapped - file->getData()) : end);
+			if (mapped == nullptr)
+				end += NATIVE_PAGE_SIZE;
+			// Chunks that were only read are already in the file
+			if (mapped == nullptr || tiles.isChunkInMemory(index)) {
+				out.seekp((std::streamoff)offset);
+				out.write((const char*)data, NATIVE_PAGE_SIZE);
+			}
+			chunk_offsets[layer][index] = offset;
+		}
+	}
+
+	std::vector<unsigned char> tables = buildTables(info, layers, chunk_offsets);
+	NativeHeader header{};
+	memcpy(header.magic, NATIVE_MAGIC, sizeof(NATIVE_MAGIC));
+	header.version = NATIVE_VERSION;
+	header.chunk_size = CHUNK_SIZE;
+	header.width = info.width;
+	header.height = info.height;
+	header.tile_size = info.tile_size;
+	header.layer_count = (uint32_t)layers.size();
+	header.texture_count = (uint32_t)info.textures.size();
+	header.tables_size = tables.size();
+	// The tables the current header points to are never overwritten, the header is the only commit point
+	bool spare_fits = in_place && previous.spare_offset >= NATIVE_PAGE_SIZE && tables.size() <= previous.spare_capacity &&
+		previous.spare_offset + previous.spare_capacity <= previous.file_end &&
+		(previous.spare_offset + previous.spare_capacity <= previous.tables_offset ||
+			previous.tables_offset + previous.tables_capacity <= previous.spare_offset);
+	if (spare_fits) {
+		header.tables_offset = previous.spare_offset;
+		header.tables_capacity = previous.spare_capacity;
+	}
+	else {
+		// Some room is left so that the following saves can reuse the region
+		header.tables_offset = end;
+		header.tables_capacity = alignUp(tables.size() + tables.size() / 4, NATIVE_PAGE_SIZE);
+		end += header.tables_capacity;
+	}
+	if (in_place) {
+		// The two regions alternate from one save to the next
+		header.spare_offset = previous.tables_offset;
+		header.spare_capacity = previous.tables_capacity;
+	}
+	header.file_end = std::max<uint64_t>(end, in_place ? previous.file_end : 0);
+
+	out.seekp((std::streamoff)header.tables_offset);
+	out.write((const char*)tables.data(), (std::streamsize)tables.size());
+	// The file has to reach the end of the tables' capacity
+	out.seekp((std::streamoff)header.file_end - 1);
+	out.put(0);
+	// The header goes last, once the chunks and tables it points to are on the disk: until it is written,
+	// the file still opens with its previous tables. Chunk rewrites aren't atomic though, chunks saved
+	// in place were already overwritten, so an interrupted in-place save can open with a mix of old
+	// and new chunk contents.
+	out.flush();
+	if (!out || !syncPath(write_path)) {
+		error = "Failed to write " + write_path;
+		return false;
+	}
+	std::vector<char> header_page(NATIVE_PAGE_SIZE, 0);
+	memcpy(header_page.data(), &header, sizeof(header));
+	out.seekp(0);
+	out.write(header_page.data(), (std::streamsize)header_page.size());
+	out.close();
+	if (!out || !syncPath(write_path)) {
+		error = "Failed to write " + write_path;
+		return false;
+	}
+
+	if (!in_place) {
+		std::error_code code;
+		std::filesystem::rename(write_path, path, code);
+		if (code) {
+			error = "Failed to replace " + path + ": " + code.message();
+			return false;
+		}
+	}
+
+	std::shared_ptr<MappedFile> saved = MappedFile::open(path, error);
+	if (saved == nullptr)
+		return false;
+	mapped_chunks.assign(layers.size(), std::vector<const PackedTile*>());
+	for (size_t layer = 0; layer < layers.size(); layer++) {
+		mapped_chunks[layer].assign(chunk_offsets[layer].size(), nullptr);
+		for (size_t index = 0; index < chunk_offsets[layer].size(); index++)
+			if (chunk_offsets[layer][index] != 0)
+				mapped_chunks[layer][index] = reinterpret_cast<const PackedTile*>(saved->getData() + chunk_offsets[layer][index]);
+	}
+	file = saved;
+	return true;
+}
@@ -0,0 +1,90 @@
+#ifndef TILEMAPEDITOR_NATIVEMAP_H
+#define TILEMAPEDITOR_NATIVEMAP_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "TileLayer.h"
+
+// Chunk payloads are aligned on pages, so that each one is paged in on its own
+constexpr uint64_t NATIVE_PAGE_SIZE{ 4096 };
+constexpr char NATIVE_MAGIC[8]{ 'T', 'M', 'E', 'M', 'A', 'P', '\r', '\n' };
+constexpr uint32_t NATIVE_VERSION{ 1 };
+static_assert(sizeof(PackedTile) * CHUNK_AREA == NATIVE_PAGE_SIZE, "A chunk payload must fill exactly one page");
+
+/*
+* Native map file, in host byte order:
+*   page 0:       header (dimensions, where the tables are)
+*   chunk pages:  CHUNK_AREA packed tiles each, one page per non-empty chunk
+*   tables:       layer records, texture records, per layer the offset of every chunk
+*                 and the per-chunk tile count of every texture it uses, then the strings
+* Opening only reads the header and the tables, chunks are read through the mapping when first accessed.
+* Saving to the mapped file writes back only the chunks changed since, in place when they were already
+* in the file, and appends the new ones. Places left by chunks that became empty are not reused
+* until the map is saved to another file. The tables alternate between two regions, so that
+* the previous ones stay valid until the new header is written.
+*/
+
+// Read-only mapping of a whole file
+class MappedFile {
+	std::string path{};
+	const unsigned char* data{ nullptr };
+	size_t size{ 0 };
+#ifdef _WIN32
+	void* file_handle{ nullptr };
+	void* mapping_handle{ nullptr };
+#else
+	int descriptor{ -1 };
+#endif
+
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	// nullptr, with a message in error, if the file can't be mapped
+	static std::shared_ptr<MappedFile> open(const std::string& path, std::string& error);
+	const std::string& getPath() const { return path; }
+	const unsigned char* getData() const { return data; }
+	size_t getSize() const { return size; }
+};
+
+struct NativeTexture {
+	int id{ 0 };
+	std::string name{};
+	std::string path{};
+};
+
+struct NativeMapInfo {
+	int width{ 1 };
+	int height{ 1 };
+	int tile_size{ 1 };
+	std::vector<std::string> layer_names{};
+	std::vector<bool> layer_visibles{};
+	std::vector<NativeTexture> textures{};
+};
+
+// The layers keep the mapping alive, file is only needed to save back to it
+bool openNativeMap(
+	const std::string& path,
+	NativeMapInfo& info,
+	std::vector<TileLayer>& layers,
+	std::shared_ptr<MappedFile>& file,
+	std::string& error);
+
+/*
+* Saves in place when path is the mapped file, otherwise writes a complete file.
+* file then points to the new mapping, and mapped_chunks to the tiles of each layer in it
+* (to be handed to TileLayer::mapChunks, which releases the in-memory copies).
+*/
+bool saveNativeMap(
+	const std::string& path,
+	const NativeMapInfo& info,
+	const std::vector<TileLayer>& layers,
+	std::shared_ptr<MappedFile>& file,
+	std::vector<std::vector<const PackedTile*>>& mapped_chunks,
+	std::string& error);
+
+#endif
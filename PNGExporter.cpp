@@ -0,0 +1,218 @@
+#include "PNGExporter.h"
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <thread>
+#include <SDL.h>
+#include <SDL_image.h>
+#include <png.h>
+#include "Trace.h"
+
+namespace {
+	/*
+	* Thin wrapper around libpng. Every libpng call is made from a function
+	* without non-trivial locals because errors are reported with longjmp.
+	*/
+	class PNGStream {
+		FILE* file{ nullptr };
+		png_structp png{ nullptr };
+		png_infop png_info{ nullptr };
+
+	public:
+		~PNGStream() {
+			png_destroy_write_struct(&png, &png_info);
+			if (file != nullptr)
+				fclose(file);
+		}
+
+		bool open(const char* path, int width, int height) {
+			file = fopen(path, "wb");
+			if (file == nullptr)
+				return false;
+			png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+			if (png == nullptr)
+				return false;
+			png_info = png_create_info_struct(png);
+			if (png_info == nullptr)
+				return false;
+			if (setjmp(png_jmpbuf(png)))
+				return false;
+
+			png_init_io(png, file);
+			png_set_IHDR(png, png_info, width, height, 8, PNG_COLOR_TYPE_RGBA,
+				PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+			png_write_info(png, png_info);
+			return true;
+		}
+
+		bool writeRow(const unsigned char* row) {
+			if (setjmp(png_jmpbuf(png)))
+				return false;
+			png_write_row(png, row);
+			return true;
+		}
+
+		bool close() {
+			if (setjmp(png_jmpbuf(png)))
+				return false;
+			png_write_end(png, nullptr);
+			bool success = (fclose(file) == 0);
+			file = nullptr;
+			return success;
+		}
+	};
+
+	// Straight alpha "over" operator, src on top of dst
+	inline void blendPixel(unsigned char* dst, const unsigned char* src) {
+		unsigned src_a = src[3];
+		if (src_a == 255) {
+			dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = 255;
+			return;
+		}
+		if (src_a == 0)
+			return;
+
+		unsigned
+			dst_a = dst[3] * (255 - src_a) / 255,
+			out_a = src_a + dst_a;
+		for (int c = 0; c < 3; c++)
+			dst[c] = (unsigned char)((src[c] * src_a + dst[c] * dst_a) / out_a);
+		dst[3] = (unsigned char)out_a;
+	}
+
+	// Composites tile row tile_y of every layer
+	std::vector<unsigned char> compositeBand(
+		int tile_y,
+		const std::vector<const TileLayer*>& layers,
+		const std::vector<const TilesetImage*>& images,
+		int tile_size)
+	{
+		TRACE_SCOPE("Composite band");
+		const TileLayer& first = *layers.front();
+		size_t row_bytes = (size_t)first.getWidth() * tile_size * 4;
+		std::vector<unsigned char> band(row_bytes * tile_size, 0);
+
+		int chunk_y = tile_y / CHUNK_SIZE;
+		for (const TileLayer* layer : layers) {
+			for (int chunk_x = 0; chunk_x < layer->getChunksW(); chunk_x++) {
+				const PackedTile* chunk = layer->getChunkTiles(chunk_x, chunk_y);
+				if (chunk == nullptr)
+					continue;
+
+				int columns = std::min(CHUNK_SIZE, layer->getWidth() - chunk_x * CHUNK_SIZE);
+				const PackedTile* row = &chunk[(size_t)(tile_y % CHUNK_SIZE) * CHUNK_SIZE];
+				for (int column = 0; column < columns; column++) {
+					if (row[column] == EMPTY_TILE)
+						continue;
+					Tile tile = unpackTile(row[column]);
+					const TilesetImage* image = images[tile.texture_id];
+					int
+						src_x = tile.id_on_texture.x * tile_size,
+						src_y = tile.id_on_texture.y * tile_size;
+					if (image == nullptr || src_x + tile_size > image->width || src_y + tile_size > image->height)
+						continue;
+
+					size_t dst_x = (size_t)(chunk_x * CHUNK_SIZE + column) * tile_size;
+					for (int py = 0; py < tile_size; py++) {
+						const unsigned char* src = &image->pixels[((size_t)(src_y + py) * image->width + src_x) * 4];
+						unsigned char* dst = &band[py * row_bytes + dst_x * 4];
+						for (int px = 0; px < tile_size; px++)
+							blendPixel(dst + px * 4, src + px * 4);
+					}
+				}
+			}
+		}
+		return band;
+	}
+}
+
+bool loadTilesetImages(const std::map<int, std::string>& paths, std::map<int, TilesetImage>& images, std::string& error) {
+	for (const auto& [id, path] : paths) {
+		SDL_Surface* loaded = IMG_Load(path.c_str());
+		if (loaded == nullptr) {
+			error = "Failed to load " + path + ": " + IMG_GetError();
+			return false;
+		}
+		SDL_Surface* converted = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+		SDL_FreeSurface(loaded);
+		if (converted == nullptr) {
+			error = "Failed to convert " + path + ": " + SDL_GetError();
+			return false;
+		}
+
+		TilesetImage& image = images[id];
+		image.width = converted->w;
+		image.height = converted->h;
+		image.pixels.resize((size_t)image.width * image.height * 4);
+		SDL_LockSurface(converted);
+		for (int y = 0; y < image.height; y++) {
+			const unsigned char* src = (const unsigned char*)converted->pixels + (size_t)y * converted->pitch;
+			std::copy(src, src + (size_t)image.width * 4, &image.pixels[(size_t)y * image.width * 4]);
+		}
+		SDL_UnlockSurface(converted);
+		SDL_FreeSurface(converted);
+	}
+	return true;
+}
+
+bool exportPNG(
+	const std::string& path,
+	const std::vector<const TileLayer*>& layers,
+	const std::map<int, TilesetImage>& tilesets,
+	int tile_size,
+	std::string& error,
+	unsigned threads)
+{
+	if (layers.empty()) {
+		error = "No visible layer to export";
+		return false;
+	}
+
+	// Indexed by texture id for the hot loop
+	std::vector<const TilesetImage*> images(MAX_TEXTURES, nullptr);
+	for (const auto& [id, image] : tilesets)
+		if (0 <= id && id < MAX_TEXTURES)
+			images[id] = &image;
+
+	int
+		tiles_h = layers.front()->getHeight(),
+		width = layers.front()->getWidth() * tile_size,
+		height = tiles_h * tile_size;
+
+	PNGStream png;
+	if (!png.open(path.c_str(), width, height)) {
+		error = "Failed to open " + path;
+		return false;
+	}
+
+	// Bands are composited ahead on worker threads while the previous ones are being encoded,
+	// a single thread composites each band when it is needed
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	auto policy = (threads == 1 ? std::launch::deferred : std::launch::async);
+	size_t max_in_flight = PNG_BANDS_PER_THREAD * threads;
+	std::deque<std::future<std::vector<unsigned char>>> pending;
+	int next_band = 0;
+	size_t row_bytes = (size_t)width * 4;
+	for (int band = 0; band < tiles_h; band++) {
+		while (next_band < tiles_h && pending.size() < max_in_flight) {
+			pending.push_back(std::async(policy, compositeBand, next_band, std::cref(layers), std::cref(images), tile_size));
+			next_band++;
+		}
+
+		std::vector<unsigned char> pixels = pending.front().get();
+		pending.pop_front();
+		for (int row = 0; row < tile_size; row++) {
+			if (!png.writeRow(&pixels[row * row_bytes])) {
+				error = "Failed to encode " + path;
+				return false;
+			}
+		}
+	}
+
+	if (!png.close()) {
+		error = "Failed to write " + path;
+		return false;
+	}
+	return true;
+}
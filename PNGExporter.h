@@ -0,0 +1,36 @@
+#ifndef TILEMAPEDITOR_PNGEXPORTER_H
+#define TILEMAPEDITOR_PNGEXPORTER_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "TileLayer.h"
+
+// Bands composited ahead of the one being written, per worker thread
+constexpr size_t PNG_BANDS_PER_THREAD{ 2 };
+
+// Decoded tileset, 4 bytes per pixel in R, G, B, A order
+struct TilesetImage {
+	int width{ 0 };
+	int height{ 0 };
+	std::vector<unsigned char> pixels{};
+};
+
+// Decodes the images with SDL_image only, no renderer is needed
+bool loadTilesetImages(const std::map<int, std::string>& paths, std::map<int, TilesetImage>& images, std::string& error);
+
+/*
+* Composites the layers (first one at the bottom) on the CPU and writes them to a PNG file.
+* The image is produced one band of tile_size rows at a time: bands are composited
+* in parallel and written in order, so only a few bands are held in memory.
+* Up to threads bands are composited at once, 0 means one per core.
+*/
+bool exportPNG(
+	const std::string& path,
+	const std::vector<const TileLayer*>& layers,
+	const std::map<int, TilesetImage>& tilesets,
+	int tile_size,
+	std::string& error,
+	unsigned threads = 0);
+
+#endif
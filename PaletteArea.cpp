@@ -1,4 +1,5 @@
 #include "PaletteArea.h"
+#include "Profiler.h"
 
 void PaletteArea::precalculateEssentials() {
 	// Precalculate some info
@@ -84,9 +85,10 @@ void PaletteArea::processTexture(Texture& texture, bool replace_mode) {
 		SDL_QueryTexture(textures[current_texture].texture, nullptr, nullptr, &cur_texture_w, &cur_texture_h);
 		SDL_QueryTexture(texture.texture, nullptr, nullptr, &new_texture_w, &new_texture_h);
 
-		if (cur_texture_w == new_texture_h && cur_texture_h == new_texture_h) {
-			SDL_DestroyTexture(textures[current_texture].texture);
+		if (cur_texture_w == new_texture_w && cur_texture_h == new_texture_h) {
+			Texture old_texture = textures[current_texture];
 			textures[current_texture] = texture;
+			editOnReplaceTexture(current_texture, old_texture, new_texture_w / tile_pixel_size - 1, new_texture_h / tile_pixel_size - 1);
 		}
 		else {
 			replace_warning = true;
@@ -98,6 +100,7 @@ void PaletteArea::processTexture(Texture& texture, bool replace_mode) {
 		int texture_id = getAvailableID();
 		if (texture_id != -1) {
 			addTexture(texture_id, texture);
+			editOnAddTexture(texture_id);
 		}
 		else {
 			std::cout << "No texture slot available!" << std::endl;
@@ -145,7 +148,10 @@ bool PaletteArea::askDeleteTexture(int view_w, int view_h) {
 		ImGui::NewLine();
 		std::string message = "Do you really want to delete the texture? (" + textures[delete_texture_id].name + ")";
 		ImGui::Text(message.c_str());
-		ImGui::Text("All tiles using this texture will also be deleted.");
+		if (textureUsage)
+			ImGui::Text("All tiles using this texture (%zu) will also be deleted.", textureUsage(delete_texture_id));
+		else
+			ImGui::Text("All tiles using this texture will also be deleted.");
 		ImGui::Separator();
 		if (ImGui::Button("Yes")) {
 			deleting_texture = false;
@@ -164,9 +170,18 @@ bool PaletteArea::askDeleteTexture(int view_w, int view_h) {
 }
 
 void PaletteArea::deleteTexture() {
-	editOnCloseTexture(delete_texture_id);
-	SDL_DestroyTexture(textures[delete_texture_id].texture);
-	textures.erase(delete_texture_id);
+	editOnCloseTexture(delete_texture_id, takeTexture(delete_texture_id));
+}
+
+Texture PaletteArea::takeTexture(int id) {
+	Texture texture = textures.at(id);
+	textures.erase(id);
+	initialize_selection();
+	return texture;
+}
+
+void PaletteArea::swapTexture(int id, Texture& texture) {
+	std::swap(textures.at(id), texture);
 	initialize_selection();
 }
 
@@ -183,15 +198,22 @@ void PaletteArea::askReplaceTexture() {
 		if (ImGui::Button("Yes")) {
 			int new_texture_w, new_texture_h;
 			SDL_QueryTexture(replace_new_texture.texture, nullptr, nullptr, &new_texture_w, &new_texture_h);
-			editOnReplaceRemoveTiles(replace_target_id, new_texture_w / tile_pixel_size, new_texture_h / tile_pixel_size);
-			SDL_DestroyTexture(textures[replace_target_id].texture);
+			Texture old_texture = textures[replace_target_id];
 			textures[replace_target_id] = replace_new_texture;
+			replace_new_texture = Texture();
+			editOnReplaceTexture(replace_target_id, old_texture, new_texture_w / tile_pixel_size - 1, new_texture_h / tile_pixel_size - 1);
 			replace_warning = false;
 			initialize_selection();
 		}
 		if (ImGui::Button("No"))
 			replace_warning = false;
 
+		// The new texture was refused (or the window closed)
+		if (!replace_warning && replace_new_texture.texture != nullptr) {
+			SDL_DestroyTexture(replace_new_texture.texture);
+			replace_new_texture = Texture();
+		}
+
 		ImGui::NewLine();
 		ImGui::End();
 	}
@@ -234,34 +256,21 @@ void PaletteArea::drawSelection(SDL_Color color, SDL_Renderer* renderer) {
 	SDL_RenderDrawLine(renderer, topleft_x + dim_x, topleft_y, topleft_x + dim_x, topleft_y + dim_y);
 }
 
-void PaletteArea::drawCurrent(SDL_Renderer* renderer, SDL_Texture* texture, int texture_id) {
+void PaletteArea::drawCurrent(SDL_Renderer* renderer, SDL_Texture* texture, int texture_id, bool redraw) {
 	precalculateEssentials();
+	if (!redraw)
+		return;
 	int
 		on_screen_w = texture_width * view_scale,
 		on_screen_h = texture_height * view_scale;
 
 	SDL_Rect dst_rect{ on_screen_origin.x, on_screen_origin.y, on_screen_w, on_screen_h };
 	SDL_RenderCopy(renderer, cur_texture_ptr, nullptr, &dst_rect);
+	PROFILE_COUNT(ProfileCounter::DRAW_CALLS, 1);
 
-	SDL_SetRenderDrawColor(renderer, line_color.r, line_color.g, line_color.b, line_color.a);
-	// Vertical lines
-	for (int i = 0; i < texture_tile_w + 1; i++) {
-		int
-			x1 = i * on_screen_tile_size + on_screen_origin.x,
-			y1 = on_screen_origin.y,
-			x2 = x1,
-			y2 = y1 + texture_tile_h * on_screen_tile_size;
-		SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-	}
-	// Horizontal lines
-	for (int i = 0; i < texture_tile_h + 1; i++) {
-		int
-			x1 = on_screen_origin.x,
-			y1 = i * on_screen_tile_size + on_screen_origin.y,
-			x2 = x1 + texture_tile_w * on_screen_tile_size,
-			y2 = y1;
-		SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-	}
+	int view_w = 1, view_h = 1;
+	SDL_QueryTexture(texture, nullptr, nullptr, &view_w, &view_h);
+	grid.draw(renderer, line_color, on_screen_origin, on_screen_tile_size, texture_tile_w, texture_tile_h, view_w, view_h);
 
 	// Focused tile
 	drawFocused(highlight_line_color, renderer);
@@ -271,9 +280,11 @@ void PaletteArea::drawCurrent(SDL_Renderer* renderer, SDL_Texture* texture, int
 	}
 }
 
-void PaletteArea::drawToTexture(SDL_Renderer* renderer, SDL_Texture* texture,int view_w, int view_h) {
-	SDL_SetRenderDrawColor(renderer, clear_color.r, clear_color.g, clear_color.b, clear_color.a);
-	SDL_RenderClear(renderer);
+void PaletteArea::drawToTexture(SDL_Renderer* renderer, SDL_Texture* texture, int view_w, int view_h, bool redraw) {
+	if (redraw) {
+		SDL_SetRenderDrawColor(renderer, clear_color.r, clear_color.g, clear_color.b, clear_color.a);
+		SDL_RenderClear(renderer);
+	}
 
 	/* TAB BAR */
 	ImGuiTabBarFlags tb_flags = ImGuiTabBarFlags_NoCloseWithMiddleMouseButton;
@@ -282,9 +293,11 @@ void PaletteArea::drawToTexture(SDL_Renderer* renderer, SDL_Texture* texture,int
 			bool texture_open{ true };
 			if (ImGui::BeginTabItem(texture_obj.second.name.c_str(), &texture_open)) {
 				current_texture = texture_obj.first;
-				drawCurrent(renderer, texture, current_texture);
+				drawCurrent(renderer, texture, current_texture, redraw);
 				ImGui::EndTabItem();
 			}
+			if (textureUsage && ImGui::IsItemHovered())
+				ImGui::SetTooltip("Used by %zu tiles", textureUsage(texture_obj.first));
 
 			if (!texture_open && !replace_warning) {
 				delete_texture_id = texture_obj.first;
@@ -321,12 +334,6 @@ std::map<int, TextureData> PaletteArea::saveTextureToTMX(tinyxml2::XMLDocument&
 	std::map<int, TextureData> out;
 	int current_first_tile_id = 1;
 	for (auto texture : textures) {
-		tinyxml2::XMLElement* tileset = doc.NewElement("tileset");
-		tileset->SetAttribute("firstgid", current_first_tile_id);
-		tileset->SetAttribute("name", texture.second.name.c_str());
-		tileset->SetAttribute("tilewidth", tile_pixel_size);
-		tileset->SetAttribute("tileheight", tile_pixel_size);
-		
 		int texture_w_px, texture_h_px;
 		SDL_QueryTexture(texture.second.texture, nullptr, nullptr, &texture_w_px, &texture_h_px);
 		int
@@ -334,24 +341,9 @@ std::map<int, TextureData> PaletteArea::saveTextureToTMX(tinyxml2::XMLDocument&
 			tile_h = texture_h_px / tile_pixel_size;
 		int tile_count = tile_w * tile_h;
 
-		tileset->SetAttribute("tilecount", tile_count);
-		tileset->SetAttribute("columns", tile_w);
-		tileset->SetText("\n");
-
-		tinyxml2::XMLElement* image = doc.NewElement("image");
-		image->SetAttribute("source", texture.second.path.c_str());
-		image->SetAttribute("width", texture_w_px);
-		image->SetAttribute("height", texture_h_px);
-		tileset->InsertEndChild(image);
-
-		map_elm_ptr->InsertEndChild(tileset);
-
-		out[texture.first] = 
-		{
-			.first_tile_id = current_first_tile_id,
-			.texture_tile_width = tile_w,
-			.texture_tile_height = tile_h 
-		};
+		out[texture.first] = addTMXTileset(
+			doc, map_elm_ptr, current_first_tile_id, texture.second.name, tile_pixel_size,
+			tile_w, tile_count, texture.second.path, texture_w_px, texture_h_px);
 		current_first_tile_id += tile_count;
 	}
 
@@ -360,12 +352,15 @@ std::map<int, TextureData> PaletteArea::saveTextureToTMX(tinyxml2::XMLDocument&
 
 SDL_Texture* draw_palette_area_texture(
 	SDL_Renderer* renderer,
+	RenderTarget& target,
 	Uint32 format,
 	int window_w,
 	int window_h,
 	PaletteArea& palette_area,
-	int& focusflag)
+	int& focusflag,
+	bool redraw)
 {
+	PROFILE_SCOPE("Palette area");
 	/* PREPARATION */
 	ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0, 0));
 	Uint32 window_flags = ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse |
@@ -401,15 +396,21 @@ SDL_Texture* draw_palette_area_texture(
 		ImGui::EndMenuBar();
 	}
 
-	SDL_Texture* texture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_TARGET, (int)size.x, (int)size.y);
+	SDL_Texture* previous = target.get();
+	SDL_Texture* texture = target.acquire(renderer, format, (int)size.x, (int)size.y);
 	if (!texture) {
-		std::cerr << "Failed to create edit texture" << std::endl;
+		std::cerr << "Failed to create palette texture" << std::endl;
+		ImGui::End();
+		ImGui::PopStyleVar();
 		return nullptr;
 	}
+	// A freshly created target has undefined content
+	redraw = redraw || (texture != previous);
 
 	/* ACTUAL RENDERING */
-	SDL_SetRenderTarget(renderer, texture);
-	palette_area.drawToTexture(renderer, texture, window_w * PALETTE_WIDTH, window_h);
+	if (redraw)
+		SDL_SetRenderTarget(renderer, texture);
+	palette_area.drawToTexture(renderer, texture, window_w * PALETTE_WIDTH, window_h, redraw);
 
 	ImGui::Image((void*)texture, ImVec2(size.x, size.y));
 
@@ -15,6 +15,8 @@
 #include "chomusuke/common.h"
 #include "useful.h"
 #include "tinyxml2.h"
+#include "TMX.h"
+#include "Rendering.h"
 
 
 struct Camera {
@@ -22,14 +24,8 @@ struct Camera {
 	float view_scale{ 1.0f };
 };
 
-struct TextureData {
-	int first_tile_id;
-	int texture_tile_width;
-	int texture_tile_height;
-};
-
 class PaletteArea {
-	const int max_texture{ 100 };
+	const int max_texture{ MAX_TEXTURES };
 	int tile_pixel_size{ 16 };
 	int current_texture{ -1 };
 	std::map<int, Camera> cameras{};
@@ -48,6 +44,7 @@ class PaletteArea {
 	int texture_tile_h{ 1 };
 	float view_scale{ DEFAULT_VIEW_SCALE };
 	cho::Vector2f camera_pos{DEFAULT_CAM_POS};
+	GridRenderer grid{};
 
 	bool deleting_texture{ false };
 	int delete_texture_id{ -1 };
@@ -61,16 +58,23 @@ public:
 	SDL_Color highlight_line_color{ 240, 240, 240, 255 };
 	SDL_Color selected_color{ 190, 190, 190, 255 };
 	SDL_Color clear_color{ 0, 0, 0, 255 };
-	std::function<void(int)> editOnCloseTexture;
-	std::function<void(int, int, int)> editOnReplaceRemoveTiles;
+	// The texture was removed from the palette, the callee owns it from now on
+	std::function<void(int, Texture)> editOnCloseTexture;
+	// A texture was loaded into a free slot
+	std::function<void(int)> editOnAddTexture;
+	// The texture was replaced, the callee owns the old one. Tiles beyond (max_x, max_y) don't exist anymore
+	std::function<void(int, Texture, int, int)> editOnReplaceTexture;
+	// Number of tiles placed with the texture
+	std::function<size_t(int)> textureUsage;
 
 	PaletteArea() = default;
 	PaletteArea(int tile_pixel_size_) :
 		tile_pixel_size{ tile_pixel_size_ }
 	{}
 
-	void drawCurrent(SDL_Renderer* renderer, SDL_Texture* texture, int texture_id);
-	void drawToTexture(SDL_Renderer* renderer, SDL_Texture* texture, int view_w, int view_h);
+	// When redraw is false, only the ImGui widgets are updated and the target keeps its previous content
+	void drawCurrent(SDL_Renderer* renderer, SDL_Texture* texture, int texture_id, bool redraw = true);
+	void drawToTexture(SDL_Renderer* renderer, SDL_Texture* texture, int view_w, int view_h, bool redraw = true);
 	void drawFocused(SDL_Color color, SDL_Renderer* renderer);
 	void drawSelection(SDL_Color color, SDL_Renderer* renderer);
 	int getAvailableID();
@@ -83,6 +87,10 @@ public:
 	void onDrag();
 	bool isValidFocus();
 	void addTexture(int id, Texture texture) { textures[id] = texture; }
+	// Removes a texture without destroying it
+	Texture takeTexture(int id);
+	// Exchanges the texture in slot id with the given one
+	void swapTexture(int id, Texture& texture);
 	void deleteTexture();
 	void precalculateEssentials();
 	void destroy();
@@ -109,11 +117,13 @@ private:
 
 SDL_Texture* draw_palette_area_texture(
 	SDL_Renderer* renderer,
+	RenderTarget& target,
 	Uint32 format,
 	int window_w,
 	int window_h,
 	PaletteArea& palette_area,
-	int& focusflag);
+	int& focusflag,
+	bool redraw = true);
 
 
 #endif
\ No newline at end of file
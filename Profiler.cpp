@@ -0,0 +1,91 @@
+#include "Profiler.h"
+
+#ifdef TILEMAPEDITOR_PROFILE
+
+#include <algorithm>
+#include <cstdio>
+#include <imgui.h>
+
+FrameProfiler& FrameProfiler::get() {
+	static FrameProfiler profiler;
+	return profiler;
+}
+
+void FrameProfiler::beginFrame() {
+	Clock::time_point now = Clock::now();
+	if (started) {
+		std::chrono::duration<double, std::milli> elapsed = now - frame_start;
+		frame_history[cursor] = (float)elapsed.count();
+		for (Section& section : sections) {
+			section.history[cursor] = (float)section.current_ms;
+			section.current_ms = 0;
+		}
+		for (size_t i = 0; i < counters.size(); i++) {
+			counter_history[i][cursor] = (float)counters[i];
+			counters[i] = 0;
+		}
+		cursor = (cursor + 1) % PROFILER_HISTORY;
+		filled = std::min(filled + 1, PROFILER_HISTORY);
+	}
+	frame_start = now;
+	started = true;
+}
+
+int FrameProfiler::section(const char* name) {
+	for (size_t i = 0; i < sections.size(); i++)
+		if (sections[i].name == name)
+			return (int)i;
+	sections.push_back(Section{ name });
+	return (int)sections.size() - 1;
+}
+
+float FrameProfiler::percentile(const Samples& samples, float p) const {
+	if (filled == 0)
+		return 0;
+	std::vector<float> sorted(samples.begin(), samples.begin() + filled);
+	size_t rank = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+	std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+	return sorted[rank];
+}
+
+void FrameProfiler::plot(const char* label, const Samples& samples, const char* unit) {
+	// The oldest frame is at cursor once the ring buffer is full
+	int offset = (filled == PROFILER_HISTORY ? cursor : 0);
+	float p50 = percentile(samples, 0.5f), p99 = percentile(samples, 0.99f);
+	char overlay[64];
+	snprintf(overlay, sizeof(overlay), "p50 %.2f%s  p99 %.2f%s", p50, unit, p99, unit);
+	ImGui::PlotLines(label, samples.data(), filled, offset, overlay, 0.0f, std::max(p99 * 1.5f, 1.0f), ImVec2(0, 50));
+}
+
+void FrameProfiler::drawOverlay(bool* open) {
+	ImGui::SetNextWindowSize(ImVec2(420, 0), ImGuiCond_Once);
+	if (!ImGui::Begin("Profiler", open)) {
+		ImGui::End();
+		return;
+	}
+
+	plot("Frame (ms)", frame_history, "ms");
+	plot("Draw calls", counter_history[(size_t)ProfileCounter::DRAW_CALLS], "");
+	plot("Tiles rendered", counter_history[(size_t)ProfileCounter::TILES_RENDERED], "");
+
+	if (ImGui::BeginTable("Sections", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+		ImGui::TableSetupColumn("Section");
+		ImGui::TableSetupColumn("Last (ms)");
+		ImGui::TableSetupColumn("p50 (ms)");
+		ImGui::TableSetupColumn("p99 (ms)");
+		ImGui::TableHeadersRow();
+		int last = (cursor + PROFILER_HISTORY - 1) % PROFILER_HISTORY;
+		for (const Section& section : sections) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn(); ImGui::TextUnformatted(section.name);
+			ImGui::TableNextColumn(); ImGui::Text("%.3f", section.history[last]);
+			ImGui::TableNextColumn(); ImGui::Text("%.3f", percentile(section.history, 0.5f));
+			ImGui::TableNextColumn(); ImGui::Text("%.3f", percentile(section.history, 0.99f));
+		}
+		ImGui::EndTable();
+	}
+	ImGui::TextWrapped("Time outside of the sections is spent presenting (including vsync) and waiting for events.");
+	ImGui::End();
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef TILEMAPEDITOR_PROFILER_H
+#define TILEMAPEDITOR_PROFILER_H
+
+/*
+* Frame profiler, only compiled when TILEMAPEDITOR_PROFILE is defined.
+* Without it, every macro below expands to nothing.
+*
+*   PROFILE_FRAME();                 // once per frame, closes the previous one
+*   PROFILE_SCOPE("Edit area");      // times the enclosing scope
+*   PROFILE_COUNT(ProfileCounter::DRAW_CALLS, 1);
+*/
+
+#ifdef TILEMAPEDITOR_PROFILE
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Frames kept for the graphs and the percentiles
+constexpr int PROFILER_HISTORY{ 240 };
+
+enum class ProfileCounter {
+	DRAW_CALLS,
+	TILES_RENDERED,
+	COUNT
+};
+
+class FrameProfiler {
+	using Clock = std::chrono::steady_clock;
+	using Samples = std::array<float, PROFILER_HISTORY>;
+
+	struct Section {
+		const char* name;
+		// Time spent in the section during the current frame
+		double current_ms{ 0 };
+		Samples history{};
+	};
+
+	std::vector<Section> sections{};
+	Samples frame_history{};
+	std::array<uint64_t, (size_t)ProfileCounter::COUNT> counters{};
+	std::array<Samples, (size_t)ProfileCounter::COUNT> counter_history{};
+	// Next slot of the ring buffers, and how many of them hold a frame
+	int cursor{ 0 };
+	int filled{ 0 };
+	Clock::time_point frame_start{};
+	bool started{ false };
+
+public:
+	static FrameProfiler& get();
+
+	void beginFrame();
+	// Sections are identified by the address of their name, which should be a string literal
+	int section(const char* name);
+	void addTime(int section, double ms) { sections[section].current_ms += ms; }
+	void count(ProfileCounter counter, uint64_t amount) { counters[(size_t)counter] += amount; }
+	void drawOverlay(bool* open);
+
+private:
+	void plot(const char* label, const Samples& samples, const char* unit);
+	// p in [0, 1], over the recorded frames
+	float percentile(const Samples& samples, float p) const;
+};
+
+class ScopedTimer {
+	int section;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	ScopedTimer(int section_) : section(section_), start(std::chrono::steady_clock::now()) {}
+	~ScopedTimer() {
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		FrameProfiler::get().addTime(section, elapsed.count());
+	}
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) \
+	static const int PROFILE_CONCAT(profile_section_, __LINE__) = FrameProfiler::get().section(name); \
+	ScopedTimer PROFILE_CONCAT(profile_timer_, __LINE__)(PROFILE_CONCAT(profile_section_, __LINE__))
+#define PROFILE_COUNT(counter, amount) FrameProfiler::get().count(counter, amount)
+#define PROFILE_FRAME() FrameProfiler::get().beginFrame()
+
+#else
+
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_COUNT(counter, amount) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,130 @@
+#include "Rendering.h"
+#include <algorithm>
+#include <cmath>
+#include "chomusuke/math.h"
+#include "Profiler.h"
+#include "Trace.h"
+
+void TileBatch::begin(SDL_Texture* texture_) {
+	texture = texture_;
+	vertices.clear();
+
+	int texture_w = 1, texture_h = 1;
+	if (texture != nullptr)
+		SDL_QueryTexture(texture, nullptr, nullptr, &texture_w, &texture_h);
+	inv_texture_w = 1.0f / texture_w;
+	inv_texture_h = 1.0f / texture_h;
+}
+
+void TileBatch::addQuad(const SDL_FRect& dst, const SDL_Rect& src) {
+	const SDL_Color white{ 255, 255, 255, 255 };
+	float
+		u1 = src.x * inv_texture_w,
+		v1 = src.y * inv_texture_h,
+		u2 = (src.x + src.w) * inv_texture_w,
+		v2 = (src.y + src.h) * inv_texture_h;
+
+	vertices.push_back({ { dst.x, dst.y }, white, { u1, v1 } });
+	vertices.push_back({ { dst.x + dst.w, dst.y }, white, { u2, v1 } });
+	vertices.push_back({ { dst.x + dst.w, dst.y + dst.h }, white, { u2, v2 } });
+	vertices.push_back({ { dst.x, dst.y + dst.h }, white, { u1, v2 } });
+}
+
+void TileBatch::submit(SDL_Renderer* renderer) {
+	if (vertices.empty() || texture == nullptr)
+		return;
+
+	// The index pattern never changes, so it is only extended when the batch grows
+	size_t quads = quadCount();
+	for (size_t quad = indices.size() / 6; quad < quads; quad++) {
+		int first = (int)quad * 4;
+		indices.insert(indices.end(), { first, first + 1, first + 2, first + 2, first + 3, first });
+	}
+
+	SDL_RenderGeometry(renderer, texture, vertices.data(), (int)vertices.size(), indices.data(), (int)quads * 6);
+	PROFILE_COUNT(ProfileCounter::DRAW_CALLS, 1);
+	PROFILE_COUNT(ProfileCounter::TILES_RENDERED, quads);
+	TRACE_COUNT(TraceCounter::TILES_DRAWN, quads);
+	TRACE_COUNT(TraceCounter::TEXTURES_BOUND, 1);
+	vertices.clear();
+}
+
+SDL_Texture* RenderTarget::acquire(SDL_Renderer* renderer, Uint32 format_, int width_, int height_) {
+	if (texture != nullptr && format == format_ && width == width_ && height == height_)
+		return texture;
+
+	destroy();
+	texture = SDL_CreateTexture(renderer, format_, SDL_TEXTUREACCESS_TARGET, width_, height_);
+	if (texture != nullptr) {
+		format = format_;
+		width = width_;
+		height = height_;
+	}
+	return texture;
+}
+
+void RenderTarget::destroy() {
+	if (texture != nullptr)
+		SDL_DestroyTexture(texture);
+	texture = nullptr;
+	width = 0;
+	height = 0;
+}
+
+void GridRenderer::draw(
+	SDL_Renderer* renderer,
+	SDL_Color color,
+	cho::Vector2f origin,
+	float cell_size,
+	int cols,
+	int rows,
+	int view_w,
+	int view_h)
+{
+	if (cell_size <= 0 || cols <= 0 || rows <= 0)
+		return;
+
+	// Lines at multiples of step * 2 are major lines, the other multiples of step fade out as they get closer
+	int step = 1;
+	while (cell_size * step < MIN_GRID_SPACING && step < std::max(cols, rows))
+		step *= 2;
+	float minor_alpha = std::clamp((cell_size * step - MIN_GRID_SPACING) / MIN_GRID_SPACING, 0.0f, 1.0f);
+
+	major_lines.clear();
+	minor_lines.clear();
+
+	int
+		grid_x1 = std::max(0, (int)origin.x),
+		grid_y1 = std::max(0, (int)origin.y),
+		grid_x2 = std::min(view_w, (int)(origin.x + cols * cell_size)),
+		grid_y2 = std::min(view_h, (int)(origin.y + rows * cell_size));
+	if (grid_x1 > grid_x2 || grid_y1 > grid_y2)
+		return;
+
+	// Vertical lines
+	int
+		first_col = std::max(0, (int)std::ceil(-origin.x / cell_size)),
+		last_col = std::min(cols, (int)std::floor((view_w - origin.x) / cell_size));
+	for (int i = first_col + mod(-first_col, step); i <= last_col; i += step) {
+		SDL_Rect line{ (int)(i * cell_size + origin.x), grid_y1, 1, grid_y2 - grid_y1 + 1 };
+		(i % (step * 2) == 0 || i == cols ? major_lines : minor_lines).push_back(line);
+	}
+
+	// Horizontal lines
+	int
+		first_row = std::max(0, (int)std::ceil(-origin.y / cell_size)),
+		last_row = std::min(rows, (int)std::floor((view_h - origin.y) / cell_size));
+	for (int i = first_row + mod(-first_row, step); i <= last_row; i += step) {
+		SDL_Rect line{ grid_x1, (int)(i * cell_size + origin.y), grid_x2 - grid_x1 + 1, 1 };
+		(i % (step * 2) == 0 || i == rows ? major_lines : minor_lines).push_back(line);
+	}
+
+	SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+	SDL_RenderFillRects(renderer, major_lines.data(), (int)major_lines.size());
+	PROFILE_COUNT(ProfileCounter::DRAW_CALLS, 1);
+	if (minor_alpha > 0 && !minor_lines.empty()) {
+		SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, (Uint8)(color.a * minor_alpha));
+		SDL_RenderFillRects(renderer, minor_lines.data(), (int)minor_lines.size());
+		PROFILE_COUNT(ProfileCounter::DRAW_CALLS, 1);
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef TILEMAPEDITOR_RENDERING_H
+#define TILEMAPEDITOR_RENDERING_H
+
+#include <SDL.h>
+#include <vector>
+#include "chomusuke/common.h"
+
+// Grid lines closer than this (in pixels) are merged into a coarser grid
+constexpr float MIN_GRID_SPACING{ 4.0f };
+
+/*
+* Accumulates textured quads that share the same texture so that they can be
+* submitted with a single SDL_RenderGeometry call.
+* Buffers keep their capacity between frames.
+*/
+class TileBatch {
+	std::vector<SDL_Vertex> vertices{};
+	std::vector<int> indices{};
+	SDL_Texture* texture{ nullptr };
+	float inv_texture_w{ 1 };
+	float inv_texture_h{ 1 };
+
+public:
+	void begin(SDL_Texture* texture_);
+	// dst is in screen pixels, src in texture pixels
+	void addQuad(const SDL_FRect& dst, const SDL_Rect& src);
+	void submit(SDL_Renderer* renderer);
+	bool empty() const { return vertices.empty(); }
+	size_t quadCount() const { return vertices.size() / 4; }
+};
+
+/*
+* Target texture kept alive across frames.
+* It is only recreated when the requested size or format changes.
+*/
+class RenderTarget {
+	SDL_Texture* texture{ nullptr };
+	Uint32 format{ 0 };
+	int width{ 0 };
+	int height{ 0 };
+
+public:
+	// Returns nullptr if the texture could not be created
+	SDL_Texture* acquire(SDL_Renderer* renderer, Uint32 format_, int width_, int height_);
+	SDL_Texture* get() const { return texture; }
+	void destroy();
+};
+
+/*
+* Draws the lines of a cols x rows grid whose top-left corner is at origin.
+* Only the lines inside the view are generated and they are submitted in at most two calls.
+* When cells get smaller than MIN_GRID_SPACING, only every n-th line is kept and
+* the lines in between fade out, so the number of lines never depends on the map size.
+*/
+class GridRenderer {
+	std::vector<SDL_Rect> major_lines{};
+	std::vector<SDL_Rect> minor_lines{};
+
+public:
+	void draw(
+		SDL_Renderer* renderer,
+		SDL_Color color,
+		cho::Vector2f origin,
+		float cell_size,
+		int cols,
+		int rows,
+		int view_w,
+		int view_h);
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "Replay.h"
+#include <SDL.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "InputRecording.h"
+#include "tilemapeditor.h"
+
+namespace {
+	// Delta of the frames that didn't receive any event
+	constexpr float REPLAY_IDLE_DELTA{ 1.0f / 60 };
+
+	// Recorded events point to the window of the recording session
+	void retarget(SDL_Event& event, Uint32 window_id) {
+		event.common.timestamp = SDL_GetTicks();
+		switch (event.type) {
+		case SDL_MOUSEMOTION: event.motion.windowID = window_id; break;
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP: event.button.windowID = window_id; break;
+		case SDL_MOUSEWHEEL: event.wheel.windowID = window_id; break;
+		case SDL_KEYDOWN:
+		case SDL_KEYUP: event.key.windowID = window_id; break;
+		case SDL_TEXTINPUT: event.text.windowID = window_id; break;
+		case SDL_WINDOWEVENT: event.window.windowID = window_id; break;
+		}
+	}
+
+	std::string toJSON(const std::string& log_path, const std::vector<double>& frame_ms) {
+		std::vector<double> sorted(frame_ms);
+		std::sort(sorted.begin(), sorted.end());
+		double total = 0;
+		for (double ms : frame_ms)
+			total += ms;
+		auto percentile = [&](double p) { return sorted.empty() ? 0.0 : sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))]; };
+
+		std::ostringstream out;
+		out << "{\n";
+		out << "  \"log\": \"" << log_path << "\",\n";
+		out << "  \"frames\": " << frame_ms.size() << ",\n";
+		out << "  \"total_ms\": " << total << ",\n";
+		out << "  \"mean_ms\": " << (frame_ms.empty() ? 0 : total / frame_ms.size()) << ",\n";
+		out << "  \"p50_ms\": " << percentile(0.5) << ",\n";
+		out << "  \"p99_ms\": " << percentile(0.99) << ",\n";
+		out << "  \"max_ms\": " << (sorted.empty() ? 0 : sorted.back()) << ",\n";
+		out << "  \"frame_ms\": [";
+		for (size_t i = 0; i < frame_ms.size(); i++)
+			out << (i == 0 ? "" : ", ") << frame_ms[i];
+		out << "]\n}\n";
+		return out.str();
+	}
+}
+
+bool parseReplayArgs(int argc, char* argv[], ReplayOptions& options) {
+	bool enabled = false;
+	for (int i = 1; i + 1 < argc; i++) {
+		std::string arg(argv[i]);
+		if (arg == "--replay") {
+			options.log_path = argv[++i];
+			enabled = true;
+		}
+		else if (arg == "--replay-out")
+			options.output_path = argv[++i];
+		else if (arg == "--trace")
+			options.trace_path = argv[++i];
+	}
+	return enabled;
+}
+
+int runReplay(const ReplayOptions& options) {
+	int window_w, window_h;
+	std::vector<RecordedFrame> frames;
+	std::string error;
+	if (!loadInputLog(options.log_path, window_w, window_h, frames, error)) {
+		std::cout << "Replay error: " << error << std::endl;
+		return 1;
+	}
+
+	// Nothing is displayed, the software renderer draws into the dummy window's surface
+	SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+		std::cout << "SDL_Init failed: " << SDL_GetError() << std::endl;
+		return 1;
+	}
+	SDL_Window* window = SDL_CreateWindow("Tilemap Editor replay", 0, 0, window_w, window_h, SDL_WINDOW_HIDDEN);
+	SDL_Renderer* renderer = (window != nullptr ? SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE | SDL_RENDERER_TARGETTEXTURE) : nullptr);
+	if (renderer == nullptr) {
+		std::cout << "Software renderer creation failed: " << SDL_GetError() << std::endl;
+		if (window != nullptr)
+			SDL_DestroyWindow(window);
+		SDL_Quit();
+		return 1;
+	}
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+
+	auto data = std::make_shared<TileMapStartupData>();
+	data->window_w = window_w;
+	data->window_h = window_h;
+	// Every frame is run back to back instead of waiting for events
+	data->idle = false;
+	// Autosaves would depend on the recorded frame times
+	data->autosave.interval_s = 0;
+	// Neither would the journal, nor should it offer to recover anything
+	data->journal = false;
+	data->trace_path = options.trace_path;
+	cho::SDLPointers pointers{ window, renderer };
+	TileMapEditor editor;
+	editor.start(data, pointers);
+
+	// Same order as the main loop: events, update, draw, present
+	std::vector<double> frame_ms;
+	uint32_t last_frame = (frames.empty() ? 0 : frames.back().frame) + ACTIVE_FRAMES_AFTER_EVENT;
+	size_t next = 0;
+	Uint32 window_id = SDL_GetWindowID(window);
+	for (uint32_t frame = 0; frame <= last_frame && !editor.isEndOfScene(); frame++) {
+		auto start = std::chrono::steady_clock::now();
+		float delta = REPLAY_IDLE_DELTA;
+		if (next < frames.size() && frames[next].frame == frame) {
+			for (SDL_Event& event : frames[next].events) {
+				retarget(event, window_id);
+				editor.processEvent(event);
+			}
+			delta = frames[next].delta;
+			next++;
+		}
+		editor.update(delta);
+		SDL_SetRenderDrawColor(renderer, data->clear_color.r, data->clear_color.g, data->clear_color.b, data->clear_color.a);
+		SDL_RenderClear(renderer);
+		editor.draw(pointers);
+		SDL_RenderPresent(renderer);
+		editor.lateUpdate(delta);
+		frame_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+	editor.processDeath();
+	SDL_DestroyRenderer(renderer);
+	SDL_DestroyWindow(window);
+	SDL_Quit();
+
+	std::string json = toJSON(options.log_path, frame_ms);
+	if (options.output_path.empty()) {
+		std::cout << json;
+		return 0;
+	}
+	std::ofstream file(options.output_path);
+	file << json;
+	if (!file.good()) {
+		std::cout << "Failed to write " << options.output_path << std::endl;
+		return 1;
+	}
+	return 0;
+}
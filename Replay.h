@@ -0,0 +1,24 @@
+#ifndef TILEMAPEDITOR_REPLAY_H
+#define TILEMAPEDITOR_REPLAY_H
+
+#include <string>
+
+struct ReplayOptions {
+	std::string log_path{};
+	// Written to stdout when empty
+	std::string output_path{};
+	// Chrome trace of the replay when not empty
+	std::string trace_path{};
+};
+
+/*
+* Command line: --replay <input log> [--replay-out <file.json>] [--trace <file.json>]
+* Returns false when --replay isn't given.
+*/
+bool parseReplayArgs(int argc, char* argv[], ReplayOptions& options);
+
+// Feeds a log written with --record to the editor, without showing any window, and writes the frame timings as JSON.
+// Returns the process exit code.
+int runReplay(const ReplayOptions& options);
+
+#endif
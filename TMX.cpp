@@ -0,0 +1,92 @@
+#include "TMX.h"
+
+uint32_t toGID(PackedTile tile, const std::map<int, TextureData>& tilesets) {
+	if (tile == EMPTY_TILE)
+		return 0;
+
+	auto it = tilesets.find(packedTextureID(tile));
+	if (it == tilesets.end())
+		return 0;
+
+	Tile unpacked = unpackTile(tile);
+	const TextureData& data = it->second;
+	if (unpacked.id_on_texture.x >= data.texture_tile_width || unpacked.id_on_texture.y >= data.texture_tile_height)
+		return 0;
+	return (uint32_t)(data.first_tile_id + unpacked.id_on_texture.y * data.texture_tile_width + unpacked.id_on_texture.x);
+}
+
+std::string encodeBase64(const unsigned char* data, size_t size) {
+	static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+	out.reserve((size + 2) / 3 * 4);
+
+	size_t i = 0;
+	for (; i + 2 < size; i += 3) {
+		uint32_t triple = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+		out.push_back(table[(triple >> 18) & 0x3F]);
+		out.push_back(table[(triple >> 12) & 0x3F]);
+		out.push_back(table[(triple >> 6) & 0x3F]);
+		out.push_back(table[triple & 0x3F]);
+	}
+
+	if (i < size) {
+		uint32_t triple = data[i] << 16;
+		if (i + 1 < size)
+			triple |= data[i + 1] << 8;
+		out.push_back(table[(triple >> 18) & 0x3F]);
+		out.push_back(table[(triple >> 12) & 0x3F]);
+		out.push_back(i + 1 < size ? table[(triple >> 6) & 0x3F] : '=');
+		out.push_back('=');
+	}
+	return out;
+}
+
+tinyxml2::XMLElement* newTMXMap(tinyxml2::XMLDocument& doc, const TMXMapInfo& info) {
+	tinyxml2::XMLElement* root_ptr = doc.NewElement("map");
+	root_ptr->SetAttribute("version", "1.10");
+	root_ptr->SetAttribute("tiledversion", "1.10.1");
+	root_ptr->SetAttribute("orientation", "orthogonal");
+	root_ptr->SetAttribute("renderorder", "right-down");
+	root_ptr->SetAttribute("width", info.width);
+	root_ptr->SetAttribute("height", info.height);
+	root_ptr->SetAttribute("tilewidth", info.tile_size);
+	root_ptr->SetAttribute("tileheight", info.tile_size);
+	root_ptr->SetAttribute("infinite", 0);
+	root_ptr->SetAttribute("nextlayerid", info.layer_count + 1);
+	root_ptr->SetAttribute("nextobjectid", 1);
+	root_ptr->SetText("\n");
+	return root_ptr;
+}
+
+TextureData addTMXTileset(
+	tinyxml2::XMLDocument& doc,
+	tinyxml2::XMLElement* map_elm_ptr,
+	int first_gid,
+	const std::string& name,
+	int tile_size,
+	int columns,
+	int tile_count,
+	const std::string& image_source,
+	int image_w,
+	int image_h)
+{
+	tinyxml2::XMLElement* tileset = doc.NewElement("tileset");
+	tileset->SetAttribute("firstgid", first_gid);
+	tileset->SetAttribute("name", name.c_str());
+	tileset->SetAttribute("tilewidth", tile_size);
+	tileset->SetAttribute("tileheight", tile_size);
+	tileset->SetAttribute("tilecount", tile_count);
+	tileset->SetAttribute("columns", columns);
+	tileset->SetText("\n");
+
+	tinyxml2::XMLElement* image = doc.NewElement("image");
+	image->SetAttribute("source", image_source.c_str());
+	image->SetAttribute("width", image_w);
+	image->SetAttribute("height", image_h);
+	tileset->InsertEndChild(image);
+
+	map_elm_ptr->InsertEndChild(tileset);
+
+	int rows = (columns > 0 ? (tile_count + columns - 1) / columns : 0);
+	return TextureData{ .first_tile_id = first_gid, .texture_tile_width = columns, .texture_tile_height = rows };
+}
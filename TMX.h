@@ -0,0 +1,59 @@
+#ifndef TILEMAPEDITOR_TMX_H
+#define TILEMAPEDITOR_TMX_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "tinyxml2.h"
+#include "TileLayer.h"
+
+struct TextureData {
+	int first_tile_id;
+	int texture_tile_width;
+	int texture_tile_height;
+};
+
+enum class TMXEncoding {
+	CSV,
+	BASE64,
+	BASE64_ZLIB,
+	BASE64_ZSTD
+};
+
+const std::map<TMXEncoding, std::string> tmx_encoding_names = {
+	{TMXEncoding::CSV, "CSV"},
+	{TMXEncoding::BASE64, "Base64 (uncompressed)"},
+	{TMXEncoding::BASE64_ZLIB, "Base64 (zlib compressed)"},
+	{TMXEncoding::BASE64_ZSTD, "Base64 (zstd compressed)"}
+};
+
+struct TMXMapInfo {
+	int width{ 1 };
+	int height{ 1 };
+	int tile_size{ 1 };
+	int layer_count{ 0 };
+};
+
+// Global tile id used by TMX, 0 means empty
+uint32_t toGID(PackedTile tile, const std::map<int, TextureData>& tilesets);
+
+std::string encodeBase64(const unsigned char* data, size_t size);
+
+// Creates the <map> root element
+tinyxml2::XMLElement* newTMXMap(tinyxml2::XMLDocument& doc, const TMXMapInfo& info);
+
+// Appends a <tileset> made of a single image to the map, and returns how its tiles map to GIDs
+TextureData addTMXTileset(
+	tinyxml2::XMLDocument& doc,
+	tinyxml2::XMLElement* map_elm_ptr,
+	int first_gid,
+	const std::string& name,
+	int tile_size,
+	int columns,
+	int tile_count,
+	const std::string& image_source,
+	int image_w,
+	int image_h);
+
+#endif
@@ -0,0 +1,324 @@
+#include "TMXReader.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <zlib.h>
+#include <zstd.h>
+#include "Trace.h"
+
+TMXReader::~TMXReader() {
+	for (std::thread& worker : workers)
+		if (worker.joinable())
+			worker.join();
+}
+
+bool TMXReader::open(const std::string& path, std::string& error) {
+	if (doc.LoadFile(path.c_str()) != tinyxml2::XML_SUCCESS) {
+		error = std::string("Failed to parse ") + path + ": " + doc.ErrorStr();
+		return false;
+	}
+
+	const tinyxml2::XMLElement* map_ptr = doc.FirstChildElement("map");
+	if (map_ptr == nullptr) {
+		error = "No <map> element";
+		return false;
+	}
+	if (map_ptr->IntAttribute("infinite", 0) != 0) {
+		error = "Infinite maps are not supported";
+		return false;
+	}
+	if (map_ptr->IntAttribute("tilewidth") != map_ptr->IntAttribute("tileheight")) {
+		error = "Only square tiles are supported";
+		return false;
+	}
+	info.width = map_ptr->IntAttribute("width");
+	info.height = map_ptr->IntAttribute("height");
+	info.tile_size = map_ptr->IntAttribute("tilewidth");
+	if (info.width <= 0 || info.height <= 0 || info.tile_size <= 0) {
+		error = "Invalid map dimensions";
+		return false;
+	}
+
+	// Image paths are relative to the map file
+	std::filesystem::path directory = std::filesystem::path(path).parent_path();
+	for (const tinyxml2::XMLElement* tileset_ptr = map_ptr->FirstChildElement("tileset"); tileset_ptr != nullptr; tileset_ptr = tileset_ptr->NextSiblingElement("tileset")) {
+		if (tileset_ptr->Attribute("source") != nullptr) {
+			error = "External tilesets (.tsx) are not supported";
+			return false;
+		}
+		const tinyxml2::XMLElement* image_ptr = tileset_ptr->FirstChildElement("image");
+		if (image_ptr == nullptr || image_ptr->Attribute("source") == nullptr) {
+			error = "Tilesets must consist of a single image";
+			return false;
+		}
+
+		TMXTileset tileset;
+		tileset.first_gid = tileset_ptr->IntAttribute("firstgid", 1);
+		tileset.name = tileset_ptr->Attribute("name", "");
+		tileset.columns = std::max(1, tileset_ptr->IntAttribute("columns", 1));
+		tileset.tile_count = tileset_ptr->IntAttribute("tilecount");
+		tileset.image_width = image_ptr->IntAttribute("width");
+		tileset.image_height = image_ptr->IntAttribute("height");
+		if (tileset.columns > (1 << PACKED_COORD_BITS) || tileset.tile_count / tileset.columns > (1 << PACKED_COORD_BITS)) {
+			error = "Tileset \"" + tileset.name + "\" is too large";
+			return false;
+		}
+		std::filesystem::path image_path(image_ptr->Attribute("source"));
+		tileset.image_path = (image_path.is_absolute() ? image_path : directory / image_path).string();
+		tilesets.push_back(tileset);
+	}
+	std::sort(tilesets.begin(), tilesets.end(), [](const TMXTileset& a, const TMXTileset& b) { return a.first_gid < b.first_gid; });
+	if (tilesets.size() > MAX_TEXTURES) {
+		error = "Too many tilesets (maximum " + std::to_string(MAX_TEXTURES) + ")";
+		return false;
+	}
+
+	for (const tinyxml2::XMLElement* layer_ptr = map_ptr->FirstChildElement("layer"); layer_ptr != nullptr; layer_ptr = layer_ptr->NextSiblingElement("layer")) {
+		const tinyxml2::XMLElement* data_ptr = layer_ptr->FirstChildElement("data");
+		if (data_ptr == nullptr || data_ptr->FirstChildElement("chunk") != nullptr) {
+			error = "Layers must contain a single <data> element";
+			return false;
+		}
+
+		LayerSource source;
+		source.name = layer_ptr->Attribute("name", "");
+		source.visible = layer_ptr->IntAttribute("visible", 1) != 0;
+		source.encoding = data_ptr->Attribute("encoding");
+		source.compression = data_ptr->Attribute("compression");
+		source.text = data_ptr->GetText();
+		sources.push_back(source);
+	}
+	info.layer_count = (int)sources.size();
+	return true;
+}
+
+void TMXReader::startDecoding(unsigned threads) {
+	layers.clear();
+	layers.resize(sources.size());
+	layer_errors.assign(sources.size(), std::string());
+
+	// Workers take layers in order until there is none left
+	auto next_layer = std::make_shared<std::atomic<size_t>>(0);
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	size_t worker_count = std::min<size_t>(threads, sources.size());
+	for (size_t i = 0; i < worker_count; i++) {
+		workers.emplace_back([this, next_layer]() {
+			for (size_t layer = (*next_layer)++; layer < sources.size(); layer = (*next_layer)++) {
+				TRACE_SCOPE("Decode layer");
+				decodeLayer(layer, layer_errors[layer]);
+			}
+		});
+	}
+}
+
+bool TMXReader::finishDecoding(std::vector<TMXLayer>& out, std::string& error) {
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+
+	for (size_t layer = 0; layer < layer_errors.size(); layer++) {
+		if (!layer_errors[layer].empty()) {
+			error = "Layer \"" + sources[layer].name + "\": " + layer_errors[layer];
+			return false;
+		}
+	}
+	out = std::move(layers);
+	return true;
+}
+
+bool TMXReader::toPackedTile(uint32_t gid, PackedTile& tile) const {
+	gid &= ~GID_FLAGS_MASK;
+	auto it = std::upper_bound(tilesets.begin(), tilesets.end(), gid,
+		[](uint32_t value, const TMXTileset& tileset) { return value < (uint32_t)tileset.first_gid; });
+	if (it == tilesets.begin())
+		return false;
+	it--;
+
+	int local_id = (int)gid - it->first_gid;
+	// Without a tilecount, the tileset can't hold more rows than a packed tile can address
+	int tile_count = (it->tile_count > 0 ? it->tile_count : it->columns << PACKED_COORD_BITS);
+	if (local_id >= tile_count)
+		return false;
+	Tile unpacked;
+	unpacked.texture_id = (int)(it - tilesets.begin());
+	unpacked.id_on_texture = TileID(local_id % it->columns, local_id / it->columns);
+	tile = packTile(unpacked);
+	return true;
+}
+
+bool TMXReader::decodeLayer(size_t index, std::string& error) {
+	const LayerSource& source = sources[index];
+	TMXLayer& layer = layers[index];
+	layer.name = source.name;
+	layer.visible = source.visible;
+	layer.tiles = TileLayer(info.width, info.height);
+
+	// GIDs are converted as they are read, a row at a time
+	size_t tile_count = (size_t)info.width * info.height;
+	size_t decoded = 0;
+	std::vector<PackedTile> row(info.width);
+	auto push = [&](uint32_t gid) {
+		if (decoded < tile_count) {
+			int x = (int)(decoded % info.width);
+			row[x] = EMPTY_TILE;
+			if (gid != 0 && !toPackedTile(gid, row[x])) {
+				error = "Invalid tile GID " + std::to_string(gid);
+				return false;
+			}
+			if (x == info.width - 1)
+				layer.tiles.setSpan((int)(decoded / info.width), 0, x, [&row](int x) { return row[x]; }, [](int, PackedTile) {});
+		}
+		decoded++;
+		return true;
+	};
+
+	const char* encoding = source.encoding ? source.encoding : "xml";
+	const char* text = source.text ? source.text : "";
+	if (strcmp(encoding, "csv") == 0) {
+		for (const char* p = text; *p != '\0';) {
+			char* end;
+			unsigned long gid = strtoul(p, &end, 10);
+			if (end == p) {
+				p++;
+				continue;
+			}
+			if (!push((uint32_t)gid))
+				return false;
+			p = end;
+		}
+	}
+	else if (strcmp(encoding, "base64") == 0) {
+		std::vector<unsigned char> bytes = decodeBase64(text);
+		if (source.compression != nullptr) {
+			std::vector<unsigned char> decompressed;
+			bool success = false;
+			if (strcmp(source.compression, "zlib") == 0 || strcmp(source.compression, "gzip") == 0)
+				success = decompressZlib(bytes, decompressed);
+			else if (strcmp(source.compression, "zstd") == 0)
+				success = decompressZstd(bytes, decompressed);
+			else {
+				error = std::string("Unsupported compression: ") + source.compression;
+				return false;
+			}
+			if (!success) {
+				error = "Corrupted compressed data";
+				return false;
+			}
+			bytes.swap(decompressed);
+		}
+
+		for (size_t i = 0; i + 3 < bytes.size(); i += 4)
+			if (!push(bytes[i] | (bytes[i + 1] << 8) | (bytes[i + 2] << 16) | ((uint32_t)bytes[i + 3] << 24)))
+				return false;
+	}
+	else {
+		error = std::string("Unsupported encoding: ") + encoding;
+		return false;
+	}
+
+	if (decoded != tile_count) {
+		error = "Expected " + std::to_string(tile_count) + " tiles, got " + std::to_string(decoded);
+		return false;
+	}
+	return true;
+}
+
+std::vector<unsigned char> decodeBase64(const char* text) {
+	std::vector<unsigned char> out;
+	out.reserve(strlen(text) / 4 * 3);
+
+	uint32_t bits = 0;
+	int bit_count = 0;
+	for (const char* p = text; *p != '\0' && *p != '='; p++) {
+		char c = *p;
+		int value;
+		if ('A' <= c && c <= 'Z') value = c - 'A';
+		else if ('a' <= c && c <= 'z') value = c - 'a' + 26;
+		else if ('0' <= c && c <= '9') value = c - '0' + 52;
+		else if (c == '+') value = 62;
+		else if (c == '/') value = 63;
+		else continue;  // Whitespace and line breaks
+
+		bits = (bits << 6) | value;
+		bit_count += 6;
+		if (bit_count >= 8) {
+			bit_count -= 8;
+			out.push_back((unsigned char)(bits >> bit_count));
+		}
+	}
+	return out;
+}
+
+bool decompressZlib(const std::vector<unsigned char>& in, std::vector<unsigned char>& out) {
+	z_stream stream{};
+	// 15 + 32: default window with automatic zlib/gzip header detection
+	if (inflateInit2(&stream, 15 + 32) != Z_OK)
+		return false;
+
+	stream.next_in = const_cast<unsigned char*>(in.data());
+	stream.avail_in = (uInt)in.size();
+	out.resize(std::max<size_t>(in.size() * 4, 1 << 16));
+
+	int result;
+	do {
+		if (stream.total_out == out.size())
+			out.resize(out.size() * 2);
+		stream.next_out = out.data() + stream.total_out;
+		stream.avail_out = (uInt)(out.size() - stream.total_out);
+		result = inflate(&stream, Z_NO_FLUSH);
+	} while (result == Z_OK);
+
+	out.resize(stream.total_out);
+	inflateEnd(&stream);
+	return result == Z_STREAM_END;
+}
+
+bool decompressZstd(const std::vector<unsigned char>& in, std::vector<unsigned char>& out) {
+	ZSTD_DCtx* context = ZSTD_createDCtx();
+	if (context == nullptr)
+		return false;
+
+	// Streaming decompression also handles several concatenated frames
+	ZSTD_inBuffer input{ in.data(), in.size(), 0 };
+	out.resize(std::max<size_t>(in.size() * 4, ZSTD_DStreamOutSize()));
+	size_t written = 0;
+	bool success = true;
+	while (true) {
+		if (written == out.size())
+			out.resize(out.size() * 2);
+		ZSTD_outBuffer output{ out.data() + written, out.size() - written, 0 };
+		size_t result = ZSTD_decompressStream(context, &output, &input);
+		written += output.pos;
+		if (ZSTD_isError(result)) {
+			success = false;
+			break;
+		}
+		// Every frame is complete and flushed
+		if (result == 0 && input.pos == input.size)
+			break;
+		// With room left in the output, the frame is only waiting for input that doesn't exist
+		if (input.pos == input.size && output.pos < output.size) {
+			success = false;
+			break;
+		}
+	}
+
+	out.resize(written);
+	ZSTD_freeDCtx(context);
+	return success;
+}
+
+bool loadTMX(const std::string& path, TMXMapInfo& info, std::vector<TMXTileset>& tilesets, std::vector<TMXLayer>& layers, std::string& error, unsigned threads) {
+	TMXReader reader;
+	if (!reader.open(path, error))
+		return false;
+	reader.startDecoding(threads);
+	if (!reader.finishDecoding(layers, error))
+		return false;
+	info = reader.getInfo();
+	tilesets = reader.getTilesets();
+	return true;
+}
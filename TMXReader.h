@@ -0,0 +1,78 @@
+#ifndef TILEMAPEDITOR_TMXREADER_H
+#define TILEMAPEDITOR_TMXREADER_H
+
+#include <string>
+#include <thread>
+#include <vector>
+#include "tinyxml2.h"
+#include "TMX.h"
+
+// Flip/rotation flags stored in the highest bits of a GID
+constexpr uint32_t GID_FLAGS_MASK{ 0xF0000000 };
+
+struct TMXTileset {
+	int first_gid{ 1 };
+	std::string name{};
+	std::string image_path{};
+	int columns{ 1 };
+	int tile_count{ 0 };
+	// As declared by the map, 0 when missing
+	int image_width{ 0 };
+	int image_height{ 0 };
+};
+
+struct TMXLayer {
+	std::string name{};
+	bool visible{ true };
+	TileLayer tiles{};
+};
+
+/*
+* Reads a TMX file in two steps so that the caller can do its own work
+* (e.g. uploading the tileset textures) while the layers are being decoded:
+*   open() parses the XML, the map header and the tilesets,
+*   startDecoding() decodes every <layer> on a pool of worker threads (one per core unless given),
+*   finishDecoding() waits for them and hands over the layers.
+* Tileset i is mapped to texture id i.
+*/
+class TMXReader {
+	struct LayerSource {
+		std::string name{};
+		bool visible{ true };
+		const char* encoding{ nullptr };
+		const char* compression{ nullptr };
+		const char* text{ nullptr };
+	};
+
+	tinyxml2::XMLDocument doc{};
+	TMXMapInfo info{};
+	std::vector<TMXTileset> tilesets{};
+	std::vector<LayerSource> sources{};
+	std::vector<TMXLayer> layers{};
+	std::vector<std::string> layer_errors{};
+	std::vector<std::thread> workers{};
+
+public:
+	~TMXReader();
+
+	bool open(const std::string& path, std::string& error);
+	const TMXMapInfo& getInfo() const { return info; }
+	const std::vector<TMXTileset>& getTilesets() const { return tilesets; }
+
+	void startDecoding(unsigned threads = 0);
+	bool finishDecoding(std::vector<TMXLayer>& out, std::string& error);
+
+private:
+	bool decodeLayer(size_t index, std::string& error);
+	// Converts a GID to a packed tile, returns false if no tileset contains it or it is past the end of its tileset
+	bool toPackedTile(uint32_t gid, PackedTile& tile) const;
+};
+
+std::vector<unsigned char> decodeBase64(const char* text);
+bool decompressZlib(const std::vector<unsigned char>& in, std::vector<unsigned char>& out);
+bool decompressZstd(const std::vector<unsigned char>& in, std::vector<unsigned char>& out);
+
+// Blocking helper reading the whole file at once, decoding layers on up to threads threads (0: one per core)
+bool loadTMX(const std::string& path, TMXMapInfo& info, std::vector<TMXTileset>& tilesets, std::vector<TMXLayer>& layers, std::string& error, unsigned threads = 0);
+
+#endif
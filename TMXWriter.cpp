@@ -0,0 +1,282 @@
+#include "TMXWriter.h"
+#include <algorithm>
+
+TMXWriter::TMXWriter(const TMXMapInfo& info) {
+	header_doc.InsertFirstChild(header_doc.NewDeclaration());
+	map_elm_ptr = newTMXMap(header_doc, info);
+	header_doc.InsertEndChild(map_elm_ptr);
+}
+
+TMXWriter::~TMXWriter() {
+	printer.reset();
+	if (file != nullptr)
+		fclose(file);
+	if (zlib_initialized)
+		deflateEnd(&zlib_stream);
+	if (zstd_context != nullptr)
+		ZSTD_freeCCtx(zstd_context);
+}
+
+bool TMXWriter::open(const std::string& path) {
+	file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+	file_buffer.resize(TMX_FILE_BUFFER_SIZE);
+	setvbuf(file, file_buffer.data(), _IOFBF, file_buffer.size());
+	printer = std::make_unique<tinyxml2::XMLPrinter>(file);
+
+	// Same visiting order as XMLDocument::Print, except that <map> is left open
+	header_doc.FirstChild()->Accept(printer.get());
+	printer->OpenElement(map_elm_ptr->Name());
+	for (const tinyxml2::XMLAttribute* attribute = map_elm_ptr->FirstAttribute(); attribute != nullptr; attribute = attribute->Next())
+		printer->PushAttribute(attribute->Name(), attribute->Value());
+	printer->PushText(map_elm_ptr->GetText());
+	for (const tinyxml2::XMLElement* child = map_elm_ptr->FirstChildElement(); child != nullptr; child = child->NextSiblingElement())
+		child->Accept(printer.get());
+	return true;
+}
+
+bool TMXWriter::writeLayer(
+	int layer_id,
+	const std::string& name,
+	bool visible,
+	const TileLayer& layer,
+	const std::map<int, TextureData>& tilesets,
+	TMXEncoding encoding)
+{
+	if (printer == nullptr)
+		return false;
+
+	printer->OpenElement("layer");
+	printer->PushAttribute("id", layer_id);
+	printer->PushAttribute("name", name.c_str());
+	printer->PushAttribute("width", layer.getWidth());
+	printer->PushAttribute("height", layer.getHeight());
+	if (!visible)
+		printer->PushAttribute("visible", 0);
+
+	printer->OpenElement("data");
+	bool success = true;
+	if (encoding == TMXEncoding::CSV) {
+		printer->PushAttribute("encoding", "csv");
+		writeCSV(layer, tilesets);
+	}
+	else {
+		printer->PushAttribute("encoding", "base64");
+		if (encoding == TMXEncoding::BASE64_ZLIB)
+			printer->PushAttribute("compression", "zlib");
+		if (encoding == TMXEncoding::BASE64_ZSTD)
+			printer->PushAttribute("compression", "zstd");
+		success = writeBase64(layer, tilesets, encoding);
+	}
+	printer->CloseElement();
+	printer->CloseElement();
+	return success;
+}
+
+bool TMXWriter::close() {
+	if (printer == nullptr)
+		return false;
+	printer->CloseElement();
+	printer.reset();
+
+	if (cache != nullptr) {
+		std::erase_if(cache->layers, [this](const auto& entry) {
+			return std::find(cached_layers.begin(), cached_layers.end(), entry.first) == cached_layers.end();
+		});
+	}
+
+	bool success = (ferror(file) == 0);
+	success = (fclose(file) == 0) && success;
+	file = nullptr;
+	return success;
+}
+
+void TMXWriter::fillBand(const TileLayer& layer, int chunk_y, const std::map<int, TextureData>& tilesets) {
+	int
+		width = layer.getWidth(),
+		first_row = chunk_y * CHUNK_SIZE,
+		rows = std::min(CHUNK_SIZE, layer.getHeight() - first_row);
+	band_bytes.assign((size_t)width * rows * 4, 0);
+
+	for (int chunk_x = 0; chunk_x < layer.getChunksW(); chunk_x++) {
+		const PackedTile* chunk = layer.getChunkTiles(chunk_x, chunk_y);
+		if (chunk == nullptr)
+			continue;
+
+		int columns = std::min(CHUNK_SIZE, width - chunk_x * CHUNK_SIZE);
+		for (int row = 0; row < rows; row++) for (int column = 0; column < columns; column++) {
+			PackedTile tile = chunk[(size_t)row * CHUNK_SIZE + column];
+			if (tile == EMPTY_TILE)
+				continue;
+
+			// GIDs are stored as little-endian 32 bit integers
+			uint32_t gid = toGID(tile, tilesets);
+			unsigned char* out = &band_bytes[((size_t)row * width + chunk_x * CHUNK_SIZE + column) * 4];
+			out[0] = (unsigned char)gid;
+			out[1] = (unsigned char)(gid >> 8);
+			out[2] = (unsigned char)(gid >> 16);
+			out[3] = (unsigned char)(gid >> 24);
+		}
+	}
+}
+
+void TMXWriter::writeCSV(const TileLayer& layer, const std::map<int, TextureData>& tilesets) {
+	text = "\n";
+	for (int y = 0; y < layer.getHeight(); y++) {
+		for (int x = 0; x < layer.getWidth(); x++) {
+			text += std::to_string(toGID(layer.getPacked(x, y), tilesets));
+			if (x + 1 < layer.getWidth() || y + 1 < layer.getHeight())
+				text += ',';
+		}
+		text += '\n';
+		flushText(false);
+	}
+	flushText(true);
+}
+
+bool TMXWriter::writeBase64(const TileLayer& layer, const std::map<int, TextureData>& tilesets, TMXEncoding encoding) {
+	text = "\n";
+	base64_carry_size = 0;
+	if (encoding == TMXEncoding::BASE64_ZLIB && !zlib_initialized) {
+		// Raw deflate, the zlib header and checksum are written around the bands
+		if (deflateInit2(&zlib_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return false;
+		zlib_initialized = true;
+	}
+	if (encoding == TMXEncoding::BASE64_ZSTD && zstd_context == nullptr && (zstd_context = ZSTD_createCCtx()) == nullptr)
+		return false;
+
+	TMXLayerCache* layer_cache = (encoding == TMXEncoding::BASE64 ? nullptr : getLayerCache(layer, tilesets, encoding));
+	if (encoding == TMXEncoding::BASE64_ZLIB) {
+		const unsigned char zlib_header[2]{ 0x78, 0x9C };
+		pushBase64(zlib_header, sizeof(zlib_header));
+	}
+
+	bool success = true;
+	uLong adler = adler32(0, nullptr, 0);
+	TMXEncodedBand uncached;
+	for (int chunk_y = 0; chunk_y < layer.getChunksH() && success; chunk_y++) {
+		if (encoding == TMXEncoding::BASE64) {
+			fillBand(layer, chunk_y, tilesets);
+			pushBase64(band_bytes.data(), band_bytes.size());
+			continue;
+		}
+
+		TMXEncodedBand& band = (layer_cache != nullptr ? layer_cache->bands[chunk_y] : uncached);
+		bool modified = (layer_cache == nullptr || band.raw_size == 0);
+		for (int chunk_x = 0; chunk_x < layer.getChunksW() && !modified; chunk_x++)
+			modified = (layer.getChunkRevision((size_t)chunk_y * layer.getChunksW() + chunk_x) > layer_cache->revision);
+		if (modified && !encodeBand(layer, chunk_y, tilesets, encoding, band)) {
+			band = TMXEncodedBand();
+			success = false;
+			break;
+		}
+
+		pushBase64(band.bytes.data(), band.bytes.size());
+		adler = adler32_combine(adler, band.adler, (z_off_t)band.raw_size);
+	}
+	if (layer_cache != nullptr && success)
+		layer_cache->revision = layer.getRevision();
+
+	if (encoding == TMXEncoding::BASE64_ZLIB) {
+		// Empty final block, then the Adler-32 of the whole layer
+		const unsigned char zlib_trailer[6]{
+			0x03, 0x00,
+			(unsigned char)(adler >> 24), (unsigned char)(adler >> 16), (unsigned char)(adler >> 8), (unsigned char)adler
+		};
+		pushBase64(zlib_trailer, sizeof(zlib_trailer));
+	}
+
+	// Remaining 1 or 2 bytes are encoded with padding
+	text += encodeBase64(base64_carry, base64_carry_size);
+	base64_carry_size = 0;
+	text += '\n';
+	flushText(true);
+	return success;
+}
+
+bool TMXWriter::encodeBand(
+	const TileLayer& layer,
+	int chunk_y,
+	const std::map<int, TextureData>& tilesets,
+	TMXEncoding encoding,
+	TMXEncodedBand& band)
+{
+	fillBand(layer, chunk_y, tilesets);
+	band.raw_size = band_bytes.size();
+	band.bytes.clear();
+
+	if (encoding == TMXEncoding::BASE64_ZSTD) {
+		// Concatenated frames decode as a single stream
+		band.bytes.resize(ZSTD_compressBound(band_bytes.size()));
+		size_t size = ZSTD_compressCCtx(zstd_context, band.bytes.data(), band.bytes.size(), band_bytes.data(), band_bytes.size(), ZSTD_CLEVEL_DEFAULT);
+		if (ZSTD_isError(size))
+			return false;
+		band.bytes.resize(size);
+		return true;
+	}
+
+	// A sync flush ends the band on a byte boundary without a final block, so bands can be concatenated
+	band.adler = (uint32_t)adler32(adler32(0, nullptr, 0), band_bytes.data(), (uInt)band_bytes.size());
+	if (deflateReset(&zlib_stream) != Z_OK)
+		return false;
+	compressed.resize(deflateBound(&zlib_stream, (uLong)band_bytes.size()) + 16);
+	zlib_stream.next_in = band_bytes.data();
+	zlib_stream.avail_in = (uInt)band_bytes.size();
+	int result;
+	do {
+		zlib_stream.next_out = compressed.data();
+		zlib_stream.avail_out = (uInt)compressed.size();
+		result = deflate(&zlib_stream, Z_SYNC_FLUSH);
+		band.bytes.insert(band.bytes.end(), compressed.data(), compressed.data() + compressed.size() - zlib_stream.avail_out);
+	} while (zlib_stream.avail_out == 0 && result == Z_OK);
+	return result == Z_OK || result == Z_BUF_ERROR;
+}
+
+TMXLayerCache* TMXWriter::getLayerCache(const TileLayer& layer, const std::map<int, TextureData>& tilesets, TMXEncoding encoding) {
+	if (cache == nullptr)
+		return nullptr;
+
+	std::vector<int> tileset_key;
+	for (const auto& [id, data] : tilesets)
+		tileset_key.insert(tileset_key.end(), { id, data.first_tile_id, data.texture_tile_width, data.texture_tile_height });
+	if (cache->tilesets != tileset_key) {
+		cache->layers.clear();
+		cache->tilesets = std::move(tileset_key);
+	}
+
+	cached_layers.push_back(layer.getUID());
+	TMXLayerCache& layer_cache = cache->layers[layer.getUID()];
+	if (layer_cache.encoding != encoding || layer_cache.bands.size() != (size_t)layer.getChunksH()) {
+		layer_cache = TMXLayerCache();
+		layer_cache.encoding = encoding;
+		layer_cache.bands.resize(layer.getChunksH());
+	}
+	return &layer_cache;
+}
+
+void TMXWriter::pushBase64(const unsigned char* data, size_t size) {
+	// Base64 works on groups of 3 bytes, the 0-2 leftover bytes are kept for the next call
+	while (base64_carry_size > 0 && size > 0) {
+		base64_carry[base64_carry_size++] = *data++;
+		size--;
+		if (base64_carry_size == 3) {
+			text += encodeBase64(base64_carry, 3);
+			base64_carry_size = 0;
+		}
+	}
+
+	size_t full = size - size % 3;
+	text += encodeBase64(data, full);
+	for (size_t i = full; i < size; i++)
+		base64_carry[base64_carry_size++] = data[i];
+	flushText(false);
+}
+
+void TMXWriter::flushText(bool force) {
+	if (text.empty() || (!force && text.size() < TMX_TEXT_FLUSH_SIZE))
+		return;
+	printer->PushText(text.c_str());
+	text.clear();
+}
@@ -0,0 +1,119 @@
+#ifndef TILEMAPEDITOR_TMXWRITER_H
+#define TILEMAPEDITOR_TMXWRITER_H
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include <zstd.h>
+#include "tinyxml2.h"
+#include "TMX.h"
+
+// Size of the stdio buffer used when writing the file
+constexpr size_t TMX_FILE_BUFFER_SIZE{ 1 << 20 };
+// Encoded text is handed to the printer once it reaches this size
+constexpr size_t TMX_TEXT_FLUSH_SIZE{ 1 << 16 };
+
+// Compressed bytes of one band of CHUNK_SIZE rows
+struct TMXEncodedBand {
+	std::vector<unsigned char> bytes{};
+	// Adler-32 and size of the uncompressed band, combined into the checksum of the zlib stream
+	uint32_t adler{ 1 };
+	size_t raw_size{ 0 };
+};
+
+struct TMXLayerCache {
+	TMXEncoding encoding{ TMXEncoding::CSV };
+	// Layer revision the bands were last brought up to date at
+	uint64_t revision{ 0 };
+	std::vector<TMXEncodedBand> bands{};
+};
+
+/*
+* Compressed bands of the layers written by the previous saves, keyed by TileLayer::getUID().
+* Bands are compressed independently (a raw deflate stream cut by a sync flush, or one zstd frame),
+* so a band whose chunks weren't written since is copied as is instead of being compressed again.
+* Uncompressed encodings aren't cached.
+*/
+struct TMXSaveCache {
+	std::map<uint64_t, TMXLayerCache> layers{};
+	// GIDs depend on the tilesets, the whole cache is dropped when they change
+	std::vector<int> tilesets{};
+
+	void clear() {
+		layers.clear();
+		tilesets.clear();
+	}
+};
+
+/*
+* Writes a TMX file without building the whole document in memory.
+* The header and the tilesets are small, so they are built as a tinyxml2 document
+* (e.g. by PaletteArea::saveTextureToTMX) and printed with the same XMLPrinter
+* that streams the layers, which keeps their output byte-identical to tinyxml2's.
+* Layers are then encoded one band of CHUNK_SIZE rows at a time.
+*
+* Usage:
+*   TMXWriter writer(info);
+*   auto tilesets = palette.saveTextureToTMX(writer.getDocument(), writer.getMapElement());
+*   writer.setCache(&cache); // optional
+*   writer.open(path);
+*   writer.writeLayer(...);
+*   writer.close();
+*/
+class TMXWriter {
+	tinyxml2::XMLDocument header_doc{};
+	tinyxml2::XMLElement* map_elm_ptr{ nullptr };
+	FILE* file{ nullptr };
+	std::vector<char> file_buffer{};
+	std::unique_ptr<tinyxml2::XMLPrinter> printer{};
+
+	// Encoding state of the layer being written
+	std::vector<unsigned char> band_bytes{};
+	std::vector<unsigned char> compressed{};
+	unsigned char base64_carry[3]{};
+	size_t base64_carry_size{ 0 };
+	std::string text{};
+	z_stream zlib_stream{};
+	bool zlib_initialized{ false };
+	ZSTD_CCtx* zstd_context{ nullptr };
+
+	TMXSaveCache* cache{ nullptr };
+	// Layers written with the cache, the others are dropped from it on close()
+	std::vector<uint64_t> cached_layers{};
+
+public:
+	TMXWriter(const TMXMapInfo& info);
+	~TMXWriter();
+
+	tinyxml2::XMLDocument& getDocument() { return header_doc; }
+	tinyxml2::XMLElement* getMapElement() { return map_elm_ptr; }
+	// Compressed layers reuse the bands of the previous save that were not modified since
+	void setCache(TMXSaveCache* save_cache) { cache = save_cache; }
+
+	// Creates the file and writes everything that was added to the document so far
+	bool open(const std::string& path);
+	bool writeLayer(
+		int layer_id,
+		const std::string& name,
+		bool visible,
+		const TileLayer& layer,
+		const std::map<int, TextureData>& tilesets,
+		TMXEncoding encoding);
+	// Closes the <map> element and the file, returns false if anything failed to be written
+	bool close();
+
+private:
+	void fillBand(const TileLayer& layer, int chunk_y, const std::map<int, TextureData>& tilesets);
+	void writeCSV(const TileLayer& layer, const std::map<int, TextureData>& tilesets);
+	bool writeBase64(const TileLayer& layer, const std::map<int, TextureData>& tilesets, TMXEncoding encoding);
+	// Fills and compresses one band on its own
+	bool encodeBand(const TileLayer& layer, int chunk_y, const std::map<int, TextureData>& tilesets, TMXEncoding encoding, TMXEncodedBand& band);
+	TMXLayerCache* getLayerCache(const TileLayer& layer, const std::map<int, TextureData>& tilesets, TMXEncoding encoding);
+	void pushBase64(const unsigned char* data, size_t size);
+	void flushText(bool force);
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "TileLayer.h"
+#include <atomic>
+
+namespace {
+	std::atomic<uint64_t> next_layer_uid{ 1 };
+}
+
+TileLayer::TileLayer(int width_, int height_) :
+	width{ width_ },
+	height{ height_ },
+	chunks_w{ (width_ + CHUNK_SIZE - 1) / CHUNK_SIZE },
+	chunks_h{ (height_ + CHUNK_SIZE - 1) / CHUNK_SIZE },
+	uid{ next_layer_uid.fetch_add(1) }
+{
+	chunks.resize((size_t)chunks_w * chunks_h);
+	chunk_revisions.resize(chunks.size(), 0);
+}
+
+TileLayer TileLayer::snapshot() const {
+	TileLayer copy;
+	copy.width = width;
+	copy.height = height;
+	copy.chunks_w = chunks_w;
+	copy.chunks_h = chunks_h;
+	copy.chunks = chunks;
+	copy.texture_chunks = texture_chunks;
+	copy.texture_tiles = texture_tiles;
+	copy.mapped = mapped;
+	copy.mapping = mapping;
+	// Same content, so savers can reuse what they cached for the original
+	copy.uid = uid;
+	copy.revision = revision;
+	copy.chunk_revisions = chunk_revisions;
+	return copy;
+}
+
+PackedTile TileLayer::set(int x, int y, PackedTile tile) {
+	size_t chunk_index = (size_t)(y / CHUNK_SIZE) * chunks_w + (x / CHUNK_SIZE);
+	std::shared_ptr<TileChunk>& chunk = chunks[chunk_index];
+	if (chunk == nullptr && !materialize(chunk_index)) {
+		// Clearing a tile inside an empty chunk doesn't need any allocation
+		if (tile == EMPTY_TILE)
+			return EMPTY_TILE;
+		chunk = std::make_shared<TileChunk>();
+		TRACE_COUNT(TraceCounter::CHUNK_ALLOCATIONS, 1);
+	}
+
+	size_t tile_index = (size_t)(y % CHUNK_SIZE) * CHUNK_SIZE + (x % CHUNK_SIZE);
+	PackedTile previous = chunk->tiles[tile_index];
+	if (previous == tile)
+		return previous;
+	unshare(chunk_index);
+	PackedTile& slot = chunk->tiles[tile_index];
+	chunk->used += (tile != EMPTY_TILE) - (previous != EMPTY_TILE);
+	slot = tile;
+	if (previous != EMPTY_TILE)
+		removeUsage(previous, chunk_index);
+	if (tile != EMPTY_TILE)
+		addUsage(tile, chunk_index);
+	chunk_revisions[chunk_index] = ++revision;
+
+	if (chunk->used == 0)
+		releaseChunk(chunk_index);
+	return previous;
+}
+
+void TileLayer::releaseIfEmpty(int chunk_x, int chunk_y) {
+	size_t chunk_index = (size_t)chunk_y * chunks_w + chunk_x;
+	if (chunks[chunk_index] != nullptr && chunks[chunk_index]->used == 0)
+		releaseChunk(chunk_index);
+}
+
+size_t TileLayer::allocatedChunks() const {
+	size_t count = 0;
+	for (const std::shared_ptr<TileChunk>& chunk : chunks)
+		count += (chunk != nullptr);
+	return count;
+}
+
+void TileLayer::mapChunks(std::shared_ptr<const void> owner, std::vector<const PackedTile*>&& tiles) {
+	for (size_t index = 0; index < chunks.size(); index++)
+		if (tiles[index] != nullptr)
+			chunks[index].reset();
+	mapped = std::move(tiles);
+	mapping = std::move(owner);
+}
+
+void TileLayer::setTextureChunkCounts(int texture_id, std::vector<uint16_t>&& counts) {
+	size_t total = 0;
+	for (uint16_t count : counts)
+		total += count;
+	texture_tiles[texture_id] = total;
+	texture_chunks[texture_id] = (total == 0 ? std::vector<uint16_t>() : std::move(counts));
+}
@@ -0,0 +1,346 @@
+#ifndef TILEMAPEDITOR_TILELAYER_H
+#define TILEMAPEDITOR_TILELAYER_H
+
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "useful.h"
+#include "Trace.h"
+
+constexpr int CHUNK_SIZE{ 32 };
+constexpr int CHUNK_AREA{ CHUNK_SIZE * CHUNK_SIZE };
+
+/*
+* Packed tile layout (32 bits):
+*   [31..24] texture_id + 1 (0 means empty)
+*   [23..12] y on texture
+*   [11..0]  x on texture
+*/
+using PackedTile = uint32_t;
+constexpr PackedTile EMPTY_TILE{ 0 };
+constexpr int PACKED_COORD_BITS{ 12 };
+constexpr PackedTile PACKED_COORD_MASK{ (1u << PACKED_COORD_BITS) - 1 };
+
+inline PackedTile packTile(const Tile& tile) {
+	if (tile.texture_id < 0)
+		return EMPTY_TILE;
+	return ((PackedTile)(tile.texture_id + 1) << (PACKED_COORD_BITS * 2)) |
+		(((PackedTile)tile.id_on_texture.y & PACKED_COORD_MASK) << PACKED_COORD_BITS) |
+		((PackedTile)tile.id_on_texture.x & PACKED_COORD_MASK);
+}
+
+inline int packedTextureID(PackedTile packed) {
+	return (int)(packed >> (PACKED_COORD_BITS * 2)) - 1;
+}
+
+inline Tile unpackTile(PackedTile packed) {
+	Tile tile;
+	if (packed == EMPTY_TILE)
+		return tile;
+	tile.texture_id = packedTextureID(packed);
+	tile.id_on_texture.x = (int)(packed & PACKED_COORD_MASK);
+	tile.id_on_texture.y = (int)((packed >> PACKED_COORD_BITS) & PACKED_COORD_MASK);
+	return tile;
+}
+
+struct TileChunk {
+	std::array<PackedTile, CHUNK_AREA> tiles{};
+	// Number of non-empty tiles, the chunk is released once it drops to 0
+	int used{ 0 };
+};
+
+/*
+* One layer of the tilemap, split into CHUNK_SIZE x CHUNK_SIZE chunks.
+* Chunks are only allocated when a non-empty tile is written into them.
+* Every write also keeps a per-texture count of tiles in each chunk up to date.
+* Chunks can also live in a mapped file (see NativeMap.h): they are read in place
+* and only copied to memory on their first write.
+* Each chunk remembers the layer revision of its last write, so that savers can skip unchanged chunks.
+* Chunks are shared with snapshots (see snapshot()) and copied before being written while shared.
+*/
+class TileLayer {
+	int width{ 0 };
+	int height{ 0 };
+	int chunks_w{ 0 };
+	int chunks_h{ 0 };
+	std::vector<std::shared_ptr<TileChunk>> chunks{};
+	// Per texture: number of its tiles in each chunk (left empty while the texture isn't used in this layer)
+	std::array<std::vector<uint16_t>, MAX_TEXTURES> texture_chunks{};
+	std::array<size_t, MAX_TEXTURES> texture_tiles{};
+	// Tiles of each chunk in the mapped file, nullptr when the chunk isn't in it (empty when nothing is mapped).
+	// Pointers are kept after a chunk is copied to memory, so that it can be written back to the same place.
+	std::vector<const PackedTile*> mapped{};
+	// Keeps the mapping alive
+	std::shared_ptr<const void> mapping{};
+	uint64_t uid{ 0 };
+	// Incremented by every write that changes a chunk
+	uint64_t revision{ 0 };
+	std::vector<uint64_t> chunk_revisions{};
+
+public:
+	TileLayer() = default;
+	TileLayer(int width_, int height_);
+	TileLayer(TileLayer&&) = default;
+	TileLayer& operator=(TileLayer&&) = default;
+	// Use snapshot() to copy a layer
+	TileLayer(const TileLayer&) = delete;
+	TileLayer& operator=(const TileLayer&) = delete;
+
+	/*
+	* Copy sharing every chunk (and the mapped file) with this layer, in O(chunk count).
+	* It can be read from another thread while this layer keeps being written on its own thread.
+	*/
+	TileLayer snapshot() const;
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	int getChunksW() const { return chunks_w; }
+	int getChunksH() const { return chunks_h; }
+	// Unique for the whole session, it follows the layer when it is moved
+	uint64_t getUID() const { return uid; }
+	uint64_t getRevision() const { return revision; }
+	// Layer revision of the last write to the chunk, 0 if it was never written
+	uint64_t getChunkRevision(size_t chunk_index) const { return chunk_revisions[chunk_index]; }
+
+	PackedTile getPacked(int x, int y) const {
+		const PackedTile* tiles = getChunkTiles(x / CHUNK_SIZE, y / CHUNK_SIZE);
+		return tiles == nullptr ? EMPTY_TILE : tiles[(size_t)(y % CHUNK_SIZE) * CHUNK_SIZE + (x % CHUNK_SIZE)];
+	}
+	Tile get(int x, int y) const { return unpackTile(getPacked(x, y)); }
+	// Returns the tile that was previously stored at (x, y)
+	PackedTile set(int x, int y, PackedTile tile);
+	PackedTile set(int x, int y, const Tile& tile) { return set(x, y, packTile(tile)); }
+
+	// f(x, tile) for the cells [x1, x2] of row y, one chunk at a time
+	template<typename Func>
+	void readSpan(int y, int x1, int x2, Func&& f) const {
+		for (int chunk_x = x1 / CHUNK_SIZE; chunk_x <= x2 / CHUNK_SIZE; chunk_x++) {
+			const PackedTile* tiles = getChunkTiles(chunk_x, y / CHUNK_SIZE);
+			int
+				start = std::max(x1, chunk_x * CHUNK_SIZE),
+				end = std::min(x2, chunk_x * CHUNK_SIZE + CHUNK_SIZE - 1);
+			if (tiles == nullptr) {
+				for (int x = start; x <= end; x++)
+					f(x, EMPTY_TILE);
+				continue;
+			}
+			const PackedTile* row = &tiles[(size_t)(y % CHUNK_SIZE) * CHUNK_SIZE];
+			for (int x = start; x <= end; x++)
+				f(x, row[x % CHUNK_SIZE]);
+		}
+	}
+
+	/*
+	* Writes value(x) to the cells [x1, x2] of row y, one chunk at a time.
+	* on_changed(x, previous) is called for every cell whose tile changed.
+	*/
+	template<typename Value, typename OnChanged>
+	void setSpan(int y, int x1, int x2, Value&& value, OnChanged&& on_changed) {
+		for (int chunk_x = x1 / CHUNK_SIZE; chunk_x <= x2 / CHUNK_SIZE; chunk_x++) {
+			size_t chunk_index = (size_t)(y / CHUNK_SIZE) * chunks_w + chunk_x;
+			std::shared_ptr<TileChunk>& chunk = chunks[chunk_index];
+			int
+				start = std::max(x1, chunk_x * CHUNK_SIZE),
+				end = std::min(x2, chunk_x * CHUNK_SIZE + CHUNK_SIZE - 1);
+			if (chunk != nullptr)
+				unshare(chunk_index);
+			else if (!materialize(chunk_index)) {
+				// Clearing cells of an empty chunk doesn't need any allocation
+				bool writes_tiles = false;
+				for (int x = start; x <= end && !writes_tiles; x++)
+					writes_tiles = (value(x) != EMPTY_TILE);
+				if (!writes_tiles)
+					continue;
+				chunk = std::make_shared<TileChunk>();
+				TRACE_COUNT(TraceCounter::CHUNK_ALLOCATIONS, 1);
+			}
+
+			PackedTile* row = &chunk->tiles[(size_t)(y % CHUNK_SIZE) * CHUNK_SIZE];
+			for (int x = start; x <= end; x++) {
+				PackedTile tile = value(x);
+				PackedTile previous = row[x % CHUNK_SIZE];
+				if (previous == tile)
+					continue;
+				row[x % CHUNK_SIZE] = tile;
+				chunk->used += (tile != EMPTY_TILE) - (previous != EMPTY_TILE);
+				if (previous != EMPTY_TILE)
+					removeUsage(previous, chunk_index);
+				if (tile != EMPTY_TILE)
+					addUsage(tile, chunk_index);
+				chunk_revisions[chunk_index] = revision + 1;
+				on_changed(x, previous);
+			}
+
+			if (chunk_revisions[chunk_index] > revision)
+				revision++;
+			if (chunk->used == 0)
+				releaseChunk(chunk_index);
+		}
+	}
+
+	// CHUNK_AREA tiles, row by row, or nullptr if the chunk is entirely empty
+	const PackedTile* getChunkTiles(int chunk_x, int chunk_y) const {
+		size_t index = (size_t)chunk_y * chunks_w + chunk_x;
+		const TileChunk* chunk = chunks[index].get();
+		if (chunk != nullptr)
+			return chunk->tiles.data();
+		return mapped.empty() ? nullptr : mapped[index];
+	}
+	// Frees the chunk if all of its tiles have been cleared
+	void releaseIfEmpty(int chunk_x, int chunk_y);
+	// Chunks held in memory, mapped chunks that were never written aren't counted
+	size_t allocatedChunks() const;
+	// Number of tiles of this layer using the texture
+	size_t textureUsage(int texture_id) const { return texture_tiles[texture_id]; }
+
+	// f(chunk_x, chunk_y, const PackedTile* tiles) is called for every non-empty chunk
+	template<typename Func>
+	void forEachChunk(Func&& f) const {
+		for (int cy = 0; cy < chunks_h; cy++) for (int cx = 0; cx < chunks_w; cx++) {
+			const PackedTile* tiles = getChunkTiles(cx, cy);
+			if (tiles != nullptr)
+				f(cx, cy, tiles);
+		}
+	}
+
+	/*
+	* Points the chunks to their tiles in a mapped file, owner keeps the mapping alive.
+	* In-memory copies of the chunks found in the file are dropped, so their content has to match.
+	*/
+	void mapChunks(std::shared_ptr<const void> owner, std::vector<const PackedTile*>&& tiles);
+	const void* getMappingOwner() const { return mapping.get(); }
+	// Where the chunk is (or was, before being copied to memory) in the mapped file, nullptr if it isn't in it
+	const PackedTile* getMappedTiles(size_t chunk_index) const { return mapped.empty() ? nullptr : mapped[chunk_index]; }
+	// Written since it was mapped, or not coming from a mapped file
+	bool isChunkInMemory(size_t chunk_index) const { return chunks[chunk_index] != nullptr; }
+	// Per-chunk tile counts of a texture (empty if the texture isn't used), saved along with mapped chunks
+	const std::vector<uint16_t>& getTextureChunkCounts(int texture_id) const { return texture_chunks[texture_id]; }
+	void setTextureChunkCounts(int texture_id, std::vector<uint16_t>&& counts);
+
+	/*
+	* Clears the tiles of a texture for which predicate(tile) is true, visiting only the chunks that use it.
+	* on_removed(x, y, tile) is called for every cleared tile.
+	*/
+	template<typename Pred, typename OnRemoved>
+	void removeTextureTiles(int texture_id, Pred&& predicate, OnRemoved&& on_removed) {
+		std::vector<uint16_t>& counts = texture_chunks[texture_id];
+		for (size_t index = 0; index < counts.size() && texture_tiles[texture_id] > 0; index++) {
+			if (counts[index] == 0)
+				continue;
+
+			if (chunks[index] == nullptr) {
+				// The counts of a mapped file may have been wrong, materialize() corrects them
+				if (!materialize(index)) {
+					texture_tiles[texture_id] -= counts[index];
+					counts[index] = 0;
+					continue;
+				}
+				if (counts.empty() || counts[index] == 0) {
+					if (chunks[index]->used == 0)
+						releaseChunk(index);
+					continue;
+				}
+			}
+			else
+				unshare(index);
+			TileChunk& chunk = *chunks[index];
+			int
+				chunk_x = (int)(index % chunks_w),
+				chunk_y = (int)(index / chunks_w);
+			for (size_t i = 0; i < chunk.tiles.size() && counts[index] > 0; i++) {
+				PackedTile tile = chunk.tiles[i];
+				if (tile == EMPTY_TILE || packedTextureID(tile) != texture_id || !predicate(tile))
+					continue;
+				chunk.tiles[i] = EMPTY_TILE;
+				chunk.used--;
+				counts[index]--;
+				texture_tiles[texture_id]--;
+				chunk_revisions[index] = revision + 1;
+				on_removed(chunk_x * CHUNK_SIZE + (int)(i % CHUNK_SIZE), chunk_y * CHUNK_SIZE + (int)(i / CHUNK_SIZE), tile);
+			}
+
+			if (chunk_revisions[index] > revision)
+				revision++;
+			if (chunk.used == 0)
+				releaseChunk(index);
+		}
+
+		if (texture_tiles[texture_id] == 0)
+			counts = std::vector<uint16_t>();
+	}
+
+private:
+	// Copies a mapped chunk to memory before its first write, returns false if it isn't mapped
+	bool materialize(size_t chunk_index) {
+		const PackedTile* tiles = getMappedTiles(chunk_index);
+		if (tiles == nullptr)
+			return false;
+		std::shared_ptr<TileChunk>& chunk = chunks[chunk_index];
+		chunk = std::make_shared<TileChunk>();
+		std::copy(tiles, tiles + CHUNK_AREA, chunk->tiles.begin());
+		// The file isn't trusted: tiles of textures out of range are dropped,
+		// and the usage counts it gave for this chunk are replaced by the actual ones
+		std::array<uint16_t, MAX_TEXTURES> usage{};
+		for (PackedTile& tile : chunk->tiles) {
+			if (tile == EMPTY_TILE)
+				continue;
+			int texture_id = packedTextureID(tile);
+			if (texture_id < 0 || texture_id >= MAX_TEXTURES)
+				tile = EMPTY_TILE;
+			else
+				usage[texture_id]++;
+		}
+		for (int texture_id = 0; texture_id < MAX_TEXTURES; texture_id++) {
+			std::vector<uint16_t>& counts = texture_chunks[texture_id];
+			uint16_t stored = (counts.empty() ? 0 : counts[chunk_index]);
+			if (stored == usage[texture_id])
+				continue;
+			if (counts.empty())
+				counts.resize(chunks.size(), 0);
+			counts[chunk_index] = usage[texture_id];
+			texture_tiles[texture_id] = texture_tiles[texture_id] - stored + usage[texture_id];
+			if (texture_tiles[texture_id] == 0)
+				counts = std::vector<uint16_t>();
+		}
+		chunk->used = (int)(CHUNK_AREA - std::count(chunk->tiles.begin(), chunk->tiles.end(), EMPTY_TILE));
+		TRACE_COUNT(TraceCounter::CHUNK_ALLOCATIONS, 1);
+		return true;
+	}
+	// Copies the chunk if a snapshot still uses it, before writing to it
+	void unshare(size_t chunk_index) {
+		std::shared_ptr<TileChunk>& chunk = chunks[chunk_index];
+		if (chunk.use_count() > 1) {
+			chunk = std::make_shared<TileChunk>(*chunk);
+			TRACE_COUNT(TraceCounter::CHUNK_ALLOCATIONS, 1);
+		}
+		else {
+			// Snapshots only ever drop their reference, this orders their last reads before our writes
+			std::atomic_thread_fence(std::memory_order_acquire);
+		}
+	}
+	// The chunk became empty, its place in the mapped file is forgotten as well
+	void releaseChunk(size_t chunk_index) {
+		chunks[chunk_index].reset();
+		if (!mapped.empty())
+			mapped[chunk_index] = nullptr;
+	}
+	void addUsage(PackedTile tile, size_t chunk_index) {
+		int texture_id = packedTextureID(tile);
+		std::vector<uint16_t>& counts = texture_chunks[texture_id];
+		if (counts.empty())
+			counts.resize(chunks.size(), 0);
+		counts[chunk_index]++;
+		texture_tiles[texture_id]++;
+	}
+	void removeUsage(PackedTile tile, size_t chunk_index) {
+		int texture_id = packedTextureID(tile);
+		texture_chunks[texture_id][chunk_index]--;
+		if (--texture_tiles[texture_id] == 0)
+			texture_chunks[texture_id] = std::vector<uint16_t>();
+	}
+};
+
+#endif
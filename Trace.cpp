@@ -0,0 +1,122 @@
+#include "Trace.h"
+#include <cstdio>
+#include <iostream>
+#include <set>
+
+namespace {
+	const char* counter_names[(size_t)TraceCounter::COUNT] = {
+		"Tiles drawn",
+		"Textures bound",
+		"Chunk allocations"
+	};
+
+	// Small ids are easier to read in the viewer than native thread ids
+	uint32_t threadIndex() {
+		static std::atomic<uint32_t> next{ 0 };
+		thread_local uint32_t index = next.fetch_add(1, std::memory_order_relaxed);
+		return index;
+	}
+
+	void writeEscaped(FILE* file, const char* text) {
+		for (const char* c = text; *c != '\0'; c++) {
+			if (*c == '"' || *c == '\\')
+				fputc('\\', file);
+			fputc(*c, file);
+		}
+	}
+}
+
+Tracer& Tracer::get() {
+	static Tracer tracer;
+	return tracer;
+}
+
+void Tracer::start(const std::string& output_path) {
+	std::lock_guard<std::mutex> lock(flush_mutex);
+	if (slots == nullptr)
+		slots = std::make_unique<Slot[]>(TRACE_RING_SIZE);
+	path = output_path;
+	origin = std::chrono::steady_clock::now();
+	// The main thread gets id 0
+	threadIndex();
+	enabled.store(true, std::memory_order_release);
+}
+
+uint64_t Tracer::now() const {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void Tracer::emit(char phase, const char* name, uint64_t timestamp_ns, uint64_t value) {
+	uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+	Slot& slot = slots[index & (TRACE_RING_SIZE - 1)];
+	slot.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.timestamp_ns.store(timestamp_ns, std::memory_order_relaxed);
+	slot.value.store(value, std::memory_order_relaxed);
+	slot.thread.store(threadIndex(), std::memory_order_relaxed);
+	slot.phase.store(phase, std::memory_order_relaxed);
+	slot.sequence.store(index + 1, std::memory_order_release);
+}
+
+void Tracer::endFrame() {
+	uint64_t timestamp = now();
+	for (size_t i = 0; i < counters.size(); i++)
+		emit('C', counter_names[i], timestamp, counters[i].exchange(0, std::memory_order_relaxed));
+}
+
+bool Tracer::flush() {
+	if (!isEnabled())
+		return false;
+	std::lock_guard<std::mutex> lock(flush_mutex);
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		std::cout << "Failed to open " << path << std::endl;
+		return false;
+	}
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+	bool first = true;
+	std::set<uint32_t> threads;
+	uint64_t end = head.load(std::memory_order_acquire);
+	uint64_t begin = (end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0);
+	for (uint64_t index = begin; index < end; index++) {
+		Slot& slot = slots[index & (TRACE_RING_SIZE - 1)];
+		if (slot.sequence.load(std::memory_order_acquire) != index + 1)
+			continue;
+		const char* name = slot.name.load(std::memory_order_relaxed);
+		uint64_t timestamp = slot.timestamp_ns.load(std::memory_order_relaxed);
+		uint64_t value = slot.value.load(std::memory_order_relaxed);
+		uint32_t thread = slot.thread.load(std::memory_order_relaxed);
+		char phase = slot.phase.load(std::memory_order_relaxed);
+		// Overwritten by a writer while it was being read
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.sequence.load(std::memory_order_relaxed) != index + 1)
+			continue;
+
+		fputs(first ? "" : ",\n", file);
+		first = false;
+		fputs("{\"name\":\"", file);
+		writeEscaped(file, name);
+		fprintf(file, "\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f", phase, thread, timestamp / 1000.0);
+		if (phase == 'X')
+			fprintf(file, ",\"dur\":%.3f}", value / 1000.0);
+		else
+			fprintf(file, ",\"args\":{\"value\":%llu}}", (unsigned long long)value);
+		threads.insert(thread);
+	}
+
+	for (uint32_t thread : threads) {
+		std::string name = (thread == 0 ? "Main" : "Worker " + std::to_string(thread));
+		fputs(first ? "" : ",\n", file);
+		first = false;
+		fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", thread, name.c_str());
+	}
+	fputs("\n]}\n", file);
+
+	bool success = (ferror(file) == 0);
+	success = (fclose(file) == 0) && success;
+	if (!success)
+		std::cout << "Failed to write " << path << std::endl;
+	return success;
+}
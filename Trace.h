@@ -0,0 +1,93 @@
+#ifndef TILEMAPEDITOR_TRACE_H
+#define TILEMAPEDITOR_TRACE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Events kept in memory, older ones are overwritten (power of two)
+constexpr size_t TRACE_RING_SIZE{ 1 << 18 };
+
+enum class TraceCounter {
+	TILES_DRAWN,
+	TEXTURES_BOUND,
+	CHUNK_ALLOCATIONS,
+	COUNT
+};
+
+/*
+* Session tracer writing the Chrome trace JSON format (chrome://tracing, ui.perfetto.dev).
+* It is enabled at runtime with --trace <file>, and while disabled every TRACE_* macro costs one relaxed load.
+*
+* Spans and counters can be emitted from any thread without locking:
+* a writer claims a slot of the ring with fetch_add and publishes it with a sequence number,
+* flush() skips the slots whose sequence changed while they were being read.
+*/
+class Tracer {
+	struct Slot {
+		// Index of the event + 1, 0 while it is being written
+		std::atomic<uint64_t> sequence{ 0 };
+		std::atomic<const char*> name{ nullptr };
+		std::atomic<uint64_t> timestamp_ns{ 0 };
+		// Duration of spans, value of counters
+		std::atomic<uint64_t> value{ 0 };
+		std::atomic<uint32_t> thread{ 0 };
+		std::atomic<char> phase{ 0 };
+	};
+
+	static inline std::atomic<bool> enabled{ false };
+	std::unique_ptr<Slot[]> slots{};
+	std::atomic<uint64_t> head{ 0 };
+	std::array<std::atomic<uint64_t>, (size_t)TraceCounter::COUNT> counters{};
+	std::chrono::steady_clock::time_point origin{};
+	std::string path{};
+	// Only taken by flush(), writers never lock
+	std::mutex flush_mutex{};
+
+public:
+	static Tracer& get();
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	// Starts recording, the events are written to path by flush()
+	void start(const std::string& output_path);
+	// Nanoseconds since start()
+	uint64_t now() const;
+	void span(const char* name, uint64_t start_ns, uint64_t end_ns) { emit('X', name, start_ns, end_ns - start_ns); }
+	void count(TraceCounter counter, uint64_t amount) { counters[(size_t)counter].fetch_add(amount, std::memory_order_relaxed); }
+	// Emits the counters accumulated since the last call, called once per frame
+	void endFrame();
+	// Writes the events still in the ring, returns false if the file couldn't be written
+	bool flush();
+
+private:
+	void emit(char phase, const char* name, uint64_t timestamp_ns, uint64_t value);
+};
+
+class TraceScope {
+	const char* name;
+	uint64_t start{ 0 };
+	bool active;
+
+public:
+	TraceScope(const char* name_) : name(name_), active(Tracer::isEnabled()) {
+		if (active)
+			start = Tracer::get().now();
+	}
+	~TraceScope() {
+		if (active)
+			Tracer::get().span(name, start, Tracer::get().now());
+	}
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// name must outlive the trace, i.e. be a string literal
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_COUNT(counter, amount) do { if (Tracer::isEnabled()) Tracer::get().count(counter, amount); } while (0)
+#define TRACE_FRAME() do { if (Tracer::isEnabled()) Tracer::get().endFrame(); } while (0)
+
+#endif
@@ -1,17 +1,51 @@
 #include "chomusuke/infrastructure.h"
 #include "tilemapeditor.h"
+#include "Benchmark.h"
+#include "Replay.h"
+#include "Batch.h"
 #undef main
 
 
 constexpr int window_w = 1800;
 constexpr int window_h = 800;
 
-int main() {
+int main(int argc, char* argv[]) {
+	BatchOptions batch_options;
+	std::string batch_error;
+	if (parseBatchArgs(argc, argv, batch_options, batch_error)) {
+		if (!batch_error.empty()) {
+			std::cout << batch_error << std::endl;
+			return 2;
+		}
+		return runBatch(batch_options);
+	}
+	BenchmarkOptions bench_options;
+	if (parseBenchmarkArgs(argc, argv, bench_options))
+		return runBenchmarks(bench_options);
+	ReplayOptions replay_options;
+	if (parseReplayArgs(argc, argv, replay_options))
+		return runReplay(replay_options);
+
 	cho::LoopManager manager;
 	manager.init("Tilemap Editor", 100, 100, window_w, window_h, {10, 2, 2, 255}, SDL_WINDOW_SHOWN, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC, SDL_BLENDMODE_BLEND);
 	auto data = std::make_shared<TileMapStartupData>();
 	data->window_w = window_w;
 	data->window_h = window_h;
+	for (int i = 1; i + 1 < argc; i++) {
+		std::string arg(argv[i]);
+		if (arg == "--trace")
+			data->trace_path = argv[i + 1];
+		else if (arg == "--record")
+			data->record_path = argv[i + 1];
+		else if (arg == "--autosave-interval")
+			data->autosave.interval_s = std::atoi(argv[i + 1]);
+		else if (arg == "--autosave-keep")
+			data->autosave.kept = std::atoi(argv[i + 1]);
+		else if (arg == "--autosave-dir")
+			data->autosave.directory = argv[i + 1];
+		else if (arg == "--journal")
+			data->journal = (std::string(argv[i + 1]) != "off");
+	}
 	manager.executeScene(std::make_shared<TileMapEditor>(), data);
 	return 0;
 }
@@ -1,4 +1,5 @@
 #include "tilemapeditor.h"
+#include "Profiler.h"
 
 
 void TileMapEditor::start(std::shared_ptr<void> data, cho::SDLPointers pointers) {
@@ -16,6 +17,7 @@ void TileMapEditor::start(std::shared_ptr<void> data, cho::SDLPointers pointers)
 	ImGui_ImplSDL2_InitForSDLRenderer(pointers.window, pointers.renderer);
 	ImGui_ImplSDLRenderer2_Init(pointers.renderer);
 	io->ConfigWindowsMoveFromTitleBarOnly = true;
+	renderer = pointers.renderer;
 
 	if (data == nullptr) {
 		std::cerr << "Startup data not specified" << std::endl;
@@ -25,6 +27,23 @@ void TileMapEditor::start(std::shared_ptr<void> data, cho::SDLPointers pointers)
 	start_data = std::static_pointer_cast<TileMapStartupData>(data);
 	window_w = start_data->window_w;
 	window_h = start_data->window_h;
+	idle_mode = start_data->idle;
+	if (!start_data->trace_path.empty())
+		Tracer::get().start(start_data->trace_path);
+	if (!start_data->record_path.empty())
+		input_recorder.open(start_data->record_path, window_w, window_h);
+	autosave_options = start_data->autosave;
+	autosaver.start();
+	if (start_data->journal) {
+		std::string directory = autosaveDirectory(autosave_options);
+		std::string error;
+		if (!findCrashedJournal(directory, crashed_journal, crashed_journal_files, error) && !error.empty()) {
+			// Nothing left to replay the journal on
+			std::cout << "Journal: " << error << std::endl;
+			discardCrashedJournal();
+		}
+		journal.open(directory);
+	}
 
 	auto nothing = [](){};
 	auto always = []() {return true; };
@@ -97,7 +116,16 @@ void TileMapEditor::start(std::shared_ptr<void> data, cho::SDLPointers pointers)
 }
 
 void TileMapEditor::init_viewport() {
+	// Entries refer to the areas being destroyed
+	history.clear();
+	native_file.reset();
+	tmx_cache.clear();
+	map_path.clear();
+	untitled_id = makeUntitledID();
+	autosaver.reset();
+	autosave_elapsed = 0;
 	if (edit_area != nullptr) {
+		edit_area->destroy();
 		edit_area.reset();
 	}
 	if (palette_area != nullptr) {
@@ -118,32 +146,63 @@ void TileMapEditor::init_viewport() {
 	palette_area->line_color = { 50, 50, 50, 255 };
 	palette_area->setCameraPosition({ -1, 0 });
 	palette_area->editOnCloseTexture =
-		[this](int id) {this->edit_area->onDeleteTexture(id); };
-	palette_area->editOnReplaceRemoveTiles =
-		[this](int id, int max_x, int max_y)
+		[this](int id, Texture texture) {this->onDeleteTexture(id, texture); };
+	palette_area->editOnAddTexture =
+		[this](int id) {this->onAddTexture(id); };
+	palette_area->textureUsage =
+		[this](int id) {return this->edit_area->textureUsage(id); };
+	palette_area->editOnReplaceTexture =
+		[this](int id, Texture old_texture, int max_x, int max_y)
 	{
-		this->edit_area->editOnReplaceRemoveTiles(id, max_x, max_y);
+		this->onReplaceTexture(id, old_texture, max_x, max_y);
 	};
 
 	inspector_area = std::make_unique<InspectorArea>();
 	inspector_area->on_add_layer = [this]() {this->edit_area->onAddLayer(); };
 	inspector_area->on_delete_layer = [this](int layer) {this->edit_area->onDeleteLayer(layer); };
 	inspector_area->on_swap = [this](int a, int b) {this->edit_area->onSwap(a, b);  };
+	// The first layer isn't undoable
 	inspector_area->addNewLayer();
+	inspector_area->on_add_layer = [this]() {this->onAddLayer(); };
+	inspector_area->on_delete_layer = [this](int layer) {this->onDeleteLayer(layer); };
+	inspector_area->on_swap = [this](int a, int b) {this->onSwapLayers(a, b); };
+	inspector_area->on_brush_changed = [this](int brush) {
+		// The floating block only exists for the select brush
+		if (brush != BRUSH_SELECT)
+			edit_area->cancelFloating();
+		edit_area->selected_brush = brush;
+	};
+	inspector_area->on_layer_changed = [this](int layer) {
+		journal.recordLayerProperties(layer, inspector_area->layer_names[layer], inspector_area->visible_layers[layer].visible);
+	};
 	inspector_area->io = io;
+	inspector_area->autosave_interval_s = autosave_options.interval_s;
+	inspector_area->autosaves_kept = autosave_options.kept;
+
+	edit_area->on_edit = [this](TileDelta&& delta) {this->pushTileEdit(std::move(delta)); };
 
 	edit_area->visibles = &inspector_area->visible_layers;
 }
 
 
 void TileMapEditor::processEvent(const SDL_Event& event) {
+	TRACE_SCOPE("Event");
+	input_recorder.record(event);
 	ImGui_ImplSDL2_ProcessEvent(&event);
+	requestRedraw();
 	if (event.type == SDL_QUIT) 
 		running = false;
 	
 	if (event.type == SDL_MOUSEMOTION) {
 		mouse.motion.x = event.motion.xrel;
 		mouse.motion.y = event.motion.yrel;
+
+		// Every motion event extends the stroke, so fast strokes don't leave gaps between frames
+		bool stroking = (fsm.getCurState() == UC_States::EDIT_DRAGGING_LEFT || fsm.getCurState() == UC_States::EDIT_DRAGGING_RIGHT);
+		if (stroking && allow_input_to_canvas && edit_area != nullptr)
+			edit_area->onStrokeTo(
+				edit_area->screenToTile(event.motion.x, event.motion.y),
+				fsm.getCurState() == UC_States::EDIT_DRAGGING_RIGHT);
 	}
 	if (event.type == SDL_MOUSEBUTTONDOWN) {
 		switch (event.button.button) {
@@ -197,9 +256,74 @@ void TileMapEditor::processEvent(const SDL_Event& event) {
 
 	if (event.type == SDL_MOUSEWHEEL)
 		mouse.wheel_motion = event.wheel.y;
+
+	if (event.type == SDL_KEYDOWN && (event.key.keysym.mod & KMOD_CTRL) && !io->WantTextInput) {
+		bool shift = (event.key.keysym.mod & KMOD_SHIFT);
+		if (event.key.keysym.sym == SDLK_z && !shift)
+			undo();
+		else if (event.key.keysym.sym == SDLK_y || (event.key.keysym.sym == SDLK_z && shift))
+			redo();
+	}
+	if (event.type == SDL_KEYDOWN && !io->WantTextInput)
+		processClipboardKey(event.key.keysym);
+}
+
+void TileMapEditor::processClipboardKey(const SDL_Keysym& key) {
+	if (edit_area == nullptr || fsm.getCurState() != UC_States::DEFAULT || !allow_input_to_canvas)
+		return;
+
+	bool
+		ctrl = (key.mod & KMOD_CTRL),
+		shift = (key.mod & KMOD_SHIFT);
+	if (ctrl) {
+		switch (key.sym) {
+		case SDLK_c: edit_area->copySelection(); break;
+		case SDLK_x: edit_area->cutSelection(); break;
+		case SDLK_v: startPaste(); break;
+		case SDLK_m: startMove(); break;
+		}
+		return;
+	}
+
+	// Bare keys would otherwise act on a stale marquee while painting
+	if (edit_area->selected_brush != BRUSH_SELECT)
+		return;
+	switch (key.sym) {
+	case SDLK_x: edit_area->flipClipboard(true); break;
+	case SDLK_y: edit_area->flipClipboard(false); break;
+	case SDLK_z: edit_area->rotateClipboard(!shift); break;
+	case SDLK_DELETE: edit_area->deleteSelection(); break;
+	case SDLK_ESCAPE:
+		if (edit_area->isFloating())
+			edit_area->cancelFloating();
+		else
+			edit_area->deselect();
+		break;
+	}
+}
+
+void TileMapEditor::startPaste() {
+	if (edit_area == nullptr || !edit_area->hasClipboard())
+		return;
+	inspector_area->selected_brush = BRUSH_SELECT;
+	edit_area->selected_brush = BRUSH_SELECT;
+	edit_area->pasteClipboard();
+}
+
+void TileMapEditor::startMove() {
+	if (edit_area == nullptr || !edit_area->hasMarquee())
+		return;
+	inspector_area->selected_brush = BRUSH_SELECT;
+	edit_area->selected_brush = BRUSH_SELECT;
+	edit_area->moveSelection();
 }
 
 void TileMapEditor::update(float delta) {
+	PROFILE_FRAME();
+	PROFILE_SCOPE("Update");
+	TRACE_FRAME();
+	TRACE_SCOPE("Update");
+	input_recorder.endFrame(frame_index++, delta);
 	ImGui_ImplSDLRenderer2_NewFrame();
 	ImGui_ImplSDL2_NewFrame();
 	ImGui::NewFrame();
@@ -209,15 +333,75 @@ void TileMapEditor::update(float delta) {
 			if (ImGui::MenuItem("New...")) {
 				creating_new = true;
 			}
+			if (ImGui::MenuItem("Open...")) {
+				nfdchar_t* open_path = nullptr;
+				nfdresult_t result = NFD_OpenDialog("tmx,tmb", nullptr, &open_path);
+				if (result == NFD_OKAY) {
+					std::string path(open_path);
+					if (path.ends_with(NATIVE) ? openNative(path) : openTMX(path))
+						creating_new = false;
+					free(open_path);
+				}
+				else if (result != NFD_CANCEL)
+					std::cout << "Error: " << NFD_GetError() << std::endl;
+			}
 			if(!creating_new && ImGui::MenuItem("Save...")){
 				saving = true;
 			}
+			if (Tracer::isEnabled() && ImGui::MenuItem("Write trace"))
+				Tracer::get().flush();
 
 			ImGui::EndMenu();
 		}
+		if (edit_area != nullptr && ImGui::BeginMenu("Edit")) {
+			if (ImGui::MenuItem("Undo", "Ctrl+Z", false, history.canUndo()))
+				undo();
+			if (ImGui::MenuItem("Redo", "Ctrl+Y", false, history.canRedo()))
+				redo();
+			ImGui::Separator();
+			bool has_marquee = edit_area->hasMarquee();
+			if (ImGui::MenuItem("Copy", "Ctrl+C", false, has_marquee))
+				edit_area->copySelection();
+			if (ImGui::MenuItem("Cut", "Ctrl+X", false, has_marquee))
+				edit_area->cutSelection();
+			if (ImGui::MenuItem("Paste", "Ctrl+V", false, edit_area->hasClipboard()))
+				startPaste();
+			if (ImGui::MenuItem("Move selection", "Ctrl+M", false, has_marquee))
+				startMove();
+			if (ImGui::MenuItem("Delete selection", "Del", false, has_marquee))
+				edit_area->deleteSelection();
+			ImGui::Separator();
+			bool can_transform = edit_area->hasClipboard() || edit_area->isFloating();
+			if (ImGui::MenuItem("Flip horizontally", "X", false, can_transform))
+				edit_area->flipClipboard(true);
+			if (ImGui::MenuItem("Flip vertically", "Y", false, can_transform))
+				edit_area->flipClipboard(false);
+			if (ImGui::MenuItem("Rotate clockwise", "Z", false, can_transform))
+				edit_area->rotateClipboard(true);
+			if (ImGui::MenuItem("Rotate counterclockwise", "Shift+Z", false, can_transform))
+				edit_area->rotateClipboard(false);
+			ImGui::EndMenu();
+		}
 		ImGui::EndMainMenuBar();
 	}
 
+	if (!crashed_journal.empty()) {
+		ImGui::Begin("Recover unsaved work", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoCollapse);
+		ImGui::SetWindowPos({ (float)window_w / 3, (float)window_h / 3 }, ImGuiCond_Once);
+		ImGui::Text("The editor didn't close properly, its last edits were journaled.");
+		const JournalBase& base = crashed_journal.front().base;
+		if (base.kind == JournalBaseKind::NEW_MAP)
+			ImGui::Text("Map: new %dx%d map", base.width, base.height);
+		else
+			ImGui::Text("Map: %s", base.path.c_str());
+		if (ImGui::Button("Recover"))
+			recoverJournal();
+		ImGui::SameLine();
+		if (ImGui::Button("Discard"))
+			discardCrashedJournal();
+		ImGui::End();
+	}
+
 	if (creating_new) {
 		ImGui::Begin("Create a new tilemap", &creating_new, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoCollapse);
 		ImGui::SetWindowPos({ (float)window_w / 2, (float)window_h / 2 }, ImGuiCond_Once);
@@ -233,6 +417,7 @@ void TileMapEditor::update(float delta) {
 				map_h = std::stoi(s_height);
 				init_viewport();
 				creating_new = false;
+				rotateJournal(JournalBaseKind::NEW_MAP, "");
 			}
 			catch (std::invalid_argument ex) {
 				std::cout << "Conversion error" << std::endl;;
@@ -249,7 +434,7 @@ void TileMapEditor::update(float delta) {
 		ImGui::Separator();
 		ImGui::NewLine();
 		if (ImGui::BeginCombo("format", cur_format.c_str())) {
-			for (std::string format : {TMX, PNG}) {
+			for (std::string format : {TMX, NATIVE, PNG}) {
 				const bool selected = (cur_format == format);
 				if (ImGui::Selectable(format.c_str(), &selected))
 					cur_format = format;
@@ -261,31 +446,35 @@ void TileMapEditor::update(float delta) {
 			ImGui::EndCombo();
 		}
 
+		if (cur_format == TMX && ImGui::BeginCombo("encoding", tmx_encoding_names.at(cur_encoding).c_str())) {
+			for (const auto& [encoding, name] : tmx_encoding_names) {
+				const bool selected = (cur_encoding == encoding);
+				if (ImGui::Selectable(name.c_str(), selected))
+					cur_encoding = encoding;
+				if (selected)
+					ImGui::SetItemDefaultFocus();
+			}
+			ImGui::EndCombo();
+		}
+
 		if (ImGui::Button("Proceed")) {
 			nfdchar_t* save_path = nullptr;
-			nfdresult_t result = NFD_SaveDialog("", nullptr, &save_path);
+			nfdresult_t result = NFD_SaveDialog(cur_format.substr(1).c_str(), nullptr, &save_path);
 			if (result == NFD_OKAY) {
-				std::cout << "Save path: " << std::string(save_path) << cur_format << std::endl;
-				
-				tinyxml2::XMLDocument doc;
-				tinyxml2::XMLDeclaration* decl = doc.NewDeclaration();
-				doc.InsertFirstChild(decl);
-
-				tinyxml2::XMLElement* root_ptr = doc.NewElement("map");
-				root_ptr->SetAttribute("version", "1.10");
-				root_ptr->SetAttribute("tiledversion", "1.10.1");
-				root_ptr->SetAttribute("orientation", "orthogonal");
-				root_ptr->SetAttribute("renderorder", "right-down");
-				root_ptr->SetAttribute("width", map_w);
-				root_ptr->SetAttribute("height", map_h);
-				root_ptr->SetAttribute("tilewidth", tile_size);
-				root_ptr->SetAttribute("tileheight", tile_size);
-				root_ptr->SetText("\n");
-				doc.InsertEndChild(root_ptr);
-
-				palette_area->saveTextureToTMX(doc, root_ptr);
-
-				doc.SaveFile("test.xml");
+				std::string path(save_path);
+				if (!path.ends_with(cur_format))
+					path += cur_format;
+				std::cout << "Save path: " << path << std::endl;
+
+				bool success = false;
+				if (cur_format == TMX)
+					success = saveTMX(path);
+				else if (cur_format == NATIVE)
+					success = saveNative(path);
+				else
+					success = savePNG(path);
+				if (!success)
+					std::cout << "Save error" << std::endl;
 				free(save_path);
 			}
 			else if (result == NFD_CANCEL) 
@@ -302,6 +491,12 @@ void TileMapEditor::update(float delta) {
 	if (edit_area == nullptr || palette_area == nullptr) 
 		return;
 	allow_input_to_canvas = palette_area->allowControl() && inspector_area->allowControl();
+	history.setMemoryBudget((size_t)inspector_area->history_budget_mb << 20);
+	inspector_area->history_memory_used = history.getMemoryUsed();
+	autosave_options.interval_s = inspector_area->autosave_interval_s;
+	autosave_options.kept = inspector_area->autosaves_kept;
+	updateAutosave(delta);
+	inspector_area->autosave_status = autosaver.getStatus();
 
 	// Interpret mouse motion
 	if (allow_input_to_canvas) {
@@ -328,7 +523,7 @@ void TileMapEditor::update(float delta) {
 		}
 
 		// Mouse wheel
-		float scale_multiplier = 1.0f - (mouse.wheel_motion * delta * wheel_speed);
+		float scale_multiplier = 1.0f - (mouse.wheel_motion * std::min(delta, MAX_ZOOM_DELTA) * wheel_speed);
 		if (mouse.focused_window == FOCUSED_EDIT)
 			edit_area->view_scale = std::max(0.1f, edit_area->view_scale * scale_multiplier);
 		if (mouse.focused_window == FOCUSED_PALETTE)
@@ -339,37 +534,710 @@ void TileMapEditor::update(float delta) {
 }
 
 void TileMapEditor::draw(cho::SDLPointers pointers) {
+	PROFILE_SCOPE("Draw");
+	TRACE_SCOPE("Draw");
+	bool redraw = active_frames > 0;
 	if (edit_area != nullptr && palette_area != nullptr) {
 		edit_area->selected_layer = inspector_area->selected;
-		edit_area->selection = palette_area->getTileSelection();
+		edit_area->setSelection(palette_area->getTileSelection());
 		edit_area->selected_brush = inspector_area->selected_brush;
-		edit_area_rend = draw_edit_area_texture(pointers.renderer, SDL_PIXELFORMAT_RGBA8888, window_w, window_h, *edit_area, mouse.focused_window, palette_area->getTextures(), inspector_area->visible_layers);
-		select_area_rend = draw_palette_area_texture(pointers.renderer, SDL_PIXELFORMAT_RGBA8888, window_w, window_h, *palette_area, mouse.focused_window);
-		inspector_area_rend = draw_inspector_area_texture(pointers.renderer, SDL_PIXELFORMAT_RGBA8888, window_w, window_h, *inspector_area);
+		draw_edit_area_texture(pointers.renderer, edit_area_target, SDL_PIXELFORMAT_RGBA8888, window_w, window_h, *edit_area, mouse.focused_window, palette_area->getTextures(), inspector_area->visible_layers, redraw);
+		draw_palette_area_texture(pointers.renderer, palette_area_target, SDL_PIXELFORMAT_RGBA8888, window_w, window_h, *palette_area, mouse.focused_window, redraw);
+		draw_inspector_area(window_w, window_h, *inspector_area);
+#ifdef TILEMAPEDITOR_PROFILE
+		if (inspector_area->show_profiler)
+			FrameProfiler::get().drawOverlay(&inspector_area->show_profiler);
+#endif
 	}
 
+	PROFILE_SCOPE("ImGui render");
 	SDL_Color clear_color = start_data->clear_color;
 	ImGui::Render();
 	SDL_RenderSetScale(pointers.renderer, io->DisplayFramebufferScale.x, io->DisplayFramebufferScale.y);
 	SDL_SetRenderDrawColor(pointers.renderer, clear_color.r, clear_color.g, clear_color.b, clear_color.a);
 	ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData());
+#ifdef TILEMAPEDITOR_PROFILE
+	ImDrawData* draw_data = ImGui::GetDrawData();
+	for (int i = 0; i < draw_data->CmdListsCount; i++)
+		PROFILE_COUNT(ProfileCounter::DRAW_CALLS, draw_data->CmdLists[i]->CmdBuffer.Size);
+#endif
 }
 
 void TileMapEditor::lateUpdate(float delta) {
-	SDL_DestroyTexture(edit_area_rend);
-	SDL_DestroyTexture(select_area_rend);
-	SDL_DestroyTexture(inspector_area_rend);
+	if (active_frames > 0) {
+		active_frames--;
+		return;
+	}
+
+	// Keep running while ImGui has a text field focused so that its cursor keeps blinking
+	if (!idle_mode || io->WantTextInput)
+		return;
+
+	// Nothing changed since the last frames: sleep until the next event (without consuming it)
+	SDL_WaitEventTimeout(nullptr, IDLE_WAIT_TIMEOUT_MS);
 }
 
 std::shared_ptr<void> TileMapEditor::processDeath() {
+	input_recorder.close();
+	autosaver.stop();
+	// Nothing to recover after a normal exit
+	journal.close(true);
+	if (Tracer::isEnabled())
+		Tracer::get().flush();
+	// Textures kept alive by the history have to go before the renderer
+	history.clear();
 	if(palette_area)
 		palette_area->destroy();
+	if (edit_area)
+		edit_area->destroy();
+	edit_area_target.destroy();
+	palette_area_target.destroy();
 	ImGui_ImplSDLRenderer2_Shutdown();
 	ImGui_ImplSDL2_Shutdown();
 	ImGui::DestroyContext();
 	return nullptr;
 }
 
+bool TileMapEditor::saveTMX(const std::string& path) {
+	TRACE_SCOPE("Save TMX");
+	if (edit_area == nullptr || palette_area == nullptr || inspector_area == nullptr)
+		return false;
+
+	const std::vector<TileLayer>& layers = edit_area->getLayers();
+	TMXMapInfo info{ .width = map_w, .height = map_h, .tile_size = tile_size, .layer_count = (int)layers.size() };
+	TMXWriter writer(info);
+	std::map<int, TextureData> tilesets = palette_area->saveTextureToTMX(writer.getDocument(), writer.getMapElement());
+	writer.setCache(&tmx_cache);
+	if (!writer.open(path))
+		return false;
+
+	for (size_t layer = 0; layer < layers.size(); layer++) {
+		bool success = writer.writeLayer(
+			(int)layer + 1,
+			inspector_area->layer_names[layer],
+			inspector_area->visible_layers[layer].visible,
+			layers[layer], tilesets, cur_encoding);
+		if (!success)
+			return false;
+	}
+
+	if (!writer.close())
+		return false;
+	map_path = path;
+	rotateJournal(JournalBaseKind::TMX, path);
+	return true;
+}
+
+bool TileMapEditor::savePNG(const std::string& path) {
+	TRACE_SCOPE("Save PNG");
+	if (edit_area == nullptr || palette_area == nullptr || inspector_area == nullptr)
+		return false;
+
+	// Tilesets are decoded again from their files so that the export doesn't depend on the GPU renderer
+	std::map<int, std::string> paths;
+	for (const auto& [id, texture] : palette_area->getTextures())
+		paths[id] = texture.path;
+
+	std::string error;
+	std::map<int, TilesetImage> images;
+	if (!loadTilesetImages(paths, images, error)) {
+		std::cout << error << std::endl;
+		return false;
+	}
+
+	const std::vector<TileLayer>& layers = edit_area->getLayers();
+	std::vector<const TileLayer*> visible_layers;
+	for (size_t layer = 0; layer < layers.size(); layer++)
+		if (inspector_area->visible_layers[layer].visible)
+			visible_layers.push_back(&layers[layer]);
+
+	if (!exportPNG(path, visible_layers, images, tile_size, error)) {
+		std::cout << error << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool TileMapEditor::openTMX(const std::string& path) {
+	TRACE_SCOPE("Open TMX");
+	TMXReader reader;
+	std::string error;
+	if (!reader.open(path, error)) {
+		std::cout << "Open error: " << error << std::endl;
+		return false;
+	}
+	reader.startDecoding();
+
+	// Textures have to be uploaded on the main thread, which happens while the layers are being decoded
+	const std::vector<TMXTileset>& tilesets = reader.getTilesets();
+	std::vector<Texture> textures(tilesets.size());
+	for (size_t id = 0; id < tilesets.size(); id++) {
+		std::filesystem::path image_path(tilesets[id].image_path);
+		textures[id].path = image_path.string();
+		textures[id].name = std::to_string(id) + ". " + image_path.filename().string();
+		textures[id].texture = cho::loadTexture(textures[id].path.c_str(), renderer);
+		if (textures[id].texture == nullptr)
+			std::cout << "Texture allocation failed: " << textures[id].path << std::endl;
+	}
+
+	std::vector<TMXLayer> layers;
+	if (!reader.finishDecoding(layers, error)) {
+		std::cout << "Open error: " << error << std::endl;
+		for (Texture& texture : textures)
+			if (texture.texture != nullptr)
+				SDL_DestroyTexture(texture.texture);
+		return false;
+	}
+
+	const TMXMapInfo& info = reader.getInfo();
+	tile_size = info.tile_size;
+	map_w = info.width;
+	map_h = info.height;
+	init_viewport();
+	map_path = path;
+
+	std::vector<TileLayer> tiles;
+	std::vector<std::string> names;
+	std::vector<bool> visibles;
+	for (TMXLayer& layer : layers) {
+		tiles.push_back(std::move(layer.tiles));
+		names.push_back(layer.name);
+		visibles.push_back(layer.visible);
+	}
+	if (tiles.empty()) {
+		tiles.emplace_back(map_w, map_h);
+		names.push_back("Layer 0");
+		visibles.push_back(true);
+	}
+	edit_area->setLayers(std::move(tiles));
+	inspector_area->setLayers(names, visibles);
+
+	for (size_t id = 0; id < textures.size(); id++) {
+		if (textures[id].texture != nullptr)
+			palette_area->addTexture((int)id, textures[id]);
+		else
+			edit_area->onDeleteTexture((int)id);
+	}
+	// Tilesets keep their index in the file even when their image failed to load
+	std::vector<int> texture_ids(textures.size());
+	for (size_t id = 0; id < textures.size(); id++)
+		texture_ids[id] = (int)id;
+	rotateJournal(JournalBaseKind::TMX, path, std::move(texture_ids));
+	return true;
+}
+
+bool TileMapEditor::saveNative(const std::string& path) {
+	TRACE_SCOPE("Save native");
+	if (edit_area == nullptr || palette_area == nullptr || inspector_area == nullptr)
+		return false;
+
+	NativeMapInfo info{ .width = map_w, .height = map_h, .tile_size = tile_size };
+	info.layer_names = inspector_area->layer_names;
+	for (size_t layer = 0; layer < inspector_area->layer_names.size(); layer++)
+		info.layer_visibles.push_back(inspector_area->visible_layers[(int)layer].visible);
+	for (const auto& [id, texture] : palette_area->getTextures())
+		info.textures.push_back(NativeTexture{ id, texture.name, texture.path });
+
+	// An in-place save overwrites chunks that an autosave snapshot may still be reading
+	autosaver.waitIdle();
+	std::string error;
+	std::vector<std::vector<const PackedTile*>> mapped_chunks;
+	if (!saveNativeMap(path, info, edit_area->getLayers(), native_file, mapped_chunks, error)) {
+		std::cout << "Save error: " << error << std::endl;
+		return false;
+	}
+	// Saved chunks are dropped from memory, they are paged from the new file again
+	edit_area->mapLayers(native_file, std::move(mapped_chunks));
+	map_path = path;
+	rotateJournal(JournalBaseKind::NATIVE, path);
+	return true;
+}
+
+bool TileMapEditor::openNative(const std::string& path) {
+	TRACE_SCOPE("Open native");
+	NativeMapInfo info;
+	std::vector<TileLayer> tiles;
+	std::shared_ptr<MappedFile> file;
+	std::string error;
+	if (!openNativeMap(path, info, tiles, file, error)) {
+		std::cout << "Open error: " << error << std::endl;
+		return false;
+	}
+
+	tile_size = info.tile_size;
+	map_w = info.width;
+	map_h = info.height;
+	init_viewport();
+	native_file = file;
+	map_path = path;
+
+	std::vector<std::string> names = info.layer_names;
+	std::vector<bool> visibles = info.layer_visibles;
+	if (tiles.empty()) {
+		tiles.emplace_back(map_w, map_h);
+		names.push_back("Layer 0");
+		visibles.push_back(true);
+	}
+	edit_area->setLayers(std::move(tiles));
+	inspector_area->setLayers(names, visibles);
+
+	for (const NativeTexture& native : info.textures) {
+		Texture texture;
+		texture.path = native.path;
+		texture.name = native.name;
+		texture.texture = cho::loadTexture(texture.path.c_str(), renderer);
+		if (texture.texture != nullptr)
+			palette_area->addTexture(native.id, texture);
+		else {
+			std::cout << "Texture allocation failed: " << texture.path << std::endl;
+			edit_area->onDeleteTexture(native.id);
+		}
+	}
+	rotateJournal(JournalBaseKind::NATIVE, path);
+	return true;
+}
+
+std::unique_ptr<MapSnapshot> TileMapEditor::takeSnapshot() {
+	TRACE_SCOPE("Snapshot");
+	auto snapshot = std::make_unique<MapSnapshot>();
+	snapshot->width = map_w;
+	snapshot->height = map_h;
+	snapshot->tile_size = tile_size;
+	for (const TileLayer& layer : edit_area->getLayers())
+		snapshot->layers.push_back(layer.snapshot());
+	snapshot->layer_names = inspector_area->layer_names;
+	for (size_t layer = 0; layer < inspector_area->layer_names.size(); layer++)
+		snapshot->layer_visibles.push_back(inspector_area->visible_layers[(int)layer].visible);
+	for (const auto& [id, texture] : palette_area->getTextures()) {
+		SnapshotTexture entry{ id, texture.name, texture.path };
+		SDL_QueryTexture(texture.texture, nullptr, nullptr, &entry.image_w, &entry.image_h);
+		snapshot->textures.push_back(entry);
+	}
+	return snapshot;
+}
+
+void TileMapEditor::updateAutosave(float delta) {
+	if (creating_new || autosave_options.interval_s <= 0) {
+		autosave_elapsed = 0;
+		return;
+	}
+	autosave_elapsed += delta;
+	// Strokes and moved blocks are left for the next frames, they aren't in the layers yet
+	if (autosave_elapsed < std::max(autosave_options.interval_s, MIN_AUTOSAVE_INTERVAL_S) ||
+		edit_area->isEditing() || edit_area->isFloating() || !autosaver.isIdle())
+		return;
+
+	autosave_elapsed = 0;
+	std::string path;
+	// Edits after the snapshot are journaled on top of it
+	if (autosaver.submit(takeSnapshot(), autosave_options, autosaveName(map_path, untitled_id), path))
+		rotateJournal(JournalBaseKind::TMX, path, {}, false);
+}
+
+void TileMapEditor::rotateJournal(
+	JournalBaseKind kind, const std::string& path, std::vector<int> texture_ids, bool written)
+{
+	if (!journal.isOpen())
+		return;
+	JournalBase base{ .kind = kind, .width = map_w, .height = map_h, .tile_size = tile_size };
+	if (kind != JournalBaseKind::NEW_MAP) {
+		std::error_code code;
+		std::filesystem::path absolute = std::filesystem::absolute(path, code);
+		base.path = (code ? path : absolute.string());
+		// Without it, a crash between saving over the base and this rotation replays the records twice
+		if (written && !fingerprintBase(base))
+			std::cout << "Journal: can't read " << base.path << ", it won't be checked on recovery" << std::endl;
+	}
+	if (texture_ids.empty() && palette_area != nullptr)
+		for (const auto& [id, texture] : palette_area->getTextures())
+			texture_ids.push_back(id);
+	base.texture_ids = std::move(texture_ids);
+	journal.rotate(base);
+}
+
+void TileMapEditor::journalTexture(int id) {
+	const std::map<int, Texture>& textures = palette_area->getTextures();
+	auto texture = textures.find(id);
+	if (texture != textures.end())
+		journal.recordSetTexture(id, texture->second.name, texture->second.path);
+	else
+		journal.recordRemoveTexture(id);
+}
+
+bool TileMapEditor::recoverJournal() {
+	TRACE_SCOPE("Recover journal");
+	auto begin_time = std::chrono::steady_clock::now();
+	const JournalBase& base = crashed_journal.front().base;
+	bool loaded = false;
+	switch (base.kind) {
+	case JournalBaseKind::NEW_MAP:
+		tile_size = base.tile_size;
+		map_w = base.width;
+		map_h = base.height;
+		init_viewport();
+		rotateJournal(JournalBaseKind::NEW_MAP, "");
+		loaded = true;
+		break;
+	case JournalBaseKind::TMX:
+		loaded = openTMX(base.path);
+		break;
+	case JournalBaseKind::NATIVE:
+		loaded = openNative(base.path);
+		break;
+	}
+	if (!loaded) {
+		// The files are kept, the next start offers them again
+		std::cout << "Recovery failed: the map the journal applies to can't be opened" << std::endl;
+		crashed_journal.clear();
+		crashed_journal_files.clear();
+		return false;
+	}
+	creating_new = false;
+
+	// From the ids of the crashed session to the ids of the palette. Opening a TMX file
+	// numbers its tilesets from 0, a native file keeps the ids.
+	std::map<int, int> texture_ids;
+	for (size_t index = 0; index < base.texture_ids.size(); index++)
+		texture_ids[base.texture_ids[index]] = (base.kind == JournalBaseKind::TMX ? (int)index : base.texture_ids[index]);
+
+	size_t replayed = 0;
+	for (JournalSegment& segment : crashed_journal) {
+		if (segment.truncated)
+			std::cout << "Journal: " << segment.file << " is truncated, its last edits are lost" << std::endl;
+		for (JournalRecord& record : segment.records)
+			replayJournalRecord(record, texture_ids);
+		replayed += segment.records.size();
+	}
+	// The recovered state is safe before the old journal goes
+	journal.sync();
+	discardCrashedJournal();
+
+	float elapsed_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin_time).count();
+	std::cout << "Recovered " << replayed << " edits in " << elapsed_ms << " ms" << std::endl;
+	return true;
+}
+
+void TileMapEditor::discardCrashedJournal() {
+	for (const std::string& file : crashed_journal_files) {
+		std::error_code code;
+		std::filesystem::remove(file, code);
+	}
+	crashed_journal.clear();
+	crashed_journal_files.clear();
+}
+
+void TileMapEditor::replayJournalRecord(JournalRecord& record, std::map<int, int>& texture_ids) {
+	int layer_count = (int)edit_area->getLayers().size();
+	switch (record.type) {
+	// Patterns are read back as TILES records
+	case JournalRecordType::TILE_PATTERN:
+	case JournalRecordType::TILES: {
+		uint64_t cells = (uint64_t)map_w * map_h;
+		for (const TileDelta::Run& run : record.tiles.runs)
+			if (run.layer >= (uint32_t)layer_count || (uint64_t)run.start + run.length > cells)
+				return;
+		// Tiles of a texture that isn't there anymore are cleared, as when a map is opened
+		auto translate = [&](PackedTile& tile) {
+			if (tile == EMPTY_TILE)
+				return;
+			auto id = texture_ids.find(packedTextureID(tile));
+			if (id == texture_ids.end() || !palette_area->getTextures().contains(id->second))
+				tile = EMPTY_TILE;
+			else
+				tile = ((PackedTile)(id->second + 1) << (PACKED_COORD_BITS * 2)) | (tile & ((1u << (PACKED_COORD_BITS * 2)) - 1));
+		};
+		TileDelta::Pattern& pattern = record.tiles.pattern;
+		if (record.tiles.hasPattern()) {
+			if (pattern.map_width != map_w)
+				return;
+			translate(pattern.origin);
+			if (pattern.origin == EMPTY_TILE) {
+				pattern = TileDelta::Pattern();
+				uint32_t count = 0;
+				for (const TileDelta::Run& run : record.tiles.runs)
+					count += run.length;
+				record.tiles.after.push_back({ EMPTY_TILE, count });
+			}
+		}
+		for (TileDelta::Span& span : record.tiles.after)
+			translate(span.tile);
+		edit_area->applyDelta(record.tiles, true);
+		journal.recordTiles(record.tiles, true);
+		break;
+	}
+	case JournalRecordType::INSERT_LAYER:
+		if (record.index < 0 || record.index > layer_count)
+			return;
+		edit_area->insertLayer(record.index, TileLayer(map_w, map_h));
+		inspector_area->insertLayer(record.index, record.name, record.visible);
+		journal.recordInsertLayer(record.index, record.name, record.visible);
+		break;
+	case JournalRecordType::REMOVE_LAYER:
+		if (record.index < 0 || record.index >= layer_count)
+			return;
+		edit_area->takeLayer(record.index);
+		inspector_area->removeLayer(record.index);
+		journal.recordRemoveLayer(record.index);
+		break;
+	case JournalRecordType::SWAP_LAYERS:
+		if (record.index < 0 || record.index >= layer_count || record.other < 0 || record.other >= layer_count)
+			return;
+		edit_area->onSwap(record.index, record.other);
+		inspector_area->swapLayers(record.index, record.other);
+		journal.recordSwapLayers(record.index, record.other);
+		break;
+	case JournalRecordType::LAYER_PROPERTIES:
+		if (record.index < 0 || record.index >= layer_count)
+			return;
+		inspector_area->layer_names[record.index] = record.name;
+		inspector_area->visible_layers[record.index].visible = record.visible;
+		journal.recordLayerProperties(record.index, record.name, record.visible);
+		break;
+	case JournalRecordType::SET_TEXTURE: {
+		auto mapped = texture_ids.find(record.index);
+		int id = record.index;
+		if (mapped != texture_ids.end())
+			id = mapped->second;
+		else {
+			// New texture of the crashed session, it keeps its id unless another one took it
+			auto taken = [&](int candidate) {
+				if (palette_area->getTextures().contains(candidate))
+					return true;
+				for (const auto& [old_id, new_id] : texture_ids)
+					if (new_id == candidate)
+						return true;
+				return false;
+			};
+			id = std::max(id, 0);
+			while (id < MAX_TEXTURES && taken(id))
+				id++;
+			// Its tiles aren't translated either, they are cleared
+			if (id >= MAX_TEXTURES) {
+				std::cout << "Journal: no texture id left for " << record.path << ", it is dropped along with its tiles" << std::endl;
+				return;
+			}
+			texture_ids[record.index] = id;
+		}
+		Texture texture;
+		texture.name = record.name;
+		texture.path = record.path;
+		texture.texture = cho::loadTexture(texture.path.c_str(), renderer);
+		if (texture.texture == nullptr) {
+			std::cout << "Texture allocation failed: " << texture.path << std::endl;
+			return;
+		}
+		if (palette_area->getTextures().contains(id)) {
+			palette_area->swapTexture(id, texture);
+			SDL_DestroyTexture(texture.texture);
+			edit_area->onTextureChanged(id);
+		}
+		else
+			palette_area->addTexture(id, texture);
+		journalTexture(id);
+		break;
+	}
+	case JournalRecordType::REMOVE_TEXTURE: {
+		auto mapped = texture_ids.find(record.index);
+		if (mapped == texture_ids.end() || !palette_area->getTextures().contains(mapped->second))
+			return;
+		Texture texture = palette_area->takeTexture(mapped->second);
+		if (texture.texture != nullptr)
+			SDL_DestroyTexture(texture.texture);
+		journalTexture(mapped->second);
+		break;
+	}
+	}
+}
+
+namespace {
+	size_t textureMemory(SDL_Texture* texture) {
+		int w = 0, h = 0;
+		if (texture != nullptr)
+			SDL_QueryTexture(texture, nullptr, nullptr, &w, &h);
+		return (size_t)w * h * 4;
+	}
+}
+
+void TileMapEditor::pushTileEdit(TileDelta&& delta) {
+	auto tiles = std::make_shared<TileDelta>(std::move(delta));
+	journal.recordTiles(*tiles, true);
+	HistoryEntry entry;
+	entry.undo = [this, tiles]() {
+		edit_area->applyDelta(*tiles, false);
+		journal.recordTiles(*tiles, false);
+	};
+	entry.redo = [this, tiles]() {
+		edit_area->applyDelta(*tiles, true);
+		journal.recordTiles(*tiles, true);
+	};
+	entry.bytes = tiles->memoryUsage();
+	history.push(std::move(entry));
+}
+
+void TileMapEditor::onAddLayer() {
+	// Layer and texture operations would break a move in progress, so it is put back first
+	edit_area->cancelFloating();
+	int index = (int)edit_area->getLayers().size();
+	edit_area->onAddLayer();
+
+	// The inspector names the layer after this callback returns
+	std::string name = "Layer " + std::to_string(inspector_area->layer_names.size());
+	journal.recordInsertLayer(index, name, true);
+	HistoryEntry entry;
+	entry.undo = [this, index]() {
+		edit_area->takeLayer(index);
+		inspector_area->removeLayer(index);
+		journal.recordRemoveLayer(index);
+	};
+	entry.redo = [this, index, name]() {
+		edit_area->insertLayer(index, TileLayer(map_w, map_h));
+		inspector_area->insertLayer(index, name, true);
+		journal.recordInsertLayer(index, name, true);
+	};
+	history.push(std::move(entry));
+}
+
+void TileMapEditor::onDeleteLayer(int layer) {
+	edit_area->cancelFloating();
+	// The layer is kept here while it is deleted
+	auto removed = std::make_shared<TileLayer>(edit_area->takeLayer(layer));
+	std::string name = inspector_area->layer_names[layer];
+	bool visible = inspector_area->visible_layers[layer].visible;
+	journal.recordRemoveLayer(layer);
+
+	HistoryEntry entry;
+	entry.undo = [this, layer, removed, name, visible]() {
+		journal.recordInsertLayer(layer, name, visible, removed.get());
+		edit_area->insertLayer(layer, std::move(*removed));
+		inspector_area->insertLayer(layer, name, visible);
+	};
+	entry.redo = [this, layer, removed]() {
+		*removed = edit_area->takeLayer(layer);
+		inspector_area->removeLayer(layer);
+		journal.recordRemoveLayer(layer);
+	};
+	entry.bytes = removed->allocatedChunks() * sizeof(TileChunk);
+	history.push(std::move(entry));
+}
+
+void TileMapEditor::onSwapLayers(int a, int b) {
+	edit_area->cancelFloating();
+	edit_area->onSwap(a, b);
+	journal.recordSwapLayers(a, b);
+
+	auto swap = [this, a, b]() {
+		edit_area->onSwap(a, b);
+		inspector_area->swapLayers(a, b);
+		journal.recordSwapLayers(a, b);
+	};
+	history.push({ .undo = swap, .redo = swap });
+}
+
+void TileMapEditor::onAddTexture(int id) {
+	// Holds the texture while it is out of the palette
+	auto removed = std::make_shared<Texture>();
+	journalTexture(id);
+
+	HistoryEntry entry;
+	entry.undo = [this, id, removed]() {
+		*removed = palette_area->takeTexture(id);
+		journalTexture(id);
+	};
+	entry.redo = [this, id, removed]() {
+		palette_area->addTexture(id, *removed);
+		*removed = Texture();
+		journalTexture(id);
+	};
+	entry.release = [removed]() {
+		if (removed->texture != nullptr)
+			SDL_DestroyTexture(removed->texture);
+	};
+	entry.bytes = textureMemory(palette_area->getTextures().at(id).texture);
+	history.push(std::move(entry));
+}
+
+void TileMapEditor::onDeleteTexture(int id, Texture texture) {
+	edit_area->cancelFloating();
+	edit_area->beginEdit();
+	edit_area->onDeleteTexture(id);
+	auto tiles = std::make_shared<TileDelta>(edit_area->endEdit());
+	auto removed = std::make_shared<Texture>(texture);
+	journalTexture(id);
+	journal.recordTiles(*tiles, true);
+
+	HistoryEntry entry;
+	entry.undo = [this, id, tiles, removed]() {
+		palette_area->addTexture(id, *removed);
+		*removed = Texture();
+		edit_area->applyDelta(*tiles, false);
+		journalTexture(id);
+		journal.recordTiles(*tiles, false);
+	};
+	entry.redo = [this, id, tiles, removed]() {
+		*removed = palette_area->takeTexture(id);
+		edit_area->applyDelta(*tiles, true);
+		journalTexture(id);
+		journal.recordTiles(*tiles, true);
+	};
+	entry.release = [removed]() {
+		if (removed->texture != nullptr)
+			SDL_DestroyTexture(removed->texture);
+	};
+	entry.bytes = tiles->memoryUsage() + textureMemory(texture.texture);
+	history.push(std::move(entry));
+}
+
+void TileMapEditor::onReplaceTexture(int id, Texture old_texture, int max_x, int max_y) {
+	edit_area->cancelFloating();
+	edit_area->beginEdit();
+	edit_area->editOnReplaceRemoveTiles(id, max_x, max_y);
+	auto tiles = std::make_shared<TileDelta>(edit_area->endEdit());
+	edit_area->onTextureChanged(id);
+	// Whichever texture isn't in the palette
+	auto other = std::make_shared<Texture>(old_texture);
+	journalTexture(id);
+	journal.recordTiles(*tiles, true);
+
+	HistoryEntry entry;
+	entry.undo = [this, id, tiles, other]() {
+		palette_area->swapTexture(id, *other);
+		edit_area->applyDelta(*tiles, false);
+		edit_area->onTextureChanged(id);
+		journalTexture(id);
+		journal.recordTiles(*tiles, false);
+	};
+	entry.redo = [this, id, tiles, other]() {
+		palette_area->swapTexture(id, *other);
+		edit_area->applyDelta(*tiles, true);
+		edit_area->onTextureChanged(id);
+		journalTexture(id);
+		journal.recordTiles(*tiles, true);
+	};
+	entry.release = [other]() { SDL_DestroyTexture(other->texture); };
+	entry.bytes = tiles->memoryUsage() + textureMemory(old_texture.texture);
+	history.push(std::move(entry));
+}
+
+void TileMapEditor::undo() {
+	// Never in the middle of a stroke or while a popup is open
+	if (edit_area == nullptr || fsm.getCurState() != UC_States::DEFAULT || !allow_input_to_canvas)
+		return;
+	// A floating move is put back first, the history then holds every edit
+	edit_area->cancelFloating();
+	if (edit_area->isEditing())
+		return;
+	history.undo();
+}
+
+void TileMapEditor::redo() {
+	if (edit_area == nullptr || fsm.getCurState() != UC_States::DEFAULT || !allow_input_to_canvas)
+		return;
+	edit_area->cancelFloating();
+	if (edit_area->isEditing())
+		return;
+	history.redo();
+}
+
 bool TileMapEditor::isEndOfScene() {
 	return !running;
 }
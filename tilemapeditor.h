@@ -5,6 +5,7 @@
 #include <imgui.h>
 #include <imgui_impl_sdl2.h>
 #include <imgui_impl_sdlrenderer2.h>
+#include <chrono>
 #include <memory>
 #include <iostream>
 #include <string>
@@ -13,15 +14,33 @@
 #include "EditArea.h"
 #include "PaletteArea.h"
 #include "Inspector.h"
+#include "TMXWriter.h"
+#include "TMXReader.h"
+#include "PNGExporter.h"
+#include "NativeMap.h"
+#include "Autosave.h"
+#include "Journal.h"
+#include "History.h"
+#include "Trace.h"
+#include "InputRecording.h"
 
 const std::string TMX = ".tmx";
 const std::string PNG = ".png";
+const std::string NATIVE = ".tmb";
 
 const std::map<std::string, std::string> format_tooltip = {
 	{TMX, "Uses the TMX format provided by Tiled. \nIt keeps texture/layer/name/hitbox data, and can be edited later."},
+	{NATIVE, "Binary format of this editor, only readable here. \nLarge maps open instantly and saving again only writes the modified chunks."},
 	{PNG, "Renders the entire tilemap to a png file. \nIt becomes a literal image, so you'll just be able to display it and nothing more."}
 };
 
+// Frames still rendered after the last event, ImGui needs a few of them to settle
+constexpr int ACTIVE_FRAMES_AFTER_EVENT{ 3 };
+// Longest wait for an event while idle
+constexpr int IDLE_WAIT_TIMEOUT_MS{ 500 };
+// The first frame after an idle period can be very long, so the delta used for zooming is capped
+constexpr float MAX_ZOOM_DELTA{ 1.0f / 30 };
+
 constexpr bool canDrag(int window, int drag_window) { return drag_window == -1 || window == drag_window;  }
 
 enum class UserControlStates {
@@ -71,17 +90,45 @@ struct TileMapStartupData {
 	int window_w = 1;
 	int window_h = 1;
 	SDL_Color clear_color{ 10, 2, 2, 255 };
+	// Chrome trace written on exit when not empty
+	std::string trace_path{};
+	// Input log written when not empty
+	std::string record_path{};
+	// Sleep until the next event when nothing changes
+	bool idle{ true };
+	AutosaveOptions autosave{};
+	// Write-ahead journal of the edits, replayed after a crash
+	bool journal{ true };
 };
 
 class TileMapEditor : public cho::IScene {
 	ImGuiIO* io{ nullptr };
-	SDL_Texture* edit_area_rend{ nullptr };
-	SDL_Texture* select_area_rend{ nullptr };
-	SDL_Texture* inspector_area_rend{ nullptr };
+	SDL_Renderer* renderer{ nullptr };
+	RenderTarget edit_area_target;
+	RenderTarget palette_area_target;
 	std::unique_ptr<EditArea> edit_area;
 	std::unique_ptr<PaletteArea> palette_area;
 	std::unique_ptr<InspectorArea> inspector_area;
 	TM_FSM fsm;
+	History history;
+	InputRecorder input_recorder;
+	uint32_t frame_index{ 0 };
+	// File the layers' chunks are paged from, when the map was opened or saved as NATIVE
+	std::shared_ptr<MappedFile> native_file{ nullptr };
+	// Compressed bands of the last TMX save, reused for the layers that weren't modified since
+	TMXSaveCache tmx_cache;
+	Autosaver autosaver;
+	AutosaveOptions autosave_options;
+	// Seconds since the last autosave
+	float autosave_elapsed{ 0 };
+	// File the map was last opened from or saved to, its autosaves are named after it
+	std::string map_path{};
+	// Names the autosaves of a map that was never saved
+	std::string untitled_id{};
+	Journal journal;
+	// Left by a session that crashed, recovery is offered while it isn't empty
+	std::vector<JournalSegment> crashed_journal;
+	std::vector<std::string> crashed_journal_files;
 	
 	std::shared_ptr<TileMapStartupData> start_data{ nullptr };
 	int window_w = 1;
@@ -91,8 +138,12 @@ class TileMapEditor : public cho::IScene {
 	int tile_size = 1;
 
 	std::string cur_format = TMX;
+	TMXEncoding cur_encoding = TMXEncoding::BASE64_ZLIB;
 	
 	const float wheel_speed = 1.2f;
+	// Number of frames left before going idle, the edit/palette areas are only re-rendered while > 0
+	int active_frames = ACTIVE_FRAMES_AFTER_EVENT;
+	bool idle_mode = true;
 	bool 
 		creating_new = true,	
 		saving = false,
@@ -101,6 +152,41 @@ class TileMapEditor : public cho::IScene {
 	MouseMotion mouse;
 	
 	void init_viewport();
+	void requestRedraw() { active_frames = ACTIVE_FRAMES_AFTER_EVENT; }
+	bool saveTMX(const std::string& path);
+	bool openTMX(const std::string& path);
+	bool savePNG(const std::string& path);
+	bool saveNative(const std::string& path);
+	bool openNative(const std::string& path);
+	// Copy-on-write copy of the layers, names and textures, cheap enough to take between two frames
+	std::unique_ptr<MapSnapshot> takeSnapshot();
+	void updateAutosave(float delta);
+	// The journal starts over from the current state, which can be loaded from the given file.
+	// Texture ids are those of the palette unless given. A file already written is fingerprinted,
+	// an autosave still being written by its worker isn't.
+	void rotateJournal(
+		JournalBaseKind kind, const std::string& path, std::vector<int> texture_ids = {}, bool written = true);
+	// Records the texture currently in the palette at this id, or its removal
+	void journalTexture(int id);
+	bool recoverJournal();
+	void discardCrashedJournal();
+	// Applies a record from a crashed session, and journals it again for this one
+	void replayJournalRecord(JournalRecord& record, std::map<int, int>& texture_ids);
+
+	// Undoable operations, each one pushes a history entry
+	void pushTileEdit(TileDelta&& delta);
+	void onAddLayer();
+	void onDeleteLayer(int layer);
+	void onSwapLayers(int a, int b);
+	void onAddTexture(int id);
+	void onDeleteTexture(int id, Texture texture);
+	void onReplaceTexture(int id, Texture old_texture, int max_x, int max_y);
+	void undo();
+	void redo();
+	// Pasting and moving happen with the select brush
+	void startPaste();
+	void startMove();
+	void processClipboardKey(const SDL_Keysym& key);
 public:
 	void start(std::shared_ptr<void> data, cho::SDLPointers pointers) override;
 	void processEvent(const SDL_Event& event) override;
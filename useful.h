@@ -7,6 +7,9 @@
 
 constexpr int BRUSH_BASIC{ 0 };
 constexpr int BRUSH_RECTANGLE{ 1 };
+constexpr int BRUSH_FILL{ 2 };
+constexpr int BRUSH_SELECT{ 3 };
+constexpr int MAX_TEXTURES{ 100 };
 constexpr int FOCUSED_EDIT{ 1 };
 constexpr int FOCUSED_PALETTE{ 2 };
 constexpr float EDIT_WIDTH{ 0.5f };
@@ -61,6 +64,4 @@ inline bool isValidSelection(TileSelection selection) {
 		selection.bottomright.x < 0 || selection.bottomright.y < 0);
 }
 
-using TileMap = std::vector<std::vector<Tile>>;
-
 #endif